@@ -110,4 +110,58 @@ public:
 };
 
 
+class Eigen_NotConverged : public Exception {
+
+public:
+
+    explicit Eigen_NotConverged(const std::string &message) : Exception(message) {}
+
+};
+
+
+class Eigen_ComplexSpectrum : public Exception {
+
+public:
+
+    explicit Eigen_ComplexSpectrum(const std::string &message) : Exception(message) {}
+
+};
+
+
+class Preconditioner_Breakdown : public Exception {
+
+public:
+
+    explicit Preconditioner_Breakdown(const std::string &message) : Exception(message) {}
+
+};
+
+
+class Cholesky_NotPositiveDefinite : public Exception {
+
+public:
+
+    explicit Cholesky_NotPositiveDefinite(const std::string &message) : Exception(message) {}
+
+};
+
+
+class SVD_NotConverged : public Exception {
+
+public:
+
+    explicit SVD_NotConverged(const std::string &message) : Exception(message) {}
+
+};
+
+
+class Conv_KernelNotSeparable : public Exception {
+
+public:
+
+    explicit Conv_KernelNotSeparable(const std::string &message) : Exception(message) {}
+
+};
+
+
 #endif
\ No newline at end of file
@@ -6,26 +6,420 @@
 
 #define random(a, b) (rand()%(b-a)+a)
 
-#include <unordered_map>
 #include <memory>
 #include <cstddef>
 #include <vector>
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <complex>
+#include <algorithm>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <functional>
+#include <random>
+#include <atomic>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
 #include "Exception.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86_DISPATCH 1
+#endif
+
+inline int threadCount() { // number of worker threads used by the parallel kernels
+    static const int n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+}
+
+inline bool &inParallelRegion() { // true while the current thread runs a parallelFor() chunk
+    static thread_local bool flag = false;
+    return flag;
+}
+
+/*
+ * threadCount() - 1 persistent workers behind parallelFor(), started on first use and joined at exit. One job runs
+ * at a time: its chunks are claimed one by one by the workers and the submitting thread alike, and the job lives on
+ * the submitter's stack, so running a loop allocates nothing. A thread that finds the pool busy runs its loop inline.
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex owner; // held by the thread whose job is running
+    std::mutex mutex; // guards everything below
+    std::condition_variable wake, finished;
+    unsigned long long generation = 0;
+    bool stop = false;
+    void (*task)(void *, long long) = nullptr;
+    void *context = nullptr;
+    long long chunks = 0, next = 0, unfinished = 0;
+    std::exception_ptr error; // first exception thrown by a chunk, rethrown by run()
+
+    void runChunks(unsigned long long job) {
+        while (true) {
+            long long t;
+            void (*fn)(void *, long long);
+            void *ctx;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (generation != job || next >= chunks) return;
+                t = next++, fn = task, ctx = context;
+            }
+            std::exception_ptr e;
+            try {
+                fn(ctx, t);
+            } catch (...) {
+                e = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (e && !error) error = e;
+            if (--unfinished == 0) finished.notify_all();
+        }
+    }
+
+public:
+    explicit ThreadPool(int n) {
+        for (int i = 0; i < n; i++) {
+            workers.emplace_back([this]() {
+                inParallelRegion() = true; // loops nested in a chunk run inline
+                unsigned long long seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&]() { return stop || generation != seen; });
+                        if (stop) return;
+                        seen = generation;
+                    }
+                    runChunks(seen);
+                }
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &w: workers) w.join();
+    }
+
+    // run fn(ctx, t) for t in [0, n) on the workers and the calling thread; false, without running, if busy
+    bool run(void (*fn)(void *, long long), void *ctx, long long n) {
+        std::unique_lock<std::mutex> own(owner, std::try_to_lock);
+        if (!own.owns_lock()) return false;
+        unsigned long long job;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = fn, context = ctx, chunks = n, next = 0, unfinished = n;
+            job = ++generation;
+        }
+        wake.notify_all();
+        runChunks(job);
+        std::exception_ptr e;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&]() { return unfinished == 0; });
+            std::swap(e, error);
+        }
+        if (e) std::rethrow_exception(e);
+        return true;
+    }
+};
+
+inline ThreadPool &threadPool() {
+    static ThreadPool pool(threadCount() - 1);
+    return pool;
+}
+
+/*
+ * Run f(lo, hi) over [begin, end) split into at most threadCount() contiguous chunks of at least `grain` items on
+ * the pool. Small ranges, and calls nested inside another parallelFor(), run inline. An exception thrown by a chunk
+ * is rethrown here once every chunk has finished.
+ */
+template<class F>
+void parallelFor(long long begin, long long end, long long grain, F &&f) {
+    long long n = end - begin;
+    if (n <= 0) return;
+    long long parts = std::min<long long>(threadCount(), std::max<long long>(1, n / std::max<long long>(1, grain)));
+    if (parts <= 1 || inParallelRegion()) {
+        f(begin, end);
+        return;
+    }
+    struct Job {
+        std::remove_reference_t<F> *f;
+        long long begin, n, parts;
+    } job{&f, begin, n, parts};
+    struct Region { // also reset when a chunk throws
+        Region() { inParallelRegion() = true; }
+
+        ~Region() { inParallelRegion() = false; }
+    } region;
+    bool ran = threadPool().run([](void *ctx, long long t) {
+        Job &j = *static_cast<Job *>(ctx);
+        (*j.f)(j.begin + j.n * t / j.parts, j.begin + j.n * (t + 1) / j.parts);
+    }, &job, parts);
+    if (!ran) f(begin, end);
+}
+
+template<class T>
+struct SparseTriplet {
+    long long row; // 0-based row
+    long long col; // 0-based column
+    T val;
+};
+
+// process-wide unique stamp for a new sparsity pattern
+inline unsigned long long newSparsePattern() {
+    static std::atomic<unsigned long long> next{0};
+    return ++next;
+}
+
+/*
+ * Compressed sparse storage. Used as CSR, entries of row r are idx[ptr[r]] .. idx[ptr[r + 1] - 1] (column indices,
+ * sorted) with values in val; used as CSC the roles of rows and columns are swapped.
+ * Writes to positions which are not yet in the pattern, and zeros written over stored entries, are staged in the
+ * COO list `pending` and merged into the compressed arrays by compress(), so random insertion stays cheap and reads
+ * stream contiguously. `staged` maps row * inner + column to the slot in `pending`, so a position is staged at most
+ * once and point reads find staged values without compressing.
+ * `pattern` identifies ptr/idx: compress() takes a new stamp when it changes them, value updates keep it, and copies
+ * share it while their patterns are equal. Code filling a freshly constructed storage needs no new stamp.
+ */
+template<class T>
+struct SparseStorage {
+    long long outer = 0; // number of rows (CSR) or columns (CSC)
+    long long inner = 0; // number of columns (CSR) or rows (CSC)
+    std::vector<long long> ptr;
+    std::vector<int> idx;
+    std::vector<T> val;
+    unsigned long long pattern = newSparsePattern();
+    std::vector<SparseTriplet<T>> pending;
+    std::unordered_map<long long, size_t> staged;
+
+    SparseStorage() = default;
+
+    SparseStorage(long long outer, long long inner) : outer(outer), inner(inner), ptr(outer + 1, 0) {}
+
+    long long nonZeros() const { return (long long) val.size(); }
+
+    long long find(long long o, long long i) const; // position of (o, i) in idx/val, -1 if not stored
+
+    void compress(); // merge pending triplets, the last write to a position wins and zeros are dropped
+
+    SparseStorage<T> transpose() const; // CSR <-> CSC
+};
+
+template<class T>
+long long SparseStorage<T>::find(long long o, long long i) const {
+    auto first = idx.begin() + ptr[o];
+    auto last = idx.begin() + ptr[o + 1];
+    auto it = std::lower_bound(first, last, (int) i);
+    if (it == last || *it != i) return -1;
+    return it - idx.begin();
+}
+
+template<class T>
+void SparseStorage<T>::compress() {
+    if (pending.empty()) return;
+    std::stable_sort(pending.begin(), pending.end(), [](const SparseTriplet<T> &a, const SparseTriplet<T> &b) {
+        return a.row != b.row ? a.row < b.row : a.col < b.col;
+    });
+    std::vector<long long> nptr(outer + 1, 0);
+    std::vector<int> nidx;
+    std::vector<T> nval;
+    nidx.reserve(idx.size() + pending.size());
+    nval.reserve(idx.size() + pending.size());
+    size_t q = 0;
+    for (long long r = 0; r < outer; r++) {
+        long long p = ptr[r];
+        long long pe = ptr[r + 1];
+        while (p < pe || (q < pending.size() && pending[q].row == r)) {
+            if (q < pending.size() && pending[q].row == r && (p == pe || pending[q].col <= idx[p])) {
+                while (q + 1 < pending.size() && pending[q + 1].row == r && pending[q + 1].col == pending[q].col) q++;
+                if (p < pe && idx[p] == pending[q].col) p++;
+                if (pending[q].val != T(0)) {
+                    nidx.push_back((int) pending[q].col);
+                    nval.push_back(pending[q].val);
+                }
+                q++;
+            } else {
+                if (val[p] != T(0)) {
+                    nidx.push_back(idx[p]);
+                    nval.push_back(val[p]);
+                }
+                p++;
+            }
+        }
+        nptr[r + 1] = (long long) nidx.size();
+    }
+    if (nptr != ptr || nidx != idx) pattern = newSparsePattern();
+    ptr.swap(nptr);
+    idx.swap(nidx);
+    val.swap(nval);
+    pending.clear();
+    pending.shrink_to_fit();
+    staged.clear();
+}
+
+template<class T>
+SparseStorage<T> SparseStorage<T>::transpose() const {
+    SparseStorage<T> t(inner, outer);
+    t.idx.resize(idx.size());
+    t.val.resize(val.size());
+    for (int i: idx) t.ptr[i + 1]++;
+    for (long long i = 0; i < inner; i++) t.ptr[i + 1] += t.ptr[i];
+    std::vector<long long> next(t.ptr.begin(), t.ptr.end() - 1);
+    for (long long o = 0; o < outer; o++) {
+        for (long long p = ptr[o]; p < ptr[o + 1]; p++) {
+            long long dst = next[idx[p]]++;
+            t.idx[dst] = (int) o;
+            t.val[dst] = val[p];
+        }
+    }
+    return t;
+}
+
+template<class T>
+class LU;
+
+template<class T>
+class HouseholderQR;
+
+template<class T>
+class SymmetricEigen;
+
+template<class T>
+class GeneralEigen;
+
+template<class T>
+class SVD;
+
+template<class T>
+class Mat;
+
+// algorithm used by Mat::conv: the sliding window, FFT with overlap-save tiling, two 1-D passes for a rank-1 kernel,
+// or Winograd minimal filtering for 3 x 3 and 5 x 5 float and double kernels (anything else falls back to Direct);
+// Auto picks Separable whenever the kernel is rank 1, otherwise FFT or Direct by kernel size; Winograd only runs on
+// request, since on a single channel the direct kernel measured faster
+enum class ConvMethod {
+    Auto,
+    Direct,
+    FFT,
+    Separable,
+    Winograd
+};
+
+// how Mat::conv reads samples outside the input: zeros, the nearest edge sample, the mirror image about the edge
+// sample (dcb|abcd|cba), or the periodic continuation
+enum class ConvBorder {
+    Zero,
+    Replicate,
+    Reflect,
+    Wrap
+};
+
+// output of Mat::conv: the input's size, only the windows inside the input, or every window touching the input
+enum class ConvShape {
+    Same,
+    Valid,
+    Full
+};
+
+// a derived result together with the storage version it was computed for
+template<class V>
+struct CachedValue {
+    unsigned long long version = ~0ULL;
+    std::shared_ptr<V> value;
+
+    bool valid(unsigned long long current) const { return value != nullptr && version == current; }
+};
+
+// Frobenius, 1 (max column abs sum) and infinity (max row abs sum) norms
+struct MatNorms {
+    double fro = 0;
+    double one = 0;
+    double inf = 0;
+};
+
+/*
+ * Lazily computed results of a matrix. They are valid while *version, the modification counter of the
+ * underlying storage, still equals the version they were computed for. Shallow copies of a Mat share the cache;
+ * submatrix views share only the counter with their parent, so writes through a view invalidate both.
+ */
+template<class T>
+struct MatCache {
+    std::shared_ptr<unsigned long long> version = std::make_shared<unsigned long long>(0);
+    CachedValue<LU<T>> lu;
+    CachedValue<T> det;
+    CachedValue<Mat<T>> inverse;
+    CachedValue<Mat<T>> transpose;
+    CachedValue<MatNorms> norms;
+    CachedValue<std::vector<double>> singularValues;
+};
+
+// a column (or any other strided sequence) of a dense matrix, indexed from 0
+template<class T>
+struct StridedView {
+    T *ptr = nullptr;
+    long long stride = 1;
+    long long length = 0;
+
+    T &operator[](long long i) const { return ptr[i * stride]; }
+
+    long long size() const { return length; }
+};
+
+// sum, minimum and maximum of a sequence with the (0-based) positions of the first minimum and maximum
+template<class T>
+struct RangeStats {
+    T sum;
+    T min;
+    T max;
+    long long argmin;
+    long long argmax;
+};
+
+// per-row or per-column reductions of a matrix, positions are 1-based like get()/set()
+template<class T>
+struct AxisStats {
+    std::vector<T> sum;
+    std::vector<T> min;
+    std::vector<T> max;
+    std::vector<int> argmin;
+    std::vector<int> argmax;
+};
+
+template<class T>
+RangeStats<T> rangeStats(const T *a, long long n); // n >= 1, vectorized for float and double
+
+template<class T>
+T rangeSum(const T *a, long long n);
+
+template<class T>
+T rangeMax(const T *a, long long n); // n >= 1
+
+template<class T>
+T rangeMin(const T *a, long long n); // n >= 1
+
 template<class T>
 class Mat {
     long long getIndex(int x, int y) const; // return the offset of Mat[x][y]
     double EPS = 1e-9;
 public:
-    std::shared_ptr<std::unordered_map<int, T>> pMap; // hashmap to store elements in sparse matrix
+    std::shared_ptr<SparseStorage<T>> pSparse; // CSR storage of a sparse matrix
     std::shared_ptr<T[]> pData; // array to store elements in dense matrix
     long long row = 0; // number of rows
     long long col = 0; // number of columns
     long long step = 0; // used for computing the index of next row
     bool isSparse = false; // 0 for dense matrix and 1 for sparse matrix
+    mutable std::shared_ptr<MatCache<T>> pCache; // cached factorizations, norms and transpose
 
     Mat() = default;
 
@@ -36,12 +430,60 @@ public:
     void set(int x, int y, T val); // set Mat[x][y] to val
     T get(int, int) const; // return Mat[x][y]
 
+    // compressed rows of a sparse matrix, pending writes are merged first; the merge updates storage shared by
+    // copies, so call csr() once before const reads of a freshly written matrix run concurrently (get() never merges)
+    const SparseStorage<T> &csr() const;
+
+    SparseStorage<T> csc() const; // compressed columns of a sparse matrix
+
+    long long nonZeros() const; // number of stored elements
+
+    // Unchecked access for inner loops on dense matrices. Indices are 1-based like get()/set(), bounds are only
+    // asserted in debug builds. Rows are contiguous, consecutive rows are `step` elements apart.
+    // Writes through these bypass set() and leave version() alone: call touch() afterwards so cached results are
+    // recomputed.
+    T &operator()(int x, int y);
+
+    const T &operator()(int x, int y) const;
+
+    T *rowPtr(int x); // address of Mat[x][1]
+
+    const T *rowPtr(int x) const;
+
+    StridedView<T> colView(int y); // Mat[1..row][y], view[0] is Mat[1][y]
+
+    StridedView<const T> colView(int y) const;
+
+    MatCache<T> &cache() const; // cache of derived results, created on first use
+
+    unsigned long long version() const; // modification counter of the storage
+
+    void touch(); // mark the matrix as modified, invalidating every cached result
+
+    const LU<T> &lu(); // LU factorization, computed once per version
+
+    const Mat<T> &transposed(); // cached transpose, read-only (clone() it before modifying)
+
+    double normFro(); // Frobenius norm, cached
+
+    double norm1(); // maximum absolute column sum, cached
+
+    double normInf(); // maximum absolute row sum, cached
+
 
     Mat<T> transpose();
 
     Mat<T> resize(int x, int y);
 
-    Mat<T> conv(Mat<T> &kernel);
+    // cross-correlation, the kernel centered at (kernel.row / 2, kernel.col / 2) for ConvShape::Same
+    Mat<T> conv(const Mat<T> &kernel, ConvBorder border = ConvBorder::Zero, ConvShape shape = ConvShape::Same,
+                ConvMethod method = ConvMethod::Auto) const;
+
+    Mat<T> conv(const Mat<T> &kernel, ConvMethod method) const; // zero border, same size as this matrix
+
+    // conv() with the kernel colKernel * rowKernel, given as a column and a row vector (either orientation is accepted)
+    Mat<T> convSeparable(const Mat<T> &colKernel, const Mat<T> &rowKernel, ConvBorder border = ConvBorder::Zero,
+                         ConvShape shape = ConvShape::Same) const;
 
     template<class T2>
     friend Mat<T2> dotMuilt(Mat<T2> const &lhs, Mat<T2> const &rhs);
@@ -62,10 +504,10 @@ public:
     friend Mat<T2> operator*(Mat<T2> const &lhs, Mat<T2> const &rhs);
 
     template<class T2>
-    friend Mat<T2> operator*(std::vector<T> const &lhs, Mat<T2> const &rhs);
+    friend Mat<T2> operator*(std::vector<T2> const &lhs, Mat<T2> const &rhs);
 
     template<class T2>
-    friend Mat<T2> operator*(Mat<T2> const &lhs, std::vector<T> const &rhs);
+    friend Mat<T2> operator*(Mat<T2> const &lhs, std::vector<T2> const &rhs);
 
     T min();
 
@@ -87,6 +529,18 @@ public:
 
     T maxCol(int c);
 
+    AxisStats<T> rowStats(); // sum, min, max, argmin and argmax of every row in one pass
+
+    AxisStats<T> colStats(); // sum, min, max, argmin and argmax of every column in one pass
+
+    std::vector<T> sumRows(); // sums of all rows
+
+    std::vector<T> sumCols(); // sums of all columns
+
+    std::pair<int, int> argMin(); // (row, column) of the first minimum
+
+    std::pair<int, int> argMax(); // (row, column) of the first maximum
+
     void print(bool hasIndex = true, int width = 5); // print the matrix with specified width for each element
 
     Mat<T> clone(); // deep copy
@@ -95,9 +549,15 @@ public:
 
     Mat<T> gauss(int &rowCount);
 
-    int rank();
+    int rank(double tol = -1); // singular values > tol, tol < 0: max(m, n) * eps * largest singular value
+
+    std::vector<double> singularValues(); // descending, cached
 
-    Mat<T> getSubmatrix(int colstart, int colend, int rowstart, int rowend);    // 获取子矩阵，也是自用
+    double cond(); // 2-norm condition number, largest / smallest singular value
+
+    Mat<T> pinv(double tol = -1); // Moore-Penrose pseudo-inverse from the SVD
+
+    Mat<T> getSubmatrix(int rowstart, int rowend, int colstart, int colend);    // 获取子矩阵，也是自用
 
     Mat<T> getCominor(int x, int y);
 
@@ -124,24 +584,25 @@ public:
 
     Mat<T> inverse();
 
-    void QR(Mat<T> &Q, Mat<T> &R); // 利用施密特正交化进行QR分解，这个方法并不是很成熟，就不让外部调用了
+    void QR(Mat<T> &Q, Mat<T> &R, bool thin = false); // A = Q * R, Q is m x m (thin: m x min(m, n)), R is m x n (thin: min(m, n) x n)
 
     void setZero();
 
     Mat<T> unitMatGen(int x);
 
-    void eigen(Mat<T> &value, Mat<T> &vector);
+    void eigen(Mat<T> &value, Mat<T> &vector); // eigenvalues into value (1 x n), eigenvectors into the columns of vector, ascending eigenvalues
 
 };
 
 template<class T>
 Mat<T>::Mat(int row, int col, std::vector<T> *list, bool isSparse) {
+    this->pCache = std::make_shared<MatCache<T>>();
     this->row = row;
     this->col = col;
     this->step = col;
     this->isSparse = isSparse;
     if (this->isSparse) {
-        this->pMap = std::shared_ptr<std::unordered_map<int, T>>(new std::unordered_map<int, T>);
+        this->pSparse = std::make_shared<SparseStorage<T>>(this->row, this->col);
     } else {
         this->pData = std::shared_ptr<T[]>(new T[this->row * this->col]);
         for (int i = 0; i < this->row; i++) {
@@ -154,7 +615,7 @@ Mat<T>::Mat(int row, int col, std::vector<T> *list, bool isSparse) {
         int cnt = 0;
         for (int i = 1; i <= row; i++) {
             for (int j = 1; j <= col; j++) {
-                if (cnt < (*list).size()) {
+                if (cnt < (int) (*list).size()) {
                     this->set(i, j, (*list)[cnt]);
                     cnt++;
                 } else {
@@ -162,6 +623,9 @@ Mat<T>::Mat(int row, int col, std::vector<T> *list, bool isSparse) {
                 }
             }
         }
+        if (this->isSparse) {
+            this->pSparse->compress();
+        }
     }
 }
 
@@ -174,8 +638,22 @@ void Mat<T>::set(int x, int y, T val) {
     }
     x--;
     y--;
+    this->touch();
     if (this->isSparse) {
-        (*this->pMap)[this->getIndex(x, y)] = val;
+        SparseStorage<T> &s = *this->pSparse;
+        long long key = (long long) x * s.inner + y;
+        auto it = s.staged.find(key);
+        if (it != s.staged.end()) {
+            s.pending[it->second].val = val;
+            return;
+        }
+        long long pos = s.find(x, y);
+        if (pos >= 0 && val != T(0)) {
+            s.val[pos] = val;
+        } else if (pos >= 0 || val != T(0)) { // a zero over a stored entry is staged so that compress() drops it
+            s.staged.emplace(key, s.pending.size());
+            s.pending.push_back({x, y, val});
+        }
     } else {
         this->pData[this->getIndex(x, y)] = val;
     }
@@ -191,10 +669,15 @@ void Mat<T>::toDense() {
                 this->pData[getIndex(i, j)] = 0;
             }
         }
-        for (auto kv: (*this->pMap)) {
-            this->pData[kv.first] = kv.second;
+        this->pSparse->compress();
+        const SparseStorage<T> &s = *this->pSparse;
+        for (long long i = 0; i < this->row; i++) {
+            for (long long p = s.ptr[i]; p < s.ptr[i + 1]; p++) {
+                this->pData[getIndex(i, s.idx[p])] = s.val[p];
+            }
         }
-        this->pMap = nullptr;
+        this->pSparse = nullptr;
+        this->pCache = std::make_shared<MatCache<T>>(); // the new storage is owned by this matrix alone
     }
 }
 
@@ -202,15 +685,20 @@ template<class T>
 void Mat<T>::toSparse() {
     if (!this->isSparse) {
         this->isSparse = true;
-        this->pMap = std::shared_ptr<std::unordered_map<int, T>>(new std::unordered_map<int, T>);
+        this->pSparse = std::make_shared<SparseStorage<T>>(this->row, this->col);
+        SparseStorage<T> &s = *this->pSparse;
         for (int i = 0; i < this->row; i++) {
             for (int j = 0; j < this->col; j++) {
-                if (this->pData[getIndex(i, j)] != 0) {
-                    (*this->pMap)[getIndex(i, j)] = this->pData[getIndex(i, j)];
+                if (this->pData[getIndex(i, j)] != T(0)) {
+                    s.idx.push_back(j);
+                    s.val.push_back(this->pData[getIndex(i, j)]);
                 }
             }
+            s.ptr[i + 1] = (long long) s.idx.size();
         }
+        this->step = this->col;
         this->pData = nullptr;
+        this->pCache = std::make_shared<MatCache<T>>();
     }
 }
 
@@ -229,16 +717,196 @@ T Mat<T>::get(int x, int y) const {
     x--;
     y--;
     if (this->isSparse) {
-        if ((*this->pMap).find(this->getIndex(x, y)) == (*this->pMap).end()) {
-            return 0;
-        } else {
-            return (*this->pMap)[this->getIndex(x, y)];
+        const SparseStorage<T> &s = *this->pSparse;
+        if (!s.pending.empty()) {
+            auto it = s.staged.find((long long) x * s.inner + y);
+            if (it != s.staged.end()) return s.pending[it->second].val;
         }
+        long long pos = s.find(x, y);
+        return pos < 0 ? T(0) : s.val[pos];
     } else {
         return this->pData[this->getIndex(x, y)];
     }
 }
 
+template<class T>
+T &Mat<T>::operator()(int x, int y) {
+    assert(!this->isSparse && x >= 1 && x <= this->row && y >= 1 && y <= this->col);
+    return this->pData[(x - 1) * this->step + (y - 1)];
+}
+
+template<class T>
+const T &Mat<T>::operator()(int x, int y) const {
+    assert(!this->isSparse && x >= 1 && x <= this->row && y >= 1 && y <= this->col);
+    return this->pData[(x - 1) * this->step + (y - 1)];
+}
+
+template<class T>
+T *Mat<T>::rowPtr(int x) {
+    assert(!this->isSparse && x >= 1 && x <= this->row);
+    return this->pData.get() + (x - 1) * this->step;
+}
+
+template<class T>
+const T *Mat<T>::rowPtr(int x) const {
+    assert(!this->isSparse && x >= 1 && x <= this->row);
+    return this->pData.get() + (x - 1) * this->step;
+}
+
+template<class T>
+StridedView<T> Mat<T>::colView(int y) {
+    assert(!this->isSparse && y >= 1 && y <= this->col);
+    return {this->pData.get() + (y - 1), this->step, this->row};
+}
+
+template<class T>
+StridedView<const T> Mat<T>::colView(int y) const {
+    assert(!this->isSparse && y >= 1 && y <= this->col);
+    return {this->pData.get() + (y - 1), this->step, this->row};
+}
+
+template<class T>
+MatCache<T> &Mat<T>::cache() const {
+    if (this->pCache == nullptr) this->pCache = std::make_shared<MatCache<T>>();
+    return *this->pCache;
+}
+
+template<class T>
+unsigned long long Mat<T>::version() const {
+    return *this->cache().version;
+}
+
+template<class T>
+void Mat<T>::touch() {
+    ++*this->cache().version;
+}
+
+template<class T>
+const LU<T> &Mat<T>::lu() {
+    MatCache<T> &c = this->cache();
+    if (!c.lu.valid(*c.version)) {
+        c.lu.value = std::make_shared<LU<T>>(*this);
+        c.lu.version = *c.version;
+    }
+    return *c.lu.value;
+}
+
+template<class T>
+const Mat<T> &Mat<T>::transposed() {
+    MatCache<T> &c = this->cache();
+    if (!c.transpose.valid(*c.version)) {
+        c.transpose.value = std::make_shared<Mat<T>>(this->transpose());
+        c.transpose.version = *c.version;
+    }
+    return *c.transpose.value;
+}
+
+template<class T>
+double Mat<T>::normFro() {
+    MatCache<T> &c = this->cache();
+    if (!c.norms.valid(*c.version)) {
+        MatNorms nm;
+        std::vector<double> colSum(this->col, 0.0);
+        double sq = 0;
+        for (int i = 1; i <= this->row; i++) {
+            double rowSum = 0;
+            if (this->isSparse) {
+                const SparseStorage<T> &s = this->csr();
+                for (long long p = s.ptr[i - 1]; p < s.ptr[i]; p++) {
+                    double v = std::abs(s.val[p]);
+                    rowSum += v;
+                    colSum[s.idx[p]] += v;
+                    sq += v * v;
+                }
+            } else {
+                const T *r = this->rowPtr(i);
+                for (long long j = 0; j < this->col; j++) {
+                    double v = std::abs(r[j]);
+                    rowSum += v;
+                    colSum[j] += v;
+                    sq += v * v;
+                }
+            }
+            nm.inf = std::max(nm.inf, rowSum);
+        }
+        for (double v: colSum) nm.one = std::max(nm.one, v);
+        nm.fro = std::sqrt(sq);
+        c.norms.value = std::make_shared<MatNorms>(nm);
+        c.norms.version = *c.version;
+    }
+    return c.norms.value->fro;
+}
+
+template<class T>
+double Mat<T>::norm1() {
+    this->normFro();
+    return this->cache().norms.value->one;
+}
+
+template<class T>
+double Mat<T>::normInf() {
+    this->normFro();
+    return this->cache().norms.value->inf;
+}
+
+template<class T>
+const SparseStorage<T> &Mat<T>::csr() const {
+    if (!this->isSparse) {
+        throw ClassTypeNotSupport("csr() requires a sparse matrix");
+    }
+    this->pSparse->compress();
+    return *this->pSparse;
+}
+
+template<class T>
+SparseStorage<T> Mat<T>::csc() const {
+    return this->csr().transpose();
+}
+
+template<class T>
+long long Mat<T>::nonZeros() const {
+    if (this->isSparse) {
+        return this->csr().nonZeros();
+    }
+    long long cnt = 0;
+    for (long long i = 0; i < this->row; i++) {
+        for (long long j = 0; j < this->col; j++) {
+            if (this->pData[getIndex(i, j)] != T(0)) cnt++;
+        }
+    }
+    return cnt;
+}
+
+/*
+ * Map-style builder for sparse matrices: positions may be added in any order, the last value added for a
+ * position wins. build() sorts the triplets once and returns a matrix in CSR form.
+ */
+template<class T>
+class SparseBuilder {
+    long long row;
+    long long col;
+    std::vector<SparseTriplet<T>> triplets;
+public:
+    SparseBuilder(long long row, long long col) : row(row), col(col) {}
+
+    void reserve(size_t n) { triplets.reserve(n); }
+
+    void add(long long x, long long y, T val) { // 1-based like Mat::set
+        if (x < 1 || y < 1 || x > row || y > col) {
+            throw InvalidCoordinatesException("Index out of range");
+        }
+        triplets.push_back({x - 1, y - 1, val});
+    }
+
+    Mat<T> build() {
+        Mat<T> ans((int) row, (int) col, nullptr, true);
+        ans.pSparse->pending.swap(triplets);
+        ans.pSparse->compress();
+        triplets.clear();
+        return ans;
+    }
+};
+
 template<class T>
 void Mat<T>::print(bool hasIndex, int w) {
     if (hasIndex) {
@@ -282,62 +950,80 @@ void Mat<T>::print(bool hasIndex, int w) {
 
 template<class T>
 Mat<T> Mat<T>::clone() {
-    std::vector<T> tmp(this->row * this->col, 0);
-    Mat<T> rt(this->row, this->col, &tmp, this->isSparse);
-    rt.step = this->step;
+    Mat<T> rt(this->row, this->col, nullptr, this->isSparse);
     if (this->isSparse) {
-        for (auto kv: (*this->pMap)) {
-            (*rt.pMap)[kv.first] = kv.second;
-        }
+        *rt.pSparse = this->csr();
     } else {
         for (int i = 1; i <= this->row; i++) {
-            for (int j = 1; j <= this->col; j++) {
-                rt.set(i, j, this->get(i, j));
-            }
+            const T *r = this->rowPtr(i);
+            std::copy(r, r + this->col, rt.rowPtr(i));
         }
     }
     return rt;
 }
 
+// largest (Max) or smallest element of a non-empty dense matrix, blocks of rows are reduced in parallel
+template<bool Max, class T>
+T denseExtreme(const Mat<T> &a) {
+    long long parts = std::min<long long>(threadCount(), std::max<long long>(1, (long long) a.row * a.col / 65536));
+    parts = std::min<long long>(parts, a.row);
+    std::vector<T> best(parts);
+    auto reduce = [](const T *p, long long n) { return Max ? rangeMax(p, n) : rangeMin(p, n); };
+    parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+        for (long long t = lo; t < hi; t++) {
+            long long b = a.row * t / parts;
+            long long e = a.row * (t + 1) / parts;
+            if (a.step == a.col) { // the rows of the block are contiguous
+                best[t] = reduce(a.rowPtr((int) b + 1), (e - b) * a.col);
+                continue;
+            }
+            best[t] = reduce(a.rowPtr((int) b + 1), a.col);
+            for (long long i = b + 1; i < e; i++) {
+                T v = reduce(a.rowPtr((int) i + 1), a.col);
+                if (Max ? v > best[t] : v < best[t]) best[t] = v;
+            }
+        }
+    });
+    return reduce(best.data(), parts);
+}
+
 template<class T>
 /* return the maximum element of the matrix */
 T Mat<T>::max() {
-    T max = this->get(1, 1);
-    for (int i = 1; i <= this->row; i++) {
-        for (int j = 1; j <= this->col; j++) {
-            if (this->get(i, j) > max) {
-                max = this->get(i, j);
-            }
+    if (this->isSparse) {
+        const SparseStorage<T> &s = this->csr();
+        T max = s.nonZeros() < this->row * this->col ? T(0) : s.val[0];
+        for (const T &v: s.val) {
+            if (v > max) max = v;
         }
+        return max;
     }
-    return max;
+    return denseExtreme<true>(*this);
 }
 
 template<class T>
 /*return the minimum value of the matrix */
 T Mat<T>::min() {
-    T min = this->get(1, 1);
-    for (int i = 1; i <= this->row; i++) {
-        for (int j = 1; j <= this->col; j++) {
-            if (this->get(i, j) < min) {
-                min = this->get(i, j);
-            }
+    if (this->isSparse) {
+        const SparseStorage<T> &s = this->csr();
+        T min = s.nonZeros() < this->row * this->col ? T(0) : s.val[0];
+        for (const T &v: s.val) {
+            if (v < min) min = v;
         }
+        return min;
     }
-    return min;
+    return denseExtreme<false>(*this);
 }
 
 template<class T>
 T Mat<T>::sum() {
-    T sum = this->get(1, 1);
-    for (int i = 1; i <= this->row; i++) {
-        for (int j = 1; j <= this->col; j++) {
-            if (i != 1 || j != 1) {
-                sum += this->get(i, j);
-            }
-        }
+    T sum = T(0);
+    if (this->isSparse) {
+        for (const T &v: this->csr().val) sum += v;
+        return sum;
     }
-    return sum;
+    std::vector<T> rows = this->sumRows();
+    return rangeSum(rows.data(), (long long) rows.size());
 }
 
 template<class T>
@@ -345,50 +1031,737 @@ T Mat<T>::avg() {
     return this->sum() / (this->row * this->col);
 }
 
-template<class T>
-Mat<T> Mat<T>::conv(Mat<T> &kernel) {
-    kernel = kernel.transpose().transpose(); // 翻转180度
-    // center
-    int x = kernel.row / 2;
-    int y = kernel.col / 2;
-    Mat<T> ans(row, col);
-    for (int i = 0; i < row; i++) {
-        for (int j = 0; j < col; j++) {
-            for (int m = 0; m < kernel.row; m++) // kernel rows
-            {
-                for (int n = 0; n < kernel.col; n++) // kernel columns
-                {
-                    int ii = i + (m - x);
-                    int jj = j + (n - y);
-                    // ignore input samples which are out of bound
-                    if (ii >= 0 && ii < row && jj >= 0 && jj < col) {
-                        ans.set(i + 1, j + 1,
-                                ans.get(i + 1, j + 1) + (this->get(ii + 1, jj + 1)) * (kernel.get(m + 1, n + 1)));
-                    }
-                }
-            }
-        }
-    }
-    return ans;
-}
-
 template<class T>
 Mat<T> Mat<T>::transpose() {
+    if (this->isSparse) {
+        Mat<T> answer(col, row, nullptr, true);
+        *answer.pSparse = this->csr().transpose();
+        return answer;
+    }
     Mat<T> answer(col, row);
-    for (int i = 1; i <= col; i++) {
-        for (int j = 1; j <= row; j++) {
-            answer.set(i, j, this->get(j, i));
+    const int B = 32; // tile size, a B x B tile of both matrices stays in L1
+    for (int ib = 1; ib <= row; ib += B) {
+        for (int jb = 1; jb <= col; jb += B) {
+            int ie = std::min<int>(row, ib + B - 1);
+            int je = std::min<int>(col, jb + B - 1);
+            for (int i = ib; i <= ie; i++) {
+                const T *src = this->rowPtr(i);
+                for (int j = jb; j <= je; j++) {
+                    answer(j, i) = src[j - 1];
+                }
+            }
         }
     }
     return answer;
 }
 
-template<class T2>
-Mat<T2> operator+(Mat<T2> &lhs, Mat<T2> &rhs) {
-    if (lhs.col != rhs.col || lhs.row != lhs.col || rhs.col != rhs.row)
-        throw (Addition_DimensionNotMatched("Matrix not matched needs for addition"));
+/*
+ * Elementwise kernels on contiguous dense storage. For float and double the loop is written once with GCC vector
+ * types and compiled for SSE2, AVX2 and AVX-512; the widest instruction set the CPU supports is picked at runtime
+ * (CPUID, checked once), so one binary runs on every machine. Other element types use the scalar loop.
+ */
+enum class ElementwiseOp {
+    Add, // out = a + b
+    Sub, // out = a - b
+    Mul, // out = a * b
+    Scale // out = a * s
+};
 
-    Mat<T2> ans(lhs.row, lhs.row);
+enum class SimdLevel {
+    Scalar, SSE2, AVX2, AVX512
+};
+
+inline SimdLevel simdLevel() {
+#ifdef MATRIX_X86_DISPATCH
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+template<class T>
+void elementwiseScalar(ElementwiseOp op, const T *a, const T *b, T s, T *out, long long n) {
+    switch (op) {
+        case ElementwiseOp::Add:
+            for (long long i = 0; i < n; i++) out[i] = a[i] + b[i];
+            break;
+        case ElementwiseOp::Sub:
+            for (long long i = 0; i < n; i++) out[i] = a[i] - b[i];
+            break;
+        case ElementwiseOp::Mul:
+            for (long long i = 0; i < n; i++) out[i] = a[i] * b[i];
+            break;
+        case ElementwiseOp::Scale:
+            for (long long i = 0; i < n; i++) out[i] = a[i] * s;
+            break;
+    }
+}
+
+#ifdef MATRIX_X86_DISPATCH
+
+// V is a GCC vector type, the body is inlined into the target-specific wrappers below and compiled for their ISA
+template<class V, class T>
+__attribute__((always_inline)) inline void elementwiseVector(ElementwiseOp op, const T *a, const T *b, T s, T *out,
+                                                             long long n) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    long long i = 0;
+    V x, y;
+    switch (op) {
+        case ElementwiseOp::Add:
+            for (; i + W <= n; i += W) {
+                std::memcpy(&x, a + i, sizeof(V));
+                std::memcpy(&y, b + i, sizeof(V));
+                x += y;
+                std::memcpy(out + i, &x, sizeof(V));
+            }
+            break;
+        case ElementwiseOp::Sub:
+            for (; i + W <= n; i += W) {
+                std::memcpy(&x, a + i, sizeof(V));
+                std::memcpy(&y, b + i, sizeof(V));
+                x -= y;
+                std::memcpy(out + i, &x, sizeof(V));
+            }
+            break;
+        case ElementwiseOp::Mul:
+            for (; i + W <= n; i += W) {
+                std::memcpy(&x, a + i, sizeof(V));
+                std::memcpy(&y, b + i, sizeof(V));
+                x *= y;
+                std::memcpy(out + i, &x, sizeof(V));
+            }
+            break;
+        case ElementwiseOp::Scale:
+            for (; i + W <= n; i += W) {
+                std::memcpy(&x, a + i, sizeof(V));
+                x *= s;
+                std::memcpy(out + i, &x, sizeof(V));
+            }
+            break;
+    }
+    elementwiseScalar(op, a + i, b ? b + i : nullptr, s, out + i, n - i);
+}
+
+typedef double SimdDouble2 __attribute__((vector_size(16)));
+typedef double SimdDouble4 __attribute__((vector_size(32)));
+typedef double SimdDouble8 __attribute__((vector_size(64)));
+typedef float SimdFloat4 __attribute__((vector_size(16)));
+typedef float SimdFloat8 __attribute__((vector_size(32)));
+typedef float SimdFloat16 __attribute__((vector_size(64)));
+
+__attribute__((target("sse2"))) inline void
+elementwiseSSE2(ElementwiseOp op, const double *a, const double *b, double s, double *out, long long n) {
+    elementwiseVector<SimdDouble2>(op, a, b, s, out, n);
+}
+
+__attribute__((target("sse2"))) inline void
+elementwiseSSE2(ElementwiseOp op, const float *a, const float *b, float s, float *out, long long n) {
+    elementwiseVector<SimdFloat4>(op, a, b, s, out, n);
+}
+
+__attribute__((target("avx2"))) inline void
+elementwiseAVX2(ElementwiseOp op, const double *a, const double *b, double s, double *out, long long n) {
+    elementwiseVector<SimdDouble4>(op, a, b, s, out, n);
+}
+
+__attribute__((target("avx2"))) inline void
+elementwiseAVX2(ElementwiseOp op, const float *a, const float *b, float s, float *out, long long n) {
+    elementwiseVector<SimdFloat8>(op, a, b, s, out, n);
+}
+
+__attribute__((target("avx512f"))) inline void
+elementwiseAVX512(ElementwiseOp op, const double *a, const double *b, double s, double *out, long long n) {
+    elementwiseVector<SimdDouble8>(op, a, b, s, out, n);
+}
+
+__attribute__((target("avx512f"))) inline void
+elementwiseAVX512(ElementwiseOp op, const float *a, const float *b, float s, float *out, long long n) {
+    elementwiseVector<SimdFloat16>(op, a, b, s, out, n);
+}
+
+#endif
+
+// out[i] = a[i] (op) b[i] for n contiguous elements, b is unused for ElementwiseOp::Scale
+template<class T>
+void elementwise(ElementwiseOp op, const T *a, const T *b, T s, T *out, long long n) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                elementwiseAVX512(op, a, b, s, out, n);
+                return;
+            case SimdLevel::AVX2:
+                elementwiseAVX2(op, a, b, s, out, n);
+                return;
+            case SimdLevel::SSE2:
+                elementwiseSSE2(op, a, b, s, out, n);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    elementwiseScalar(op, a, b, s, out, n);
+}
+
+// Givens rotation of two rows: (x, y) := (c * x - s * y, s * x + c * y), vectorized like elementwise()
+template<class T>
+void planeRotationScalar(T *x, T *y, T c, T s, long long n) {
+    for (long long i = 0; i < n; i++) {
+        T h = y[i];
+        y[i] = s * x[i] + c * h;
+        x[i] = c * x[i] - s * h;
+    }
+}
+
+#ifdef MATRIX_X86_DISPATCH
+
+template<class V, class T>
+__attribute__((always_inline)) inline void planeRotationVector(T *x, T *y, T c, T s, long long n) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    long long i = 0;
+    V a, b;
+    for (; i + W <= n; i += W) {
+        std::memcpy(&a, x + i, sizeof(V));
+        std::memcpy(&b, y + i, sizeof(V));
+        V nx = c * a - s * b;
+        V ny = s * a + c * b;
+        std::memcpy(x + i, &nx, sizeof(V));
+        std::memcpy(y + i, &ny, sizeof(V));
+    }
+    planeRotationScalar(x + i, y + i, c, s, n - i);
+}
+
+__attribute__((target("sse2"))) inline void planeRotationSSE2(double *x, double *y, double c, double s, long long n) {
+    planeRotationVector<SimdDouble2>(x, y, c, s, n);
+}
+
+__attribute__((target("sse2"))) inline void planeRotationSSE2(float *x, float *y, float c, float s, long long n) {
+    planeRotationVector<SimdFloat4>(x, y, c, s, n);
+}
+
+__attribute__((target("avx2"))) inline void planeRotationAVX2(double *x, double *y, double c, double s, long long n) {
+    planeRotationVector<SimdDouble4>(x, y, c, s, n);
+}
+
+__attribute__((target("avx2"))) inline void planeRotationAVX2(float *x, float *y, float c, float s, long long n) {
+    planeRotationVector<SimdFloat8>(x, y, c, s, n);
+}
+
+__attribute__((target("avx512f"))) inline void
+planeRotationAVX512(double *x, double *y, double c, double s, long long n) {
+    planeRotationVector<SimdDouble8>(x, y, c, s, n);
+}
+
+__attribute__((target("avx512f"))) inline void
+planeRotationAVX512(float *x, float *y, float c, float s, long long n) {
+    planeRotationVector<SimdFloat16>(x, y, c, s, n);
+}
+
+#endif
+
+template<class T>
+void planeRotation(T *x, T *y, T c, T s, long long n) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                planeRotationAVX512(x, y, c, s, n);
+                return;
+            case SimdLevel::AVX2:
+                planeRotationAVX2(x, y, c, s, n);
+                return;
+            case SimdLevel::SSE2:
+                planeRotationSSE2(x, y, c, s, n);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    planeRotationScalar(x, y, c, s, n);
+}
+
+// apply an elementwise kernel to dense matrices row by row (one call when none of them is a strided view)
+template<class T>
+void elementwiseRows(ElementwiseOp op, const Mat<T> &a, const Mat<T> *b, T s, Mat<T> &out) {
+    bool contiguous = a.step == a.col && out.step == out.col && (b == nullptr || b->step == b->col);
+    if (contiguous) {
+        elementwise(op, a.pData.get(), b ? b->pData.get() : nullptr, s, out.pData.get(), a.row * a.col);
+        return;
+    }
+    for (int i = 1; i <= a.row; i++) {
+        elementwise(op, a.rowPtr(i), b ? b->rowPtr(i) : nullptr, s, out.rowPtr(i), a.col);
+    }
+}
+
+/*
+ * Reduction kernels. rangeStats() finds sum, min and max with their positions in a single pass, keeping one
+ * accumulator and one index per SIMD lane; rangeMax()/rangeMin() track the single value without positions;
+ * columnStatsAccumulate() folds one row into per-column accumulators.
+ * Both use the same vector-type / runtime-dispatch scheme as elementwise().
+ */
+template<class T>
+using StatsIndex = std::conditional_t<sizeof(T) == 4, int, long long>; // lane-sized index for the SIMD kernels
+
+template<class T>
+RangeStats<T> rangeStatsScalar(const T *a, long long n) {
+    RangeStats<T> st{a[0], a[0], a[0], 0, 0};
+    for (long long j = 1; j < n; j++) {
+        st.sum += a[j];
+        if (a[j] < st.min) {
+            st.min = a[j];
+            st.argmin = j;
+        }
+        if (a[j] > st.max) {
+            st.max = a[j];
+            st.argmax = j;
+        }
+    }
+    return st;
+}
+
+template<class T>
+T rangeSumScalar(const T *a, long long n) {
+    T sum = T(0);
+    for (long long j = 0; j < n; j++) sum += a[j];
+    return sum;
+}
+
+template<bool Max, class T>
+T rangeExtremeScalar(const T *a, long long n) {
+    T m = a[0];
+    for (long long j = 1; j < n; j++) {
+        if (Max ? a[j] > m : a[j] < m) m = a[j];
+    }
+    return m;
+}
+
+// fold row number rowIndex into the per-column accumulators, the first row folded must be passed with first = true
+template<class T>
+void columnStatsScalar(const T *r, long long n, StatsIndex<T> rowIndex, bool first,
+                       T *sum, T *mn, T *mx, StatsIndex<T> *amin, StatsIndex<T> *amax) {
+    for (long long j = 0; j < n; j++) {
+        if (first) {
+            sum[j] = mn[j] = mx[j] = r[j];
+            amin[j] = amax[j] = rowIndex;
+            continue;
+        }
+        sum[j] += r[j];
+        if (r[j] < mn[j]) {
+            mn[j] = r[j];
+            amin[j] = rowIndex;
+        }
+        if (r[j] > mx[j]) {
+            mx[j] = r[j];
+            amax[j] = rowIndex;
+        }
+    }
+}
+
+#ifdef MATRIX_X86_DISPATCH
+
+template<class V, class IV, class T>
+__attribute__((always_inline)) inline RangeStats<T> rangeStatsVector(const T *a, long long n) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    typedef StatsIndex<T> I;
+    if (n < 2 * W) return rangeStatsScalar(a, n);
+    V x, sum, mn, mx;
+    IV idx, imn, imx;
+    for (int l = 0; l < W; l++) idx[l] = l;
+    std::memcpy(&x, a, sizeof(V));
+    sum = mn = mx = x;
+    imn = imx = idx;
+    long long j = W;
+    for (; j + W <= n; j += W) {
+        std::memcpy(&x, a + j, sizeof(V));
+        idx += (I) W;
+        sum += x;
+        IV lt = x < mn;
+        mn = lt ? x : mn;
+        imn = lt ? idx : imn;
+        IV gt = x > mx;
+        mx = gt ? x : mx;
+        imx = gt ? idx : imx;
+    }
+    RangeStats<T> st{sum[0], mn[0], mx[0], imn[0], imx[0]};
+    for (int l = 1; l < W; l++) {
+        st.sum += sum[l];
+        if (mn[l] < st.min || (mn[l] == st.min && imn[l] < st.argmin)) {
+            st.min = mn[l];
+            st.argmin = imn[l];
+        }
+        if (mx[l] > st.max || (mx[l] == st.max && imx[l] < st.argmax)) {
+            st.max = mx[l];
+            st.argmax = imx[l];
+        }
+    }
+    for (; j < n; j++) {
+        st.sum += a[j];
+        if (a[j] < st.min) {
+            st.min = a[j];
+            st.argmin = j;
+        }
+        if (a[j] > st.max) {
+            st.max = a[j];
+            st.argmax = j;
+        }
+    }
+    return st;
+}
+
+template<class V, class T>
+__attribute__((always_inline)) inline T rangeSumVector(const T *a, long long n) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    V x, s0 = {}, s1 = {};
+    long long j = 0;
+    for (; j + 2 * W <= n; j += 2 * W) {
+        std::memcpy(&x, a + j, sizeof(V));
+        s0 += x;
+        std::memcpy(&x, a + j + W, sizeof(V));
+        s1 += x;
+    }
+    s0 += s1;
+    T sum = T(0);
+    for (int l = 0; l < W; l++) sum += s0[l];
+    for (; j < n; j++) sum += a[j];
+    return sum;
+}
+
+template<class V, bool Max, class T>
+__attribute__((always_inline)) inline T rangeExtremeVector(const T *a, long long n) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    if (n < 2 * W) return rangeExtremeScalar<Max>(a, n);
+    V x, m0, m1;
+    std::memcpy(&m0, a, sizeof(V));
+    std::memcpy(&m1, a + W, sizeof(V));
+    long long j = 2 * W;
+    for (; j + 2 * W <= n; j += 2 * W) {
+        std::memcpy(&x, a + j, sizeof(V));
+        m0 = (Max ? x > m0 : x < m0) ? x : m0;
+        std::memcpy(&x, a + j + W, sizeof(V));
+        m1 = (Max ? x > m1 : x < m1) ? x : m1;
+    }
+    m0 = (Max ? m1 > m0 : m1 < m0) ? m1 : m0;
+    T m = m0[0];
+    for (int l = 1; l < W; l++) {
+        if (Max ? m0[l] > m : m0[l] < m) m = m0[l];
+    }
+    for (; j < n; j++) {
+        if (Max ? a[j] > m : a[j] < m) m = a[j];
+    }
+    return m;
+}
+
+template<class V, class IV, class T>
+__attribute__((always_inline)) inline void columnStatsVector(const T *r, long long n, StatsIndex<T> rowIndex, bool first,
+                                                             T *sum, T *mn, T *mx, StatsIndex<T> *amin,
+                                                             StatsIndex<T> *amax) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    if (first) {
+        columnStatsScalar(r, n, rowIndex, first, sum, mn, mx, amin, amax);
+        return;
+    }
+    IV iv = IV{} + rowIndex;
+    V x, acc;
+    IV pos;
+    long long j = 0;
+    for (; j + W <= n; j += W) {
+        std::memcpy(&x, r + j, sizeof(V));
+        std::memcpy(&acc, sum + j, sizeof(V));
+        acc += x;
+        std::memcpy(sum + j, &acc, sizeof(V));
+        std::memcpy(&acc, mn + j, sizeof(V));
+        std::memcpy(&pos, amin + j, sizeof(IV));
+        IV lt = x < acc;
+        acc = lt ? x : acc;
+        pos = lt ? iv : pos;
+        std::memcpy(mn + j, &acc, sizeof(V));
+        std::memcpy(amin + j, &pos, sizeof(IV));
+        std::memcpy(&acc, mx + j, sizeof(V));
+        std::memcpy(&pos, amax + j, sizeof(IV));
+        IV gt = x > acc;
+        acc = gt ? x : acc;
+        pos = gt ? iv : pos;
+        std::memcpy(mx + j, &acc, sizeof(V));
+        std::memcpy(amax + j, &pos, sizeof(IV));
+    }
+    columnStatsScalar(r + j, n - j, rowIndex, false, sum + j, mn + j, mx + j, amin + j, amax + j);
+}
+
+typedef long long SimdLong2 __attribute__((vector_size(16)));
+typedef long long SimdLong4 __attribute__((vector_size(32)));
+typedef long long SimdLong8 __attribute__((vector_size(64)));
+typedef int SimdInt4 __attribute__((vector_size(16)));
+typedef int SimdInt8 __attribute__((vector_size(32)));
+typedef int SimdInt16 __attribute__((vector_size(64)));
+
+__attribute__((target("sse2"))) inline RangeStats<double> rangeStatsSSE2(const double *a, long long n) {
+    return rangeStatsVector<SimdDouble2, SimdLong2>(a, n);
+}
+
+__attribute__((target("sse2"))) inline RangeStats<float> rangeStatsSSE2(const float *a, long long n) {
+    return rangeStatsVector<SimdFloat4, SimdInt4>(a, n);
+}
+
+__attribute__((target("avx2"))) inline RangeStats<double> rangeStatsAVX2(const double *a, long long n) {
+    return rangeStatsVector<SimdDouble4, SimdLong4>(a, n);
+}
+
+__attribute__((target("avx2"))) inline RangeStats<float> rangeStatsAVX2(const float *a, long long n) {
+    return rangeStatsVector<SimdFloat8, SimdInt8>(a, n);
+}
+
+__attribute__((target("avx512f"))) inline RangeStats<double> rangeStatsAVX512(const double *a, long long n) {
+    return rangeStatsVector<SimdDouble8, SimdLong8>(a, n);
+}
+
+__attribute__((target("avx512f"))) inline RangeStats<float> rangeStatsAVX512(const float *a, long long n) {
+    return rangeStatsVector<SimdFloat16, SimdInt16>(a, n);
+}
+
+__attribute__((target("sse2"))) inline double rangeSumSSE2(const double *a, long long n) {
+    return rangeSumVector<SimdDouble2>(a, n);
+}
+
+__attribute__((target("sse2"))) inline float rangeSumSSE2(const float *a, long long n) {
+    return rangeSumVector<SimdFloat4>(a, n);
+}
+
+__attribute__((target("avx2"))) inline double rangeSumAVX2(const double *a, long long n) {
+    return rangeSumVector<SimdDouble4>(a, n);
+}
+
+__attribute__((target("avx2"))) inline float rangeSumAVX2(const float *a, long long n) {
+    return rangeSumVector<SimdFloat8>(a, n);
+}
+
+__attribute__((target("avx512f"))) inline double rangeSumAVX512(const double *a, long long n) {
+    return rangeSumVector<SimdDouble8>(a, n);
+}
+
+__attribute__((target("avx512f"))) inline float rangeSumAVX512(const float *a, long long n) {
+    return rangeSumVector<SimdFloat16>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("sse2"))) inline double rangeExtremeSSE2(const double *a, long long n) {
+    return rangeExtremeVector<SimdDouble2, Max>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("sse2"))) inline float rangeExtremeSSE2(const float *a, long long n) {
+    return rangeExtremeVector<SimdFloat4, Max>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("avx2"))) inline double rangeExtremeAVX2(const double *a, long long n) {
+    return rangeExtremeVector<SimdDouble4, Max>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("avx2"))) inline float rangeExtremeAVX2(const float *a, long long n) {
+    return rangeExtremeVector<SimdFloat8, Max>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("avx512f"))) inline double rangeExtremeAVX512(const double *a, long long n) {
+    return rangeExtremeVector<SimdDouble8, Max>(a, n);
+}
+
+template<bool Max>
+__attribute__((target("avx512f"))) inline float rangeExtremeAVX512(const float *a, long long n) {
+    return rangeExtremeVector<SimdFloat16, Max>(a, n);
+}
+
+__attribute__((target("sse2"))) inline void
+columnStatsSSE2(const double *r, long long n, long long i, bool first, double *s, double *mn, double *mx,
+                long long *amin, long long *amax) {
+    columnStatsVector<SimdDouble2, SimdLong2>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+__attribute__((target("sse2"))) inline void
+columnStatsSSE2(const float *r, long long n, int i, bool first, float *s, float *mn, float *mx,
+                int *amin, int *amax) {
+    columnStatsVector<SimdFloat4, SimdInt4>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+__attribute__((target("avx2"))) inline void
+columnStatsAVX2(const double *r, long long n, long long i, bool first, double *s, double *mn, double *mx,
+                long long *amin, long long *amax) {
+    columnStatsVector<SimdDouble4, SimdLong4>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+__attribute__((target("avx2"))) inline void
+columnStatsAVX2(const float *r, long long n, int i, bool first, float *s, float *mn, float *mx,
+                int *amin, int *amax) {
+    columnStatsVector<SimdFloat8, SimdInt8>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+__attribute__((target("avx512f"))) inline void
+columnStatsAVX512(const double *r, long long n, long long i, bool first, double *s, double *mn, double *mx,
+                  long long *amin, long long *amax) {
+    columnStatsVector<SimdDouble8, SimdLong8>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+__attribute__((target("avx512f"))) inline void
+columnStatsAVX512(const float *r, long long n, int i, bool first, float *s, float *mn, float *mx,
+                  int *amin, int *amax) {
+    columnStatsVector<SimdFloat16, SimdInt16>(r, n, i, first, s, mn, mx, amin, amax);
+}
+
+#endif
+
+template<class T>
+RangeStats<T> rangeStats(const T *a, long long n) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                return rangeStatsAVX512(a, n);
+            case SimdLevel::AVX2:
+                return rangeStatsAVX2(a, n);
+            case SimdLevel::SSE2:
+                return rangeStatsSSE2(a, n);
+            default:
+                break;
+        }
+    }
+#endif
+    return rangeStatsScalar(a, n);
+}
+
+template<class T>
+T rangeSum(const T *a, long long n) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                return rangeSumAVX512(a, n);
+            case SimdLevel::AVX2:
+                return rangeSumAVX2(a, n);
+            case SimdLevel::SSE2:
+                return rangeSumSSE2(a, n);
+            default:
+                break;
+        }
+    }
+#endif
+    return rangeSumScalar(a, n);
+}
+
+template<bool Max, class T>
+T rangeExtreme(const T *a, long long n) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                return rangeExtremeAVX512<Max>(a, n);
+            case SimdLevel::AVX2:
+                return rangeExtremeAVX2<Max>(a, n);
+            case SimdLevel::SSE2:
+                return rangeExtremeSSE2<Max>(a, n);
+            default:
+                break;
+        }
+    }
+#endif
+    return rangeExtremeScalar<Max>(a, n);
+}
+
+template<class T>
+T rangeMax(const T *a, long long n) {
+    return rangeExtreme<true>(a, n);
+}
+
+template<class T>
+T rangeMin(const T *a, long long n) {
+    return rangeExtreme<false>(a, n);
+}
+
+template<class T>
+void columnStatsAccumulate(const T *r, long long n, StatsIndex<T> rowIndex, bool first,
+                           T *sum, T *mn, T *mx, StatsIndex<T> *amin, StatsIndex<T> *amax) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                columnStatsAVX512(r, n, rowIndex, first, sum, mn, mx, amin, amax);
+                return;
+            case SimdLevel::AVX2:
+                columnStatsAVX2(r, n, rowIndex, first, sum, mn, mx, amin, amax);
+                return;
+            case SimdLevel::SSE2:
+                columnStatsSSE2(r, n, rowIndex, first, sum, mn, mx, amin, amax);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    columnStatsScalar(r, n, rowIndex, first, sum, mn, mx, amin, amax);
+}
+
+// per outer index (row of a CSR, column of a CSC) statistics of a sparse matrix, counting the implicit zeros
+template<class T>
+AxisStats<T> sparseAxisStats(const SparseStorage<T> &s) {
+    AxisStats<T> st;
+    st.sum.assign(s.outer, T(0));
+    st.min.assign(s.outer, T(0));
+    st.max.assign(s.outer, T(0));
+    st.argmin.assign(s.outer, 1);
+    st.argmax.assign(s.outer, 1);
+    for (long long o = 0; o < s.outer; o++) {
+        long long b = s.ptr[o];
+        long long e = s.ptr[o + 1];
+        long long zero = 0; // first position which holds an implicit zero
+        for (long long p = b; p < e && s.idx[p] == zero; p++) zero++;
+        bool hasZero = zero < s.inner;
+        bool init = false;
+        for (long long p = b; p < e; p++) {
+            T v = s.val[p];
+            st.sum[o] += v;
+            if (!init || v < st.min[o]) {
+                st.min[o] = v;
+                st.argmin[o] = s.idx[p] + 1;
+            }
+            if (!init || v > st.max[o]) {
+                st.max[o] = v;
+                st.argmax[o] = s.idx[p] + 1;
+            }
+            init = true;
+        }
+        if (hasZero) {
+            if (!init || T(0) < st.min[o] || (T(0) == st.min[o] && zero + 1 < st.argmin[o])) {
+                st.min[o] = T(0);
+                st.argmin[o] = (int) zero + 1;
+            }
+            if (!init || T(0) > st.max[o] || (T(0) == st.max[o] && zero + 1 < st.argmax[o])) {
+                st.max[o] = T(0);
+                st.argmax[o] = (int) zero + 1;
+            }
+        }
+    }
+    return st;
+}
+
+template<class T2>
+Mat<T2> operator+(Mat<T2> const &lhs, Mat<T2> const &rhs) {
+    if (lhs.col != rhs.col || lhs.row != rhs.row)
+        throw (Addition_DimensionNotMatched("Matrix not matched needs for addition"));
+
+    Mat<T2> ans(lhs.row, lhs.col);
+    if (!lhs.isSparse && !rhs.isSparse) {
+        elementwiseRows(ElementwiseOp::Add, lhs, &rhs, T2(0), ans);
+        return ans;
+    }
     for (int i = 1; i <= lhs.row; ++i) {
         for (int j = 1; j <= lhs.col; ++j) {
             ans.set(i, j, lhs.get(i, j) + rhs.get(i, j));
@@ -399,11 +1772,15 @@ Mat<T2> operator+(Mat<T2> &lhs, Mat<T2> &rhs) {
 }
 
 template<class T2>
-Mat<T2> operator-(Mat<T2> &lhs, Mat<T2> &rhs) {
-    if (lhs.col != rhs.col || lhs.row != lhs.col || rhs.col != rhs.row)
+Mat<T2> operator-(Mat<T2> const &lhs, Mat<T2> const &rhs) {
+    if (lhs.col != rhs.col || lhs.row != rhs.row)
         throw (Addition_DimensionNotMatched("Matrix not matched needs for addition"));
 
     Mat<T2> ans(lhs.row, lhs.col);
+    if (!lhs.isSparse && !rhs.isSparse) {
+        elementwiseRows(ElementwiseOp::Sub, lhs, &rhs, T2(0), ans);
+        return ans;
+    }
     for (int i = 1; i <= lhs.row; ++i) {
         for (int j = 1; j <= lhs.col; ++j) {
             ans.set(i, j, lhs.get(i, j) - rhs.get(i, j));
@@ -413,24 +1790,41 @@ Mat<T2> operator-(Mat<T2> &lhs, Mat<T2> &rhs) {
     return ans;
 }
 
+// element-wise (Hadamard) product
 template<class T2>
-Mat<T2> operator*(double lhs, Mat<T2> &rhs) {
-    Mat<T2> ans(rhs.row, rhs.col);
-    for (int i = 1; i <= rhs.row; ++i) {
-        for (int j = 1; j <= rhs.col; ++j) {
-            ans.set(i, j, rhs.get(i, j) * lhs);
+Mat<T2> dotMuilt(Mat<T2> const &lhs, Mat<T2> const &rhs) {
+    if (lhs.col != rhs.col || lhs.row != rhs.row)
+        throw (Multiply_DimensionsNotMatched("Matrix not matched needs for element-wise multiplication"));
+
+    Mat<T2> ans(lhs.row, lhs.col);
+    if (!lhs.isSparse && !rhs.isSparse) {
+        elementwiseRows(ElementwiseOp::Mul, lhs, &rhs, T2(0), ans);
+        return ans;
+    }
+    for (int i = 1; i <= lhs.row; ++i) {
+        for (int j = 1; j <= lhs.col; ++j) {
+            ans.set(i, j, lhs.get(i, j) * rhs.get(i, j));
         }
     }
-    ans.setZero();
+
     return ans;
 }
 
 template<class T2>
-Mat<T2> operator*(Mat<T2> &rhs, double lhs) {
+Mat<T2> operator*(double lhs, Mat<T2> const &rhs) {
+    return rhs * lhs;
+}
+
+template<class T2>
+Mat<T2> operator*(Mat<T2> const &rhs, double lhs) {
     Mat<T2> ans(rhs.row, rhs.col);
-    for (int i = 1; i <= rhs.row; ++i) {
-        for (int j = 1; j <= rhs.col; ++j) {
-            ans.set(i, j, rhs.get(i, j) * lhs);
+    if (!rhs.isSparse && (std::is_same_v<T2, double> || std::is_same_v<T2, float>)) {
+        elementwiseRows<T2>(ElementwiseOp::Scale, rhs, nullptr, T2(lhs), ans);
+    } else {
+        for (int i = 1; i <= rhs.row; ++i) {
+            for (int j = 1; j <= rhs.col; ++j) {
+                ans.set(i, j, rhs.get(i, j) * lhs);
+            }
         }
     }
 
@@ -440,10 +1834,12 @@ Mat<T2> operator*(Mat<T2> &rhs, double lhs) {
 
 template<class T2>
 Mat<T2> Mat<T2>::getSubmatrix(int rowstart, int rowend, int colstart, int colend) {
-    if (colend > colstart || rowend > rowstart ||
+    if (colstart > colend || rowstart > rowend ||
         colend > this->col || rowend > this->row ||
-        colstart < 1 || rowend < 1)
+        colstart < 1 || rowstart < 1)
         throw (InvalidCoordinatesException("Coordinate for submatrix is out of bound."));
+    if (this->isSparse)
+        throw (ClassTypeNotSupport("Submatrix views require a dense matrix."));
     colstart--;
     colend--;
     rowstart--;
@@ -452,14 +1848,16 @@ Mat<T2> Mat<T2>::getSubmatrix(int rowstart, int rowend, int colstart, int colend
     ans.col = colend - colstart + 1;
     ans.row = rowend - rowstart + 1;
     ans.step = this->step;
-    ans.pData = std::shared_ptr<T2[]>(
-            this->pData.get() + this->getIndex(rowstart, colstart));
+    // the view shares ownership of the parent buffer
+    ans.pData = std::shared_ptr<T2[]>(this->pData, this->pData.get() + this->getIndex(rowstart, colstart));
+    ans.pCache = std::make_shared<MatCache<T2>>();
+    ans.pCache->version = this->cache().version;
     return ans;
 }
 
 template<class T2>
-Mat<T2> operator*(std::vector<T2> &lhs, Mat<T2> &rhs) {
-    if (rhs.row == 1 && rhs.col == lhs.size()) {
+Mat<T2> operator*(std::vector<T2> const &lhs, Mat<T2> const &rhs) {
+    if (rhs.row == 1 && rhs.col == (long long) lhs.size()) {
         Mat<T2> ans(rhs.col, rhs.col);
         std::vector<T2> list;
         for (int i = 0; i < rhs.col; ++i) {
@@ -468,7 +1866,12 @@ Mat<T2> operator*(std::vector<T2> &lhs, Mat<T2> &rhs) {
             }
         }
         return Mat<T2>(rhs.col, rhs.col, &list);
-    } else if (rhs.row != 1 && rhs.row == lhs.size()) {
+    } else if (rhs.row != 1 && rhs.row == (long long) lhs.size()) {
+        if (rhs.isSparse) {
+            Mat<T2> ans(1, rhs.col);
+            spmvTransposed(rhs.csr(), lhs.data(), ans.pData.get());
+            return ans;
+        }
         std::vector<T2> list;
         for (int i = 0; i < rhs.col; ++i) {
             T2 t = 0;
@@ -484,484 +1887,5128 @@ Mat<T2> operator*(std::vector<T2> &lhs, Mat<T2> &rhs) {
     }
 }
 
-template<class T2>
-Mat<T2> operator*(Mat<T2> lhs, Mat<T2> rhs) {
-    if (lhs.col != rhs.row) {
-        throw (Multiply_DimensionsNotMatched(""));
+/*
+ * GEMM: C = alpha * A * B + beta * C.
+ * A is m x k, B is k x n, C is m x n. A and B are addressed through a row stride and a column stride,
+ * so transposed operands and submatrices can be passed without copying. C is row-major with leading dimension ldc.
+ * For float and double the product is cache-blocked (NC / KC / MC), both operands are packed into contiguous
+ * panels and an MR x NR register tile is accumulated by the micro-kernel. Other types use the plain triple loop.
+ */
+template<class T>
+struct GemmBlocking {
+    static constexpr int MR = 4;
+    static constexpr int NR = 4;
+    static constexpr int MC = 64;
+    static constexpr int KC = 128;
+    static constexpr int NC = 1024;
+};
+
+template<>
+struct GemmBlocking<double> {
+    static constexpr int MR = 4;
+    static constexpr int NR = 8;
+    static constexpr int MC = 128;  // MC x KC block of A stays in L2
+    static constexpr int KC = 256;  // KC x NR sliver of B stays in L1
+    static constexpr int NC = 2048; // KC x NC panel of B stays in L3
+};
+
+template<>
+struct GemmBlocking<float> {
+    static constexpr int MR = 8;
+    static constexpr int NR = 8;
+    static constexpr int MC = 128;
+    static constexpr int KC = 384;
+    static constexpr int NC = 4096;
+};
+
+template<class T>
+void gemmNaive(long long m, long long n, long long k, T alpha,
+               const T *A, long long rsA, long long csA,
+               const T *B, long long rsB, long long csB,
+               T beta, T *C, long long ldc) {
+    for (long long i = 0; i < m; i++) {
+        T *c = C + i * ldc;
+        for (long long j = 0; j < n; j++) {
+            c[j] = (beta == T(0)) ? T(0) : beta * c[j];
+        }
+        for (long long p = 0; p < k; p++) {
+            T a = alpha * A[i * rsA + p * csA];
+            const T *b = B + p * rsB;
+            for (long long j = 0; j < n; j++) {
+                c[j] += a * b[j * csB];
+            }
+        }
     }
-    Mat<T2> ans(lhs.row, rhs.col);
-    for (int i = 1; i <= ans.row; i++) {
-        for (int j = 1; j <= ans.col; j++) {
-            T2 sum = 0;
-            for (int k = 1; k <= lhs.col; k++) {
-                sum += lhs.get(i, k) * rhs.get(k, j);
+}
+
+// copy an mc x kc block of A into row panels of height MR, zero padded at the bottom edge
+template<class T, int MR>
+void gemmPackA(long long mc, long long kc, const T *A, long long rsA, long long csA, T *buf) {
+    for (long long ir = 0; ir < mc; ir += MR) {
+        long long mr = std::min<long long>(MR, mc - ir);
+        for (long long p = 0; p < kc; p++) {
+            for (long long i = 0; i < mr; i++) {
+                buf[p * MR + i] = A[(ir + i) * rsA + p * csA];
+            }
+            for (long long i = mr; i < MR; i++) {
+                buf[p * MR + i] = T(0);
             }
-            ans.set(i, j, sum);
         }
+        buf += MR * kc;
     }
-    ans.setZero();
-    return ans;
 }
 
-template<class T>
-Mat<T> Mat<T>::resize(int x, int y) {
-    Mat<T> ans(x, y);
-    int i_ = 1;
-    int j_ = 1;
-    for (int i = 1; i <= x; i++) {
-        for (int j = 1; j <= y; j++) {
-            if (i_ <= this->row && j_ <= this->col) {
-                ans.set(i, j, this->get(i_, j_));
-            } else {
-                ans.set(i, j, 0);
+// copy a kc x nc block of B into column panels of width NR, zero padded at the right edge
+template<class T, int NR>
+void gemmPackB(long long kc, long long nc, const T *B, long long rsB, long long csB, T *buf) {
+    for (long long jr = 0; jr < nc; jr += NR) {
+        long long nr = std::min<long long>(NR, nc - jr);
+        for (long long p = 0; p < kc; p++) {
+            const T *b = B + p * rsB + jr * csB;
+            for (long long j = 0; j < nr; j++) {
+                buf[p * NR + j] = b[j * csB];
             }
-            j_++;
-            if (j_ == this->col) {
-                j_ = 0;
-                i_++;
+            for (long long j = nr; j < NR; j++) {
+                buf[p * NR + j] = T(0);
             }
         }
+        buf += NR * kc;
     }
-    return ans;
-}
-
-//template <class T>
-//cv::Mat Mat<T>::toOpencv() {
-//    cv::Mat ans(this->row, this->col, CV_64F);
-//    for (int i = 1; i <= this->row; i++) {
-//        for (int j = 1; j <= this->col; j++) {
-//            ans.at<double>(i - 1, j - 1) = this->get(i, j);
-//        }
-//    }
-//    return Mat<T>(rhs.row, rhs.col, &list);
-//}
-
-template<class T>
-int Mat<T>::rank() {
-    int res{};
-    Mat<T> resMat = this->gauss();
-    for (int i = 1; i <= this->row; ++i) {
-        if (resMat.get(i, this->col) != 0) res++;
-    }
-    return res;
 }
 
-
-template<class T2>
-Mat<T2> Mat<T2>::gauss() {
-
-
-    Mat<T2> out = this->clone();
-    int i = 1;
-    int pivot = 1;
-    //out.print();
-
-    for (; i <= out.row && pivot <= out.col; i++, pivot++) {
-        if (i > out.col) {
-            break;
-        }
-
-        for (int k = i + 1; k <= out.row; k++) {
-            if (out.get(i, pivot) != 0) {
-                break;
-            } else if (out.get(k, pivot) != 0) {
-                for (int count = 1; count <= out.col; count++) {
-                    T2 mid = out.get(i, count);
-                    out.set(i, count, out.get(k, count));
-                    out.set(k, count, mid);
-                }
-                break;
+// C[0:mr, 0:nr] += alpha * a * b, where a is an MR x kc panel and b is a kc x NR panel
+template<class T, int MR, int NR>
+inline void gemmMicroKernel(long long kc, T alpha, const T *a, const T *b, T *C, long long ldc, long long mr, long long nr) {
+    T acc[MR][NR] = {};
+    for (long long p = 0; p < kc; p++) {
+        const T *ap = a + p * MR;
+        const T *bp = b + p * NR;
+        for (int i = 0; i < MR; i++) {
+            T ai = ap[i];
+            for (int j = 0; j < NR; j++) {
+                acc[i][j] += ai * bp[j];
             }
         }
     }
-    //out.print();
-
-    for (i = 1; i <= out.row && out.col; i++) {
-        int max = i;
-        for (int k = i; k <= out.row; k++) {
-            if (fabs(out.get(k, i)) > fabs(out.get(max, i))) max = k;
-        }
-        if (fabs(out.get(max, i)) < EPS) continue;
-        if (max != i) {
-            for (int j = 1; j <= out.col; j++) {
-                T2 mid = out.get(i, j);
-                out.set(i, j, out.get(max, j));
-                out.set(max, j, mid);
+    if (mr == MR && nr == NR) {
+        for (int i = 0; i < MR; i++) {
+            for (int j = 0; j < NR; j++) {
+                C[i * ldc + j] += alpha * acc[i][j];
             }
         }
-        //std::cout << "Test" << std::endl;
-        for (int k = i + 1; k <= out.row; k++) {
-            if (fabs(out.get(i, i)) < EPS) {
-                break;
-            }
-            T2 a = -out.get(k, i) / out.get(i, i);
-            for (int count = 1; count <= out.col; count++) {
-                out.set(k, count, a * out.get(i, count) + out.get(k, count));
+    } else {
+        for (long long i = 0; i < mr; i++) {
+            for (long long j = 0; j < nr; j++) {
+                C[i * ldc + j] += alpha * acc[i][j];
             }
         }
     }
-    out.setZero();
-    return out;
 }
 
+template<class T>
+void gemmBlocked(long long m, long long n, long long k, T alpha,
+                 const T *A, long long rsA, long long csA,
+                 const T *B, long long rsB, long long csB,
+                 T beta, T *C, long long ldc) {
+    constexpr int MR = GemmBlocking<T>::MR;
+    constexpr int NR = GemmBlocking<T>::NR;
+    constexpr long long MC = GemmBlocking<T>::MC;
+    constexpr long long KC = GemmBlocking<T>::KC;
+    constexpr long long NC = GemmBlocking<T>::NC;
 
-template<class T2>
-Mat<T2> Mat<T2>::gauss(int &cnt) {
-    Mat<T2> out = this->clone();
-    int i = 1;
-    int pivot = 1;
-    int l_cnt = 0;
-    //out.print();
-
-    for (; i <= out.row && pivot <= out.col; i++, pivot++) {
-        if (i > out.col) {
-            break;
+    for (long long i = 0; i < m; i++) {
+        T *c = C + i * ldc;
+        for (long long j = 0; j < n; j++) {
+            c[j] = (beta == T(0)) ? T(0) : beta * c[j];
         }
+    }
+    if (k == 0 || alpha == T(0)) return;
 
-        for (int k = i + 1; k <= out.row; k++) {
-            if (out.get(i, pivot) != 0) {
-                break;
-            } else if (out.get(k, pivot) != 0) {
-                l_cnt++;
-                for (int count = 1; count <= out.col; count++) {
-                    T2 mid = out.get(i, count);
-                    out.set(i, count, out.get(k, count));
-                    out.set(k, count, mid);
+    std::vector<T> packB(((std::min(NC, n) + NR - 1) / NR) * NR * std::min(KC, k));
+    long long blocks = (m + MC - 1) / MC;
+    for (long long jc = 0; jc < n; jc += NC) {
+        long long nc = std::min(NC, n - jc);
+        for (long long pc = 0; pc < k; pc += KC) {
+            long long kc = std::min(KC, k - pc);
+            gemmPackB<T, NR>(kc, nc, B + pc * rsB + jc * csB, rsB, csB, packB.data());
+            // MC blocks of A are independent: each thread packs its own blocks and shares the packed B panel
+            long long grain = m * nc * kc < (1 << 21) ? blocks : 1;
+            parallelFor(0, blocks, grain, [&](long long lo, long long hi) {
+                std::vector<T> packA(((std::min(MC, m) + MR - 1) / MR) * MR * kc);
+                for (long long ic = lo * MC; ic < std::min(m, hi * MC); ic += MC) {
+                    long long mc = std::min(MC, m - ic);
+                    gemmPackA<T, MR>(mc, kc, A + ic * rsA + pc * csA, rsA, csA, packA.data());
+                    for (long long jr = 0; jr < nc; jr += NR) {
+                        const T *b = packB.data() + (jr / NR) * NR * kc;
+                        for (long long ir = 0; ir < mc; ir += MR) {
+                            const T *a = packA.data() + (ir / MR) * MR * kc;
+                            gemmMicroKernel<T, MR, NR>(kc, alpha, a, b, C + (ic + ir) * ldc + jc + jr, ldc,
+                                                       std::min<long long>(MR, mc - ir),
+                                                       std::min<long long>(NR, nc - jr));
+                        }
+                    }
                 }
-                break;
-            }
+            });
         }
     }
-    //out.print();
+}
 
-    for (i = 1; i <= out.row && out.col; i++) {
-        int max = i;
-        for (int k = i; k <= out.row; k++) {
-            if (fabs(out.get(k, i)) > fabs(out.get(max, i))) max = k;
+template<class T>
+void gemm(long long m, long long n, long long k, T alpha,
+          const T *A, long long rsA, long long csA,
+          const T *B, long long rsB, long long csB,
+          T beta, T *C, long long ldc) {
+    if (m <= 0 || n <= 0) return;
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        if (m * n * k > 4096) {
+            gemmBlocked(m, n, k, alpha, A, rsA, csA, B, rsB, csB, beta, C, ldc);
+            return;
         }
-        if (fabs(out.get(max, i)) < EPS) continue;
-        if (max != i) {
-            l_cnt++;
-            for (int j = 1; j <= out.col; j++) {
-                T2 mid = out.get(i, j);
-                out.set(i, j, out.get(max, j));
-                out.set(max, j, mid);
-            }
+    }
+    gemmNaive(m, n, k, alpha, A, rsA, csA, B, rsB, csB, beta, C, ldc);
+}
+
+/*
+ * 2-D convolution kernels used by Mat::conv. They compute the valid cross-correlation of a source block,
+ * out(i, j) = sum over (m, n) of src(i + m, j + n) * k(m, n), for an nr x nc output read from an
+ * (nr + kr - 1) x (nc + kc - 1) source, so they need no bounds checks; convTiles() hands them tiles of the input or
+ * of a padded copy. Matrices are row-major with leading dimensions.
+ */
+
+// output pixels [jlo, jhi) of one row; r[m] is the source row under kernel row m
+template<class T>
+void convRowScalar(const T *const *r, long long kr, long long kc, const T *k, long long ldk, T *o, long long jlo,
+                   long long jhi) {
+    for (long long j = jlo; j < jhi; j++) {
+        T sum = T(0);
+        for (long long m = 0; m < kr; m++) {
+            const T *src = r[m] + j, *w = k + m * ldk;
+            for (long long n = 0; n < kc; n++) sum += w[n] * src[n];
         }
-        //std::cout << "Test" << std::endl;
-        for (int k = i + 1; k <= out.row; k++) {
-            if (fabs(out.get(i, i)) < EPS) {
-                break;
+        o[j] = sum;
+    }
+}
+
+#ifdef MATRIX_X86_DISPATCH
+
+// pixels are accumulated over every tap in four vector registers and stored once
+template<class V, class T>
+__attribute__((always_inline)) inline void
+convRowVector(const T *const *r, long long kr, long long kc, const T *k, long long ldk, T *o, long long nc) {
+    constexpr long long W = sizeof(V) / sizeof(T);
+    long long j = 0;
+    V v0, v1, v2, v3;
+    for (; j + 4 * W <= nc; j += 4 * W) {
+        V a0 = {}, a1 = {}, a2 = {}, a3 = {};
+        for (long long m = 0; m < kr; m++) {
+            const T *src = r[m] + j, *w = k + m * ldk;
+            for (long long n = 0; n < kc; n++) {
+                T c = w[n];
+                std::memcpy(&v0, src + n, sizeof(V));
+                std::memcpy(&v1, src + n + W, sizeof(V));
+                std::memcpy(&v2, src + n + 2 * W, sizeof(V));
+                std::memcpy(&v3, src + n + 3 * W, sizeof(V));
+                a0 += c * v0;
+                a1 += c * v1;
+                a2 += c * v2;
+                a3 += c * v3;
             }
-            T2 a = -out.get(k, i) / out.get(i, i);
-            l_cnt++;
-            for (int count = 1; count <= out.col; count++) {
-                out.set(k, count, a * out.get(i, count) + out.get(k, count));
+        }
+        std::memcpy(o + j, &a0, sizeof(V));
+        std::memcpy(o + j + W, &a1, sizeof(V));
+        std::memcpy(o + j + 2 * W, &a2, sizeof(V));
+        std::memcpy(o + j + 3 * W, &a3, sizeof(V));
+    }
+    for (; j + W <= nc; j += W) {
+        V a0 = {};
+        for (long long m = 0; m < kr; m++) {
+            const T *src = r[m] + j, *w = k + m * ldk;
+            for (long long n = 0; n < kc; n++) {
+                std::memcpy(&v0, src + n, sizeof(V));
+                a0 += w[n] * v0;
             }
         }
+        std::memcpy(o + j, &a0, sizeof(V));
     }
-    out.setZero();
-    cnt = l_cnt;
-    return out;
+    convRowScalar(r, kr, kc, k, ldk, o, j, nc);
 }
 
-template<class T>
-std::vector<T> Mat<T>::getRow(int l_row) {
-    std::vector<T> res;
-    for (int i = 1; i <= this->col; ++i) {
-        res.template emplace_back(this->get(l_row, i));
-    }
-    return res;
+__attribute__((target("sse2"))) inline void
+convRowSSE2(const double *const *r, long long kr, long long kc, const double *k, long long ldk, double *o,
+            long long nc) {
+    convRowVector<SimdDouble2>(r, kr, kc, k, ldk, o, nc);
 }
 
-template<class T>
-std::vector<T> Mat<T>::getCol(int l_col) {
-    std::vector<T> res;
-    for (int i = 1; i <= this->row; ++i) {
-        res.template emplace_back(this->get(i, l_col));
-    }
-    return res;
+__attribute__((target("sse2"))) inline void
+convRowSSE2(const float *const *r, long long kr, long long kc, const float *k, long long ldk, float *o, long long nc) {
+    convRowVector<SimdFloat4>(r, kr, kc, k, ldk, o, nc);
+}
+
+__attribute__((target("avx2"))) inline void
+convRowAVX2(const double *const *r, long long kr, long long kc, const double *k, long long ldk, double *o,
+            long long nc) {
+    convRowVector<SimdDouble4>(r, kr, kc, k, ldk, o, nc);
+}
+
+__attribute__((target("avx2"))) inline void
+convRowAVX2(const float *const *r, long long kr, long long kc, const float *k, long long ldk, float *o, long long nc) {
+    convRowVector<SimdFloat8>(r, kr, kc, k, ldk, o, nc);
+}
+
+__attribute__((target("avx512f"))) inline void
+convRowAVX512(const double *const *r, long long kr, long long kc, const double *k, long long ldk, double *o,
+              long long nc) {
+    convRowVector<SimdDouble8>(r, kr, kc, k, ldk, o, nc);
+}
+
+__attribute__((target("avx512f"))) inline void
+convRowAVX512(const float *const *r, long long kr, long long kc, const float *k, long long ldk, float *o,
+              long long nc) {
+    convRowVector<SimdFloat16>(r, kr, kc, k, ldk, o, nc);
 }
 
+#endif
+
+// one output row of nc pixels
 template<class T>
-//获取代数余子式
-Mat<T> Mat<T>::getCominor(int x, int y) {
-    if (x > this->row || y > this->col) throw (Cominor_CoordinateExceedsBounds(""));
-    std::vector<T> res;
-    for (int i = 1; i <= this->row; ++i) {
-        for (int j = 1; j <= this->col; ++j) {
-            if (i != x || j != y) res.template emplace_back(this->get(i, j));
+void convRow(const T *const *r, long long kr, long long kc, const T *k, long long ldk, T *o, long long nc) {
+#ifdef MATRIX_X86_DISPATCH
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        switch (simdLevel()) {
+            case SimdLevel::AVX512:
+                convRowAVX512(r, kr, kc, k, ldk, o, nc);
+                return;
+            case SimdLevel::AVX2:
+                convRowAVX2(r, kr, kc, k, ldk, o, nc);
+                return;
+            case SimdLevel::SSE2:
+                convRowSSE2(r, kr, kc, k, ldk, o, nc);
+                return;
+            default:
+                break;
         }
     }
-    return Mat<T>(this->row - 1, this->col - 1, &res);
+#endif
+    convRowScalar(r, kr, kc, k, ldk, o, 0, nc);
 }
 
+/*
+ * Implicit im2col: the patch of output pixel j is the kc-wide slice at column j of the kr source rows under the
+ * kernel, so the patch matrix is never built and convRow() reduces it against the kernel in registers like a GEMM
+ * micro-kernel.
+ */
 template<class T>
-T Mat<T>::det() {
-    if (this->col != this->row) throw (Determinant_NotSquareMatrix(""));
-    int cnt{};
-    T ans = 1;
-    Mat<T> res = this->gauss(cnt);
-    for (int i = 1; i <= this->col; ++i) {
-        ans *= res.get(i, i);
+void convDirectTile(const T *src, long long lds, long long nr, long long nc, long long kr, long long kc, const T *k,
+                    long long ldk, T *out, long long ldo) {
+    std::vector<const T *> r(kr);
+    for (long long i = 0; i < nr; i++) {
+        for (long long m = 0; m < kr; m++) r[m] = src + (i + m) * lds;
+        convRow(r.data(), kr, kc, k, ldk, out + i * ldo, nc);
     }
-    return pow(-1, cnt) * ans;
 }
 
-template<class T>
-double Mat<T>::trace() {
-    double ans{};
-    if (this->col != this->row) throw (Trace_NotSquareMatrix(""));
-    else {
-        for (int i = 0; i < this->row; ++i) {
-            ans += this->get(i + 1, i + 1);
-        }
+/*
+ * Winograd minimal filtering F(M x M, R x R): an M x M output tile is Y = A^T [U . (B^T d B)] A, where d is the
+ * (M + R - 1)^2 input tile and U = G g G^T the transformed kernel, so the elementwise product costs (M + R - 1)^2
+ * multiplications instead of M^2 R^2. The transforms below use the interpolation points 0, 1, -1 (alpha = 4) and
+ * 0, 1, -1, 2, -2 (alpha = 6) plus infinity; F(4, 3) and F(2, 5) share the alpha = 6 input transform. They act on
+ * one row or column of a tile (elements s apart) and work on scalars or on vectors holding one tile per lane.
+ */
+template<int M, int R>
+struct Winograd;
+
+template<>
+struct Winograd<2, 3> {
+    static constexpr int A = 4;
+    static constexpr double G[A][3] = {{1, 0, 0}, {0.5, 0.5, 0.5}, {0.5, -0.5, 0.5}, {0, 0, 1}};
+
+    template<class V>
+    __attribute__((always_inline)) static void input(const V *d, V *v, int s) {
+        v[0] = d[0] - d[2 * s];
+        v[s] = d[s] + d[2 * s];
+        v[2 * s] = d[2 * s] - d[s];
+        v[3 * s] = d[s] - d[3 * s];
     }
-    return ans;
+
+    template<class V>
+    __attribute__((always_inline)) static void output(const V *m, V *y, int s) {
+        y[0] = m[0] + m[s] + m[2 * s];
+        y[s] = m[s] - m[2 * s] - m[3 * s];
+    }
+};
+
+// input transform of the alpha = 6 point set
+template<class V>
+__attribute__((always_inline)) inline void winogradInput6(const V *d, V *v, int s) {
+    V d0 = d[0], d1 = d[s], d2 = d[2 * s], d3 = d[3 * s], d4 = d[4 * s], d5 = d[5 * s];
+    V a = d4 - 4 * d2, b = d3 - 4 * d1, c = d4 - d2, e = 2 * (d3 - d1);
+    v[0] = 4 * d0 - 5 * d2 + d4;
+    v[s] = a + b;
+    v[2 * s] = a - b;
+    v[3 * s] = c + e;
+    v[4 * s] = c - e;
+    v[5 * s] = 4 * d1 - 5 * d3 + d5;
 }
 
-template<class T>
-Mat<T> Mat<T>::inverse() {
-    if (this->row != this->col) {
-        throw Inverse_NotSquareMatrix("error: calculate the inverse of a non-square matrix");
+template<>
+struct Winograd<4, 3> {
+    static constexpr int A = 6;
+    static constexpr double G[A][3] = {{1.0 / 4, 0, 0}, {-1.0 / 6, -1.0 / 6, -1.0 / 6}, {-1.0 / 6, 1.0 / 6, -1.0 / 6},
+                                       {1.0 / 24, 1.0 / 12, 1.0 / 6}, {1.0 / 24, -1.0 / 12, 1.0 / 6}, {0, 0, 1}};
+
+    template<class V>
+    __attribute__((always_inline)) static void input(const V *d, V *v, int s) { winogradInput6(d, v, s); }
+
+    template<class V>
+    __attribute__((always_inline)) static void output(const V *m, V *y, int s) {
+        V a = m[s] + m[2 * s], b = m[s] - m[2 * s], c = m[3 * s] + m[4 * s], e = m[3 * s] - m[4 * s];
+        y[0] = m[0] + a + c;
+        y[s] = b + 2 * e;
+        y[2 * s] = a + 4 * c;
+        y[3 * s] = b + 8 * e + m[5 * s];
     }
-    int n = this->row;
-    Mat<T> a(n, 2 * n);
-    for (int i = 1; i <= n; i++) {
-        for (int j = 1; j <= n; j++) {
-            a.set(i, j, this->get(i, j));
-        }
+};
+
+template<>
+struct Winograd<2, 5> {
+    static constexpr int A = 6;
+    static constexpr double G[A][5] = {{1.0 / 4, 0, 0, 0, 0},
+                                       {-1.0 / 6, -1.0 / 6, -1.0 / 6, -1.0 / 6, -1.0 / 6},
+                                       {-1.0 / 6, 1.0 / 6, -1.0 / 6, 1.0 / 6, -1.0 / 6},
+                                       {1.0 / 24, 1.0 / 12, 1.0 / 6, 1.0 / 3, 2.0 / 3},
+                                       {1.0 / 24, -1.0 / 12, 1.0 / 6, -1.0 / 3, 2.0 / 3},
+                                       {0, 0, 0, 0, 1}};
+
+    template<class V>
+    __attribute__((always_inline)) static void input(const V *d, V *v, int s) { winogradInput6(d, v, s); }
+
+    template<class V>
+    __attribute__((always_inline)) static void output(const V *m, V *y, int s) {
+        y[0] = m[0] + m[s] + m[2 * s] + m[3 * s] + m[4 * s];
+        y[s] = m[s] - m[2 * s] + 2 * (m[3 * s] - m[4 * s]) + m[5 * s];
     }
-    /* Augmenting Identity Matrix of Order n */
-    for (int i = 1; i <= n; i++) {
-        for (int j = 1; j <= n; j++) {
-            if (i == j) {
-                a.set(i, j + n, 1);
-            } else {
-                a.set(i, j + n, 0);
+};
+
+// U = G g G^T for an R x R kernel, alpha x alpha row-major
+template<class T, int M, int R>
+std::vector<T> winogradKernel(const T *k, long long ldk) {
+    constexpr int A = Winograd<M, R>::A;
+    const auto &G = Winograd<M, R>::G;
+    std::vector<T> U(A * A);
+    for (int a = 0; a < A; a++) {
+        for (int b = 0; b < A; b++) {
+            double sum = 0;
+            for (int m = 0; m < R; m++) {
+                for (int n = 0; n < R; n++) sum += G[a][m] * (double) k[m * ldk + n] * G[b][n];
             }
+            U[a * A + b] = (T) sum;
         }
     }
+    return U;
+}
 
-    /* Applying Gauss Jordan Elimination */
-    for (int i = 1; i <= n; i++) {
-        if (a.get(i, i) == 0) {
-            std::cout << "Mathematical Error!";
-            throw (Inverse_NotInvertible(""));
-        }
-        for (int j = 1; j <= n; j++) {
-            if (i != j) {
-                double ratio = a.get(j, i) / a.get(i, i);
-                for (int k = 1; k <= 2 * n; k++) {
-                    a.set(j, k, a.get(j, k) - ratio * a.get(i, k));
+/*
+ * Full M x M tiles of a valid-correlation block, W = sizeof(V) / sizeof(T) horizontally adjacent tiles at a time,
+ * one per vector lane; returns how many output rows and columns were covered.
+ */
+template<class V, class T, int M, int R>
+__attribute__((always_inline)) inline std::pair<long long, long long>
+winogradVector(const T *src, long long lds, long long nr, long long nc, const T *U, T *out, long long ldo) {
+    constexpr int A = Winograd<M, R>::A;
+    constexpr long long W = sizeof(V) / sizeof(T);
+    long long rowsDone = nr / M * M, colsDone = nc / (M * W) * (M * W);
+    T lanes[A][A][W];
+    V d[A][A], t[A][A], y[M][M];
+    for (long long i0 = 0; i0 < rowsDone; i0 += M) {
+        for (long long j0 = 0; j0 < colsDone; j0 += M * W) {
+            for (int a = 0; a < A; a++) {
+                const T *row = src + (i0 + a) * lds + j0;
+                for (long long l = 0; l < W; l++) {
+                    for (int b = 0; b < A; b++) lanes[a][b][l] = row[l * M + b];
+                }
+            }
+            std::memcpy(d, lanes, sizeof(d));
+            for (int a = 0; a < A; a++) Winograd<M, R>::input(&d[a][0], &t[a][0], 1);
+            for (int b = 0; b < A; b++) Winograd<M, R>::input(&t[0][b], &d[0][b], A);
+            for (int a = 0; a < A; a++) {
+                for (int b = 0; b < A; b++) d[a][b] *= U[a * A + b];
+            }
+            for (int a = 0; a < A; a++) Winograd<M, R>::output(&d[a][0], &t[a][0], 1);
+            for (int j = 0; j < M; j++) Winograd<M, R>::output(&t[0][j], &d[0][j], A);
+            for (int i = 0; i < M; i++) std::memcpy(y[i], d[i], sizeof(y[i]));
+            std::memcpy(lanes, y, sizeof(y));
+            const T(*res)[M][W] = reinterpret_cast<const T (*)[M][W]>(&lanes[0][0][0]);
+            for (int i = 0; i < M; i++) {
+                T *o = out + (i0 + i) * ldo + j0;
+                for (long long l = 0; l < W; l++) {
+                    for (int j = 0; j < M; j++) o[l * M + j] = res[i][j][l];
                 }
             }
         }
     }
-    /* Row Operation to Make Principal Diagonal to 1 */
-    for (int i = 1; i <= n; i++) {
-        for (int j = n + 1; j <= 2 * n; j++) {
-            a.set(i, j, a.get(i, j) / a.get(i, i));
-        }
-    }
-
-    Mat<T> rt(n, n);
-    for (int i = 1; i <= n; i++) {
-        for (int j = 1; j <= n; j++) {
-            rt.set(i, j, a.get(i, j + n));
-        }
-    }
-    return rt;
+    return {rowsDone, colsDone};
 }
 
+// element types with Winograd kernels; the vector types below only exist for these
 template<class T>
-void Mat<T>::setZero() {
-    for (int i = 1; i <= row; ++i) {
-        for (int j = 1; j <= col; ++j) {
-            if (fabs(this->get(i, j)) < EPS) this->set(i, j, 0.0);
-        }
-    }
+constexpr bool winogradSupported = std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+#ifdef MATRIX_X86_DISPATCH
+
+template<class T>
+using SimdSSE2 = std::conditional_t<std::is_same_v<T, double>, SimdDouble2, SimdFloat4>;
+template<class T>
+using SimdAVX2 = std::conditional_t<std::is_same_v<T, double>, SimdDouble4, SimdFloat8>;
+template<class T>
+using SimdAVX512 = std::conditional_t<std::is_same_v<T, double>, SimdDouble8, SimdFloat16>;
+
+template<class T, int M, int R>
+__attribute__((target("sse2"))) inline std::pair<long long, long long>
+winogradSSE2(const T *src, long long lds, long long nr, long long nc, const T *U, T *out, long long ldo) {
+    return winogradVector<SimdSSE2<T>, T, M, R>(src, lds, nr, nc, U, out, ldo);
 }
 
-Mat<double> ranMatGen(int x, int y, int start = 1, int end = 10) {
-    std::vector<double> list;
-    for (int i = 0; i < x; ++i) {
-        for (int j = 0; j < y; ++j) {
-            list.emplace_back(random(start, end));
-        }
-    }
-    return Mat<double>(x, y, &list);
+template<class T, int M, int R>
+__attribute__((target("avx2"))) inline std::pair<long long, long long>
+winogradAVX2(const T *src, long long lds, long long nr, long long nc, const T *U, T *out, long long ldo) {
+    return winogradVector<SimdAVX2<T>, T, M, R>(src, lds, nr, nc, U, out, ldo);
 }
 
-template<class T>
-Mat<T> unitMatGen(int x) {
-    std::vector<T> list;
-    for (int i = 0; i < x; ++i) {
-        for (int j = 0; j < x; ++j) {
-            if (i != j) list.template emplace_back(0);
-            else list.template emplace_back(1);
-        }
-    }
-    return Mat<T>(x, x, &list);
+template<class T, int M, int R>
+__attribute__((target("avx512f"))) inline std::pair<long long, long long>
+winogradAVX512(const T *src, long long lds, long long nr, long long nc, const T *U, T *out, long long ldo) {
+    return winogradVector<SimdAVX512<T>, T, M, R>(src, lds, nr, nc, U, out, ldo);
 }
 
-template<class T2>
-void Mat<T2>::QR(Mat<T2> &Q, Mat<T2> &R) {
-    Mat<T2> temp = this->clone();
-    if (Q.col != Q.row || R.col != R.row || Q.col != R.col)
-        throw (InvalidDimensionsException("Q or R size mismatch!"));
+#endif
 
-    int i, j, k, m;
-    T2 u, alpha, w, t;
-    for (i = 1; i <= Q.col; i++) {
-        for (j = 1; j <= Q.row; j++) {
-            Q.set(i, j, 0);
-            if (i == j) Q.set(i, j, 1);
-        }
+// Winograd tile kernel for float and double; the pixels outside the full tiles take the direct path
+template<class T, int M, int R>
+void convWinogradTile(const T *src, long long lds, long long nr, long long nc, const T *U, const T *k, long long ldk,
+                      T *out, long long ldo) {
+    static_assert(winogradSupported<T>);
+    std::pair<long long, long long> done{0, 0};
+#ifdef MATRIX_X86_DISPATCH
+    switch (simdLevel()) {
+        case SimdLevel::AVX512:
+            done = winogradAVX512<T, M, R>(src, lds, nr, nc, U, out, ldo);
+            break;
+        case SimdLevel::AVX2:
+            done = winogradAVX2<T, M, R>(src, lds, nr, nc, U, out, ldo);
+            break;
+        case SimdLevel::SSE2:
+            done = winogradSSE2<T, M, R>(src, lds, nr, nc, U, out, ldo);
+            break;
+        default:
+            done = winogradVector<T, T, M, R>(src, lds, nr, nc, U, out, ldo);
     }
+#else
+    done = winogradVector<T, T, M, R>(src, lds, nr, nc, U, out, ldo);
+#endif
+    auto [rowsDone, colsDone] = done;
+    if (colsDone < nc) {
+        convDirectTile(src + colsDone, lds, rowsDone, nc - colsDone, R, R, k, ldk, out + colsDone, ldo);
+    }
+    if (rowsDone < nr) {
+        convDirectTile(src + rowsDone * lds, lds, nr - rowsDone, nc, R, R, k, ldk, out + rowsDone * ldo, ldo);
+    }
+}
 
-    for (k = 1; k <= Q.col - 1; k++) {
-
-        T2 u = 0;
-        for (i = k; i <= Q.col; i++) {
-            w = fabs(temp.get(i, k));
-            if (w > u) u = w;
+// smallest m >= n of the form 2^a 3^b 5^c, the lengths FFTPlan handles with its fast butterflies
+inline long long fftGoodSize(long long n) {
+    long long best = 1;
+    while (best < n) best *= 2;
+    for (long long p5 = 1; p5 < best; p5 *= 5) {
+        for (long long p35 = p5; p35 < best; p35 *= 3) {
+            long long m = p35;
+            while (m < n) m *= 2;
+            best = std::min(best, m);
         }
-        alpha = 0;
+    }
+    return best;
+}
 
-        for (i = k; i <= Q.col; i++) {
-            t = temp.get(i, k) / u;
-            alpha = alpha + t * t;
-        }
-        if (temp.get(k, k) > 0) u = -u;
-        alpha = u * sqrt(alpha);
-        if (fabs(alpha) + 1.0 == 1.0) {
-            throw (InvalidCoordinatesException("QR分解失败!"));
-        }
+/*
+ * Complex FFT of a fixed length n, unnormalized, computed in place by the Stockham autosort algorithm: every stage
+ * reads one buffer and writes the other in natural order, so no bit reversal is needed. Stages use radix 4, 2, 3
+ * and 5 butterflies, and a plain DFT for any other prime factor.
+ */
+class FFTPlan {
+    long long n;
+    std::vector<int> radices;
+    std::vector<std::complex<double>> w;  // w[k] = exp(-2 pi i k / n)
+    std::vector<std::complex<double>> tw; // per stage, w^(s p u) for p < m and 1 <= u < r, u fastest
 
-        u = sqrt(2 * alpha * (alpha - temp.get(k, k)));
-        if ((u + 1) != 1) {
-            temp.set(k, k, (temp.get(k, k) - alpha) / u);
-            for (i = k + 1; i <= Q.col; i++) temp.set(i, k, temp.get(i, k) / u);
+    template<bool Inverse>
+    void transform(std::complex<double> *x, std::complex<double> *work, long long batch) const;
 
-            for (j = 1; j <= Q.col; j++) {
-                t = 0;
-                for (m = k; m <= Q.col; m++)
-                    t = t + temp.get(m, k) * Q.get(m, j);
-                for (i = k; i <= Q.col; i++)
-                    Q.set(i, j, Q.get(i, j) - 2 * t * temp.get(i, k));
-            }
+public:
+    explicit FFTPlan(long long n = 1);
 
-            for (j = k + 1; j <= Q.col; j++) {
-                t = 0;
-                for (m = k; m <= Q.col; m++)
-                    t = t + temp.get(m, k) * temp.get(m, j);
-                for (i = k; i <= Q.col; i++)
-                    temp.set(i, j, temp.get(i, j) - 2 * t * temp.get(i, k));
-            }
+    long long size() const { return n; }
 
-            temp.set(k, k, alpha);
-            for (i = k + 1; i <= Q.col; i++) temp.set(i, k, 0);
-        }
+    // transforms batch interleaved sequences, element j of sequence k being x[j * batch + k]; work holds n * batch values
+    void forward(std::complex<double> *x, std::complex<double> *work, long long batch = 1) const {
+        transform<false>(x, work, batch);
     }
 
-    for (i = 1; i <= Q.col - 1; i++) {
-        for (j = i + 1; j <= Q.col; j++) {
-            t = Q.get(i, j);
-            Q.set(i, j, Q.get(j, i));
-            Q.set(j, i, t);
-        }
+    void inverse(std::complex<double> *x, std::complex<double> *work, long long batch = 1) const {
+        transform<true>(x, work, batch);
     }
+};
 
-    R = temp.clone();
-}
-
-template<class T2>
-void Mat<T2>::eigen(Mat<T2> &value, Mat<T2> &vector) {
-    Mat<T2> temp = this->clone();
-    if (temp.col != temp.row) {
-        throw (InvalidDimensionsException("Only square matrices have eigenvalues and eigenvectors."));
-    } else if (value.col != this->col || value.row != 1) {
-        throw (InvalidDimensionsException("Size of matrices for eigenvalue should be 1 X N."));
-    } else if (vector.col != vector.row || vector.row != this->row) {
-        throw (InvalidDimensionsException("Size for eigenvetor container mismatch"));
+inline FFTPlan::FFTPlan(long long n) : n(n) {
+    if (n < 1) throw (InvalidDimensionsException("FFT length must be positive"));
+    long long m = n;
+    while (m % 4 == 0) radices.push_back(4), m /= 4;
+    if (m % 2 == 0) radices.push_back(2), m /= 2;
+    for (int r = 3; m > 1; r += 2) {
+        if ((long long) r * r > m) r = (int) m;
+        while (m % r == 0) radices.push_back(r), m /= r;
     }
-
-    Mat<T2> Q(temp.row, temp.col);
-    Mat<T2> R(temp.row, temp.col);
-    for (int count = 1; count <= 50; count++) {
-        temp.QR(Q, R);
-        temp = R * Q;
+    w.resize(n);
+    for (long long k = 0; k < n; k++) w[k] = std::polar(1.0, -2 * M_PI * (double) k / (double) n);
+    long long s = 1;
+    for (int r: radices) {
+        long long len = n / s;
+        for (long long p = 0; p < len / r; p++) {
+            for (int u = 1; u < r; u++) tw.push_back(w[s * p * u]);
+        }
+        s *= r;
     }
+}
 
-    for (int i = 1; i <= value.col; i++)
-        value.set(1, i, temp.get(i, i));
+// complex product without the inf/nan recovery of std::complex's operator*, which is not inlined
+inline std::complex<double> fftMul(std::complex<double> a, std::complex<double> b) {
+    return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+template<bool Inverse>
+void FFTPlan::transform(std::complex<double> *x, std::complex<double> *work, long long batch) const {
+    using C = std::complex<double>;
+    // multiply by -i for the forward transform, +i for the inverse
+    auto rot = [](C z) { return Inverse ? C(-z.imag(), z.real()) : C(z.imag(), -z.real()); };
+    auto conj = [](C z) { return Inverse ? std::conj(z) : z; };
+    const double s3 = std::sqrt(3.0) / 2;
+    const double c51 = std::cos(2 * M_PI / 5), c52 = std::cos(4 * M_PI / 5);
+    const double s51 = std::sin(2 * M_PI / 5), s52 = std::sin(4 * M_PI / 5);
+    std::vector<C> a, b;
+    const C *t = tw.data();
+    C *src = x, *dst = work;
+    long long s = batch, len = n;
+    // stage: len = r * m sub-transforms of stride s; dst[q + s (r p + u)] = w^(s p u) * DFT_r(src[q + s (p + j m)])_u.
+    // s counts values rather than elements, so the batch runs in the innermost loop of every butterfly.
+    for (int r: radices) {
+        long long m = len / r, sm = s * m;
+        for (long long p = 0; p < m; p++, t += r - 1) {
+            const C *in = src + s * p;
+            C *out = dst + s * r * p;
+            switch (r) {
+                case 4: {
+                    C w1 = conj(t[0]), w2 = conj(t[1]), w3 = conj(t[2]);
+                    for (long long q = 0; q < s; q++) {
+                        C a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm], a3 = in[q + 3 * sm];
+                        C t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3, t3 = rot(a1 - a3);
+                        out[q] = t0 + t2;
+                        out[q + s] = fftMul(t1 + t3, w1);
+                        out[q + 2 * s] = fftMul(t0 - t2, w2);
+                        out[q + 3 * s] = fftMul(t1 - t3, w3);
+                    }
+                    break;
+                }
+                case 2: {
+                    C w1 = conj(t[0]);
+                    for (long long q = 0; q < s; q++) {
+                        C a0 = in[q], a1 = in[q + sm];
+                        out[q] = a0 + a1;
+                        out[q + s] = fftMul(a0 - a1, w1);
+                    }
+                    break;
+                }
+                case 3: {
+                    C w1 = conj(t[0]), w2 = conj(t[1]);
+                    for (long long q = 0; q < s; q++) {
+                        C a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm];
+                        C t1 = a1 + a2, u = a0 - 0.5 * t1, v = rot(s3 * (a1 - a2));
+                        out[q] = a0 + t1;
+                        out[q + s] = fftMul(u + v, w1);
+                        out[q + 2 * s] = fftMul(u - v, w2);
+                    }
+                    break;
+                }
+                case 5: {
+                    C w1 = conj(t[0]), w2 = conj(t[1]), w3 = conj(t[2]), w4 = conj(t[3]);
+                    for (long long q = 0; q < s; q++) {
+                        C a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm], a3 = in[q + 3 * sm], a4 = in[q + 4 * sm];
+                        C t1 = a1 + a4, t2 = a2 + a3, d1 = a1 - a4, d2 = a2 - a3;
+                        C u1 = a0 + c51 * t1 + c52 * t2, u2 = a0 + c52 * t1 + c51 * t2;
+                        C v1 = rot(s51 * d1 + s52 * d2), v2 = rot(s52 * d1 - s51 * d2);
+                        out[q] = a0 + t1 + t2;
+                        out[q + s] = fftMul(u1 + v1, w1);
+                        out[q + 2 * s] = fftMul(u2 + v2, w2);
+                        out[q + 3 * s] = fftMul(u2 - v2, w3);
+                        out[q + 4 * s] = fftMul(u1 - v1, w4);
+                    }
+                    break;
+                }
+                default: {
+                    a.resize(r), b.resize(r);
+                    for (long long q = 0; q < s; q++) {
+                        for (int j = 0; j < r; j++) a[j] = in[q + j * sm];
+                        for (int u = 0; u < r; u++) {
+                            C sum = 0;
+                            for (int j = 0; j < r; j++) sum += fftMul(a[j], conj(w[(long long) (j * u % r) * (n / r)]));
+                            b[u] = sum;
+                        }
+                        out[q] = b[0];
+                        for (int u = 1; u < r; u++) out[q + u * s] = fftMul(b[u], conj(t[u - 1]));
+                    }
+                }
+            }
+        }
+        std::swap(src, dst);
+        s *= r;
+        len = m;
+    }
+    if (src != x) std::copy(src, src + n * batch, x);
+}
+
+/*
+ * 2-D FFT of a p x q real array, kept as its p x (q / 2 + 1) half spectrum. Rows are transformed two at a time as
+ * the real and imaginary parts of one complex row, then split using the Hermitian symmetry of real transforms.
+ */
+class RealFFT2D {
+    long long p, q, h;
+    FFTPlan rowPlan, colPlan;
+
+public:
+    RealFFT2D(long long p, long long q) : p(p), q(q), h(q / 2 + 1), rowPlan(q), colPlan(p) {}
+
+    long long spectrumSize() const { return p * h; }
+
+    // spectrum of the array whose top-left nr x nc block is a (leading dimension lda) and whose other entries are 0
+    template<class T>
+    void forward(const T *a, long long lda, long long nr, long long nc, std::complex<double> *spec) const;
+
+    // first nr rows of the real array (leading dimension ldo) scaled by 1 / (p q); spec is overwritten
+    void inverse(std::complex<double> *spec, double *out, long long ldo, long long nr) const;
+
+private:
+    void columns(std::complex<double> *spec, bool inverse) const;
+};
+
+// column transforms, batched over blocks of FFT_COLUMN_BLOCK columns copied out to contiguous storage
+constexpr long long FFT_COLUMN_BLOCK = 16;
+
+inline void RealFFT2D::columns(std::complex<double> *spec, bool inverse) const {
+    long long blocks = (h + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK;
+    parallelFor(0, blocks, std::max<long long>(1, 256 / p), [&](long long lo, long long hi) {
+        std::vector<std::complex<double>> v(p * FFT_COLUMN_BLOCK), work(p * FFT_COLUMN_BLOCK);
+        for (long long b = lo; b < hi; b++) {
+            long long k0 = b * FFT_COLUMN_BLOCK, bw = std::min(FFT_COLUMN_BLOCK, h - k0);
+            for (long long r = 0; r < p; r++) std::copy(spec + r * h + k0, spec + r * h + k0 + bw, &v[r * bw]);
+            if (inverse) colPlan.inverse(v.data(), work.data(), bw);
+            else colPlan.forward(v.data(), work.data(), bw);
+            for (long long r = 0; r < p; r++) std::copy(&v[r * bw], &v[r * bw] + bw, spec + r * h + k0);
+        }
+    });
+}
+
+template<class T>
+void RealFFT2D::forward(const T *a, long long lda, long long nr, long long nc, std::complex<double> *spec) const {
+    using C = std::complex<double>;
+    std::fill(spec + std::min(nr, p) * h, spec + p * h, C(0));
+    parallelFor(0, (std::min(nr, p) + 1) / 2, std::max<long long>(1, 4096 / q), [&](long long lo, long long hi) {
+        std::vector<C> z(q), work(q);
+        for (long long pr = lo; pr < hi; pr++) {
+            long long r = 2 * pr;
+            bool pair = r + 1 < std::min(nr, p);
+            const T *a0 = a + r * lda, *a1 = a0 + lda;
+            std::fill(z.begin() + std::min(nc, q), z.end(), C(0));
+            for (long long c = 0; c < std::min(nc, q); c++) z[c] = C((double) a0[c], pair ? (double) a1[c] : 0.0);
+            rowPlan.forward(z.data(), work.data());
+            C *s0 = spec + r * h, *s1 = s0 + h;
+            for (long long k = 0; k < h; k++) {
+                C zk = z[k], zc = std::conj(z[(q - k) % q]);
+                s0[k] = 0.5 * (zk + zc);
+                if (pair) s1[k] = C(0.5 * (zk.imag() - zc.imag()), -0.5 * (zk.real() - zc.real()));
+            }
+        }
+    });
+    columns(spec, false);
+}
+
+inline void RealFFT2D::inverse(std::complex<double> *spec, double *out, long long ldo, long long nr) const {
+    using C = std::complex<double>;
+    columns(spec, true);
+    double scale = 1.0 / ((double) p * (double) q);
+    nr = std::min(nr, p);
+    parallelFor(0, (nr + 1) / 2, std::max<long long>(1, 4096 / q), [&](long long lo, long long hi) {
+        std::vector<C> z(q), work(q);
+        for (long long pr = lo; pr < hi; pr++) {
+            long long r = 2 * pr;
+            bool pair = r + 1 < p;
+            const C *s0 = spec + r * h, *s1 = s0 + h;
+            for (long long k = 0; k < h; k++) z[k] = pair ? s0[k] + C(-s1[k].imag(), s1[k].real()) : s0[k];
+            for (long long k = h; k < q; k++) {
+                C a = std::conj(s0[q - k]), b = pair ? std::conj(s1[q - k]) : C(0); // an unpaired last row has no s1
+                z[k] = a + C(-b.imag(), b.real());
+            }
+            rowPlan.inverse(z.data(), work.data());
+            double *o0 = out + r * ldo, *o1 = o0 + ldo;
+            for (long long c = 0; c < q; c++) o0[c] = z[c].real() * scale;
+            if (r + 1 < nr) for (long long c = 0; c < q; c++) o1[c] = z[c].imag() * scale;
+        }
+    });
+}
+
+constexpr long long CONV_TILE_ROWS = 32; // output tile of the direct, separable and Winograd paths
+constexpr long long CONV_TILE_COLS = 512;
+constexpr long long CONV_FFT_TILE = 256; // FFT size of the overlap-save tiles along each dimension
+// kernels with at least this many taps use the FFT (floating types only), measured crossovers with the direct path
+constexpr long long CONV_FFT_TAPS = 441; // 21 x 21
+constexpr long long CONV_FFT_TAPS_FLOAT = 729; // 27 x 27, the direct path is twice as wide for float
+
+// input index read at position i of an axis of length n, or -1 for a zero sample
+inline long long convBorderIndex(long long i, long long n, ConvBorder border) {
+    if (i >= 0 && i < n) return i;
+    switch (border) {
+        case ConvBorder::Replicate:
+            return i < 0 ? 0 : n - 1;
+        case ConvBorder::Reflect: {
+            if (n == 1) return 0;
+            long long period = 2 * (n - 1);
+            i %= period;
+            if (i < 0) i += period;
+            return i < n ? i : period - i;
+        }
+        case ConvBorder::Wrap:
+            i %= n;
+            return i < 0 ? i + n : i;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Tiled driver: output pixel (i, j) correlates the kernel with the window whose top-left sample is input
+ * (i - oy, j - ox). The output is cut into tiles of tr x tc pixels, and the tiles of all count images (the b-th
+ * starting at in + b * inStride and out + b * outStride) run in parallel. An interior tile's source block lies inside
+ * the input and is read in place; a border tile's block is gathered into a buffer following the border mode first.
+ * tile(src, lds, nr, nc, out, ldo) computes the valid correlation of one block.
+ */
+template<class T, class F>
+void convTiles(long long rows, long long cols, const T *in, long long ldi, long long inStride, long long outRows,
+               long long outCols, T *out, long long ldo, long long outStride, long long count, long long oy,
+               long long ox, ConvBorder border, long long kr, long long kc, long long tr, long long tc, const F &tile) {
+    long long nti = (outRows + tr - 1) / tr, ntj = (outCols + tc - 1) / tc;
+    parallelFor(0, count * nti * ntj, 1, [&](long long lo, long long hi) {
+        std::vector<T> pad;
+        std::vector<long long> colIndex;
+        for (long long t = lo; t < hi; t++) {
+            long long b = t / (nti * ntj), i0 = t % (nti * ntj) / ntj * tr, j0 = t % ntj * tc;
+            long long nr = std::min(tr, outRows - i0), nc = std::min(tc, outCols - j0);
+            long long sr = i0 - oy, sc = j0 - ox, pr = nr + kr - 1, pc = nc + kc - 1;
+            const T *image = in + b * inStride;
+            T *o = out + b * outStride + i0 * ldo + j0;
+            if (sr >= 0 && sc >= 0 && sr + pr <= rows && sc + pc <= cols) {
+                tile(image + sr * ldi + sc, ldi, nr, nc, o, ldo);
+                continue;
+            }
+            pad.resize(pr * pc);
+            colIndex.resize(pc);
+            for (long long c = 0; c < pc; c++) colIndex[c] = convBorderIndex(sc + c, cols, border);
+            for (long long p = 0; p < pr; p++) {
+                long long ri = convBorderIndex(sr + p, rows, border);
+                T *d = &pad[p * pc];
+                const T *src = image + ri * ldi;
+                for (long long c = 0; c < pc; c++) d[c] = ri < 0 || colIndex[c] < 0 ? T(0) : src[colIndex[c]];
+            }
+            tile(pad.data(), pc, nr, nc, o, ldo);
+        }
+    });
+}
+
+/*
+ * Overlap-save FFT tile: the cyclic correlation of a zero-extended p x q source block with the flipped kernel equals
+ * the valid correlation wherever the kernel window does not wrap around, which covers an nr x nc output as long as
+ * nr + kr - 1 <= p and nc + kc - 1 <= q. The kernel spectrum is computed once per plan.
+ */
+template<class T>
+class ConvFFTTile {
+    long long kr, kc, q;
+    RealFFT2D fft;
+    std::vector<std::complex<double>> K;
+
+public:
+    ConvFFTTile(long long kr, long long kc, const T *k, long long ldk, long long p, long long q);
+
+    void operator()(const T *src, long long lds, long long nr, long long nc, T *out, long long ldo) const;
+};
+
+template<class T>
+ConvFFTTile<T>::ConvFFTTile(long long kr, long long kc, const T *k, long long ldk, long long p, long long q)
+        : kr(kr), kc(kc), q(q), fft(p, q), K(fft.spectrumSize()) {
+    std::vector<double> flipped(kr * kc);
+    for (long long m = 0; m < kr; m++) {
+        for (long long n = 0; n < kc; n++) flipped[(kr - 1 - m) * kc + kc - 1 - n] = (double) k[m * ldk + n];
+    }
+    fft.forward(flipped.data(), kc, kr, kc, K.data());
+}
+
+template<class T>
+void ConvFFTTile<T>::operator()(const T *src, long long lds, long long nr, long long nc, T *out, long long ldo) const {
+    std::vector<std::complex<double>> spec(fft.spectrumSize());
+    std::vector<double> buf((nr + kr - 1) * q);
+    fft.forward(src, lds, nr + kr - 1, nc + kc - 1, spec.data());
+    for (long long e = 0; e < fft.spectrumSize(); e++) spec[e] = fftMul(spec[e], K[e]);
+    fft.inverse(spec.data(), buf.data(), q, nr + kr - 1);
+    for (long long i = 0; i < nr; i++) {
+        const double *b = &buf[(i + kr - 1) * q + kc - 1];
+        T *o = out + i * ldo;
+        for (long long j = 0; j < nc; j++) {
+            if constexpr (std::is_integral_v<T>) o[j] = (T) std::llround(b[j]);
+            else o[j] = (T) b[j];
+        }
+    }
+}
+
+// FFT length along one axis and the output tile length it serves; small outputs take a single tile
+inline std::pair<long long, long long> convFFTTileSize(long long outN, long long kn) {
+    long long len = std::max(CONV_FFT_TILE, 4 * (kn - 1));
+    long long whole = fftGoodSize(outN + kn - 1);
+    if (whole <= len) return {whole, outN};
+    len = fftGoodSize(len);
+    return {len, len - kn + 1};
+}
+
+/*
+ * Rank-1 test for a kernel: K = c * r^T. The column and row through the largest entry are the factors, and every
+ * entry is checked against their product, exactly for integer types and to a few ulps of the largest entry
+ * otherwise. Integer factors stay integral without a common scale: r is the pivot row divided by its gcd, and since
+ * r is then primitive every row of a rank-1 integer kernel is an integer multiple of it.
+ */
+template<class T>
+bool separableFactors(long long kr, long long kc, const T *k, long long ldk, std::vector<T> &c, std::vector<T> &r) {
+    auto mag = [](T x) {
+        if constexpr (std::is_signed_v<T>) return x < T(0) ? -x : x;
+        else return x;
+    };
+    long long pm = 0, pn = 0;
+    for (long long m = 0; m < kr; m++) {
+        for (long long n = 0; n < kc; n++) {
+            if (mag(k[m * ldk + n]) > mag(k[pm * ldk + pn])) pm = m, pn = n;
+        }
+    }
+    T pivot = k[pm * ldk + pn];
+    if (pivot == T(0)) return false;
+    c.resize(kr);
+    r.resize(kc);
+    if constexpr (std::is_integral_v<T>) {
+        T g = T(0);
+        for (long long n = 0; n < kc; n++) g = std::gcd(g, k[pm * ldk + n]);
+        if constexpr (std::is_signed_v<T>) {
+            if (pivot < T(0)) g = -g; // keep the pivot of r positive
+        }
+        for (long long n = 0; n < kc; n++) r[n] = k[pm * ldk + n] / g;
+        for (long long m = 0; m < kr; m++) {
+            if (k[m * ldk + pn] % r[pn] != T(0)) return false;
+            c[m] = k[m * ldk + pn] / r[pn];
+        }
+    } else {
+        for (long long m = 0; m < kr; m++) c[m] = k[m * ldk + pn];
+        for (long long n = 0; n < kc; n++) r[n] = k[pm * ldk + n] / pivot;
+    }
+    for (long long m = 0; m < kr; m++) {
+        for (long long n = 0; n < kc; n++) {
+            if constexpr (std::is_integral_v<T>) {
+                if ((long long) k[m * ldk + n] != (long long) c[m] * r[n]) return false;
+            } else {
+                T tol = 32 * std::numeric_limits<T>::epsilon() * std::abs(pivot);
+                if (std::abs(k[m * ldk + n] - c[m] * r[n]) > tol) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// separable tile: per output row, the column kernel combines kr source rows, then the row kernel runs along the result
+template<class T>
+void convSeparableTile(const T *src, long long lds, long long nr, long long nc, const T *c, long long kr, const T *r,
+                       long long kc, T *out, long long ldo) {
+    std::vector<const T *> rows(kr);
+    std::vector<T> tmp(nc + kc - 1);
+    const T *t = tmp.data();
+    for (long long i = 0; i < nr; i++) {
+        for (long long m = 0; m < kr; m++) rows[m] = src + (i + m) * lds;
+        T *o = out + i * ldo;
+        convRow(rows.data(), kr, 1, c, 1, tmp.data(), nc + kc - 1);
+        convRow(&t, 1, kc, r, kc, o, nc);
+    }
+}
+
+/*
+ * Convolution prepared once for a kernel and an input size, then applied to any number of images: the method is
+ * resolved, a separable kernel is factored and the FFT kernel spectrum is computed at construction, and apply()
+ * writes into caller-provided buffers, running the tiles of all images of a batch in parallel.
+ */
+template<class T>
+class ConvPlan {
+    long long rows, cols, kr, kc, outRows, outCols, oy, ox;
+    ConvBorder border;
+    ConvMethod method; // Direct, FFT, Separable or Winograd
+    Mat<T> ker;
+    std::vector<T> c, r; // ker = c * r^T for Separable
+    std::vector<T> winograd; // transformed kernel G g G^T
+    int winogradTile = 0; // output tile size M of F(M x M, R x R)
+    std::shared_ptr<const ConvFFTTile<T>> fft;
+    long long tr = CONV_TILE_ROWS, tc = CONV_TILE_COLS;
+
+    void shape(ConvShape s);
+
+    void run(const T *in, long long ldi, long long inStride, T *out, long long ldo, long long outStride,
+             long long count) const;
+
+public:
+    // Mat::conv(kernel, border, shape, method) for rows x cols inputs
+    ConvPlan(const Mat<T> &kernel, int rows, int cols, ConvBorder border = ConvBorder::Zero,
+             ConvShape shape = ConvShape::Same, ConvMethod method = ConvMethod::Auto);
+
+    // Mat::convSeparable(colKernel, rowKernel, border, shape) for rows x cols inputs
+    ConvPlan(const Mat<T> &colKernel, const Mat<T> &rowKernel, int rows, int cols,
+             ConvBorder border = ConvBorder::Zero, ConvShape shape = ConvShape::Same);
+
+    int outputRows() const { return (int) outRows; }
+
+    int outputCols() const { return (int) outCols; }
+
+    ConvMethod resolvedMethod() const { return method; }
+
+    // count row-major images packed back to back, written to count packed outputRows() x outputCols() results
+    void apply(const T *images, T *outputs, long long count = 1) const;
+
+    void apply(const Mat<T> &image, Mat<T> &output) const; // output must already have the output size
+
+    Mat<T> apply(const Mat<T> &image) const;
+};
+
+template<class T>
+void ConvPlan<T>::shape(ConvShape s) {
+    outRows = rows, outCols = cols, oy = kr / 2, ox = kc / 2;
+    if (s == ConvShape::Valid) {
+        outRows = std::max<long long>(0, rows - kr + 1), outCols = std::max<long long>(0, cols - kc + 1);
+        oy = ox = 0;
+    } else if (s == ConvShape::Full) {
+        outRows = rows + kr - 1, outCols = cols + kc - 1;
+        oy = kr - 1, ox = kc - 1;
+    }
+}
+
+template<class T>
+ConvPlan<T>::ConvPlan(const Mat<T> &kernel, int rows, int cols, ConvBorder border, ConvShape shape,
+                      ConvMethod method) : rows(rows), cols(cols), kr(kernel.row), kc(kernel.col), border(border),
+                                           method(method), ker(kernel) {
+    ker.toDense();
+    if (ker.pData == kernel.pData) ker = ker.clone(); // the plan keeps its own copy
+    this->shape(shape);
+    bool twoD = kr > 1 && kc > 1;
+    bool separable = (method == ConvMethod::Auto || method == ConvMethod::Separable) && twoD &&
+                     separableFactors<T>(kr, kc, ker.pData.get(), ker.step, c, r);
+    if (method == ConvMethod::Separable && !separable && twoD) throw (Conv_KernelNotSeparable("kernel is not rank 1"));
+    bool winogradShape = winogradSupported<T> && kr == kc && (kr == 3 || kr == 5);
+    if (separable) {
+        this->method = ConvMethod::Separable;
+    } else if (method == ConvMethod::Auto || method == ConvMethod::Separable) {
+        // integer results are only exact on the direct path
+        long long taps = std::is_same_v<T, float> ? CONV_FFT_TAPS_FLOAT : CONV_FFT_TAPS;
+        bool large = kr * kc >= taps;
+        this->method = std::is_floating_point_v<T> && large ? ConvMethod::FFT : ConvMethod::Direct;
+    } else if (method == ConvMethod::Winograd && !winogradShape) {
+        this->method = ConvMethod::Direct;
+    }
+    if constexpr (winogradSupported<T>) {
+        if (this->method == ConvMethod::Winograd) {
+            // F(4 x 4, 3 x 3) loses about a digit to F(2 x 2, 3 x 3), too much for float
+            winogradTile = kr == 5 || std::is_same_v<T, float> ? 2 : 4;
+            if (kr == 5) winograd = winogradKernel<T, 2, 5>(ker.pData.get(), ker.step);
+            else if (winogradTile == 4) winograd = winogradKernel<T, 4, 3>(ker.pData.get(), ker.step);
+            else winograd = winogradKernel<T, 2, 3>(ker.pData.get(), ker.step);
+        }
+    }
+    if (this->method == ConvMethod::FFT && outRows > 0 && outCols > 0 && kr > 0 && kc > 0) {
+        auto [p, ftr] = convFFTTileSize(outRows, kr);
+        auto [q, ftc] = convFFTTileSize(outCols, kc);
+        fft = std::make_shared<const ConvFFTTile<T>>(kr, kc, ker.pData.get(), ker.step, p, q);
+        tr = ftr, tc = ftc;
+    }
+}
+
+template<class T>
+ConvPlan<T>::ConvPlan(const Mat<T> &colKernel, const Mat<T> &rowKernel, int rows, int cols, ConvBorder border,
+                      ConvShape shape) : rows(rows), cols(cols), border(border), method(ConvMethod::Separable) {
+    if (std::min(colKernel.row, colKernel.col) > 1 || std::min(rowKernel.row, rowKernel.col) > 1) {
+        throw (InvalidDimensionsException("separable kernels must be vectors"));
+    }
+    kr = (long long) colKernel.row * colKernel.col, kc = (long long) rowKernel.row * rowKernel.col;
+    this->shape(shape);
+    c.resize(kr);
+    r.resize(kc);
+    for (long long m = 0; m < kr; m++) c[m] = colKernel.get(colKernel.col == 1 ? m + 1 : 1, colKernel.col == 1 ? 1 : m + 1);
+    for (long long n = 0; n < kc; n++) r[n] = rowKernel.get(rowKernel.row == 1 ? 1 : n + 1, rowKernel.row == 1 ? n + 1 : 1);
+}
+
+template<class T>
+void ConvPlan<T>::run(const T *in, long long ldi, long long inStride, T *out, long long ldo, long long outStride,
+                      long long count) const {
+    if (count <= 0 || outRows == 0 || outCols == 0) return;
+    if (rows == 0 || cols == 0 || kr == 0 || kc == 0) {
+        for (long long b = 0; b < count; b++) {
+            for (long long i = 0; i < outRows; i++) std::fill(out + b * outStride + i * ldo, out + b * outStride + i * ldo + outCols, T(0));
+        }
+        return;
+    }
+    auto tiles = [&](const auto &tile) {
+        convTiles(rows, cols, in, ldi, inStride, outRows, outCols, out, ldo, outStride, count, oy, ox, border, kr, kc,
+                  tr, tc, tile);
+    };
+    if (method == ConvMethod::Separable) {
+        tiles([&](const T *s, long long lds, long long nr, long long nc, T *o, long long ldo) {
+            convSeparableTile(s, lds, nr, nc, c.data(), kr, r.data(), kc, o, ldo);
+        });
+    } else if (method == ConvMethod::FFT) {
+        tiles(*fft);
+    } else if (method == ConvMethod::Winograd) {
+        if constexpr (winogradSupported<T>) {
+            tiles([&](const T *s, long long lds, long long nr, long long nc, T *o, long long ldo) {
+                const T *k = ker.pData.get(), *U = winograd.data();
+                if (kr == 5) convWinogradTile<T, 2, 5>(s, lds, nr, nc, U, k, ker.step, o, ldo);
+                else if (winogradTile == 4) convWinogradTile<T, 4, 3>(s, lds, nr, nc, U, k, ker.step, o, ldo);
+                else convWinogradTile<T, 2, 3>(s, lds, nr, nc, U, k, ker.step, o, ldo);
+            });
+        }
+    } else {
+        tiles([&](const T *s, long long lds, long long nr, long long nc, T *o, long long ldo) {
+            convDirectTile(s, lds, nr, nc, kr, kc, ker.pData.get(), ker.step, o, ldo);
+        });
+    }
+}
+
+template<class T>
+void ConvPlan<T>::apply(const T *images, T *outputs, long long count) const {
+    run(images, cols, rows * cols, outputs, outCols, outRows * outCols, count);
+}
+
+template<class T>
+void ConvPlan<T>::apply(const Mat<T> &image, Mat<T> &output) const {
+    if (image.row != rows || image.col != cols) throw (InvalidDimensionsException("image size does not match the plan"));
+    if (output.row != outRows || output.col != outCols || output.isSparse) {
+        throw (InvalidDimensionsException("output must be a dense matrix of the plan's output size"));
+    }
+    Mat<T> src = image;
+    src.toDense();
+    output.touch();
+    run(src.pData.get(), src.step, 0, output.pData.get(), output.step, 0, 1);
+}
+
+template<class T>
+Mat<T> ConvPlan<T>::apply(const Mat<T> &image) const {
+    Mat<T> ans((int) outRows, (int) outCols);
+    apply(image, ans);
+    return ans;
+}
+
+template<class T>
+Mat<T> Mat<T>::convSeparable(const Mat<T> &colKernel, const Mat<T> &rowKernel, ConvBorder border,
+                             ConvShape shape) const {
+    return ConvPlan<T>(colKernel, rowKernel, row, col, border, shape).apply(*this);
+}
+
+template<class T>
+Mat<T> Mat<T>::conv(const Mat<T> &kernel, ConvMethod method) const {
+    return conv(kernel, ConvBorder::Zero, ConvShape::Same, method);
+}
+
+template<class T>
+Mat<T> Mat<T>::conv(const Mat<T> &kernel, ConvBorder border, ConvShape shape, ConvMethod method) const {
+    return ConvPlan<T>(kernel, row, col, border, shape, method).apply(*this);
+}
+
+// split the rows of a CSR matrix into at most threadCount() blocks holding roughly the same number of nonzeros
+template<class T>
+std::vector<long long> sparseRowBlocks(const SparseStorage<T> &A) {
+    long long nnz = A.nonZeros();
+    long long parts = std::min<long long>(threadCount(), std::max<long long>(1, (nnz + A.outer) / 16384));
+    std::vector<long long> bounds{0};
+    for (long long t = 1; t < parts; t++) {
+        long long target = nnz * t / parts;
+        long long r = std::upper_bound(A.ptr.begin(), A.ptr.end(), target) - A.ptr.begin() - 1;
+        bounds.push_back(std::max(bounds.back(), r));
+    }
+    bounds.push_back(A.outer);
+    return bounds;
+}
+
+// y = A * x for a CSR matrix A, rows are processed in nonzero-balanced blocks on all threads
+template<class T>
+void spmv(const SparseStorage<T> &A, const T *x, T *y) {
+    spmv(A, sparseRowBlocks(A), x, y);
+}
+
+// spmv() with the row blocks computed once by sparseRowBlocks(), for repeated products with the same matrix
+template<class T>
+void spmv(const SparseStorage<T> &A, const std::vector<long long> &bounds, const T *x, T *y) {
+    parallelFor(0, (long long) bounds.size() - 1, 1, [&](long long lo, long long hi) {
+        for (long long i = bounds[lo]; i < bounds[hi]; i++) {
+            T sum = T(0);
+            for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+                sum += A.val[p] * x[A.idx[p]];
+            }
+            y[i] = sum;
+        }
+    });
+}
+
+// y = A^T * x for a CSR matrix A (x has A.outer entries, y has A.inner entries). Every row block scatters into its
+// own copy of y (the first one into y itself), then the copies are summed column-wise.
+template<class T>
+void spmvTransposed(const SparseStorage<T> &A, const T *x, T *y) {
+    std::vector<long long> bounds = sparseRowBlocks(A);
+    long long parts = (long long) bounds.size() - 1;
+    std::vector<T> partial(std::max<long long>(0, parts - 1) * A.inner);
+    parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+        for (long long b = lo; b < hi; b++) {
+            T *acc = b == 0 ? y : partial.data() + (b - 1) * A.inner;
+            std::fill(acc, acc + A.inner, T(0));
+            for (long long i = bounds[b]; i < bounds[b + 1]; i++) {
+                T xi = x[i];
+                if (xi == T(0)) continue;
+                for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+                    acc[A.idx[p]] += A.val[p] * xi;
+                }
+            }
+        }
+    });
+    if (parts <= 1) return;
+    parallelFor(0, A.inner, 4096, [&](long long lo, long long hi) {
+        for (long long b = 1; b < parts; b++) {
+            const T *acc = partial.data() + (b - 1) * A.inner;
+            elementwise(ElementwiseOp::Add, y + lo, acc + lo, T(0), y + lo, hi - lo);
+        }
+    });
+}
+
+// C = A * B for a CSR matrix A and a dense row-major B with n columns
+template<class T>
+void spmm(const SparseStorage<T> &A, const T *B, long long ldb, long long n, T *C, long long ldc) {
+    std::vector<long long> bounds = sparseRowBlocks(A);
+    parallelFor(0, (long long) bounds.size() - 1, 1, [&](long long lo, long long hi) {
+        for (long long i = bounds[lo]; i < bounds[hi]; i++) {
+            T *c = C + i * ldc;
+            std::fill(c, c + n, T(0));
+            for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+                T a = A.val[p];
+                const T *b = B + A.idx[p] * ldb;
+                for (long long j = 0; j < n; j++) {
+                    c[j] += a * b[j];
+                }
+            }
+        }
+    });
+}
+
+// C = A * B for a dense row-major m x k matrix A and a CSR matrix B
+template<class T>
+void denseTimesSparse(long long m, const T *A, long long lda, const SparseStorage<T> &B, T *C, long long ldc) {
+    parallelFor(0, m, std::max<long long>(1, 16384 / (B.nonZeros() / std::max<long long>(1, B.outer) + 1)),
+                [&](long long lo, long long hi) {
+                    for (long long i = lo; i < hi; i++) {
+                        const T *a = A + i * lda;
+                        T *c = C + i * ldc;
+                        std::fill(c, c + B.inner, T(0));
+                        for (long long k = 0; k < B.outer; k++) {
+                            T aik = a[k];
+                            if (aik == T(0)) continue;
+                            for (long long p = B.ptr[k]; p < B.ptr[k + 1]; p++) {
+                                c[B.idx[p]] += aik * B.val[p];
+                            }
+                        }
+                    }
+                });
+}
+
+/*
+ * Sparse x sparse product (Gustavson, row by row). The symbolic phase computes the pattern of C = A * B and
+ * is kept in an SpGemmPlan, the numeric phase only fills values, so products repeated with the same sparsity
+ * patterns pay for the symbolic phase once:
+ *     SpGemmPlan<double> plan = spgemmSymbolic(A, B);
+ *     Mat<double> C = spgemmNumeric(plan, A, B); // again whenever the values of A or B change
+ * Rows of C are merged with a dense marker array when C is narrow enough and with an open addressing hash
+ * table otherwise. Each row pattern is built once, into a buffer per row block, and copied into place after the
+ * row lengths are summed. The plan remembers the patterns of A and B by their SparseStorage::pattern stamps.
+ */
+template<class T>
+struct SpGemmPlan {
+    long long rows = 0;
+    long long cols = 0;
+    long long inner = 0;
+    unsigned long long lhsPattern = 0, rhsPattern = 0; // CSR patterns of A and B the plan was built for
+    std::vector<long long> ptr; // CSR pattern of the product
+    std::vector<int> idx;
+};
+
+// widest product merged with a dense marker array, an int per column of C for every thread
+constexpr long long SPGEMM_DENSE_LIMIT = 1 << 20;
+
+// collect the distinct columns of row i of A * B into cols, using either marker (dense) or table (hash)
+template<class T>
+void spgemmRowPattern(const SparseStorage<T> &A, const SparseStorage<T> &B, long long i,
+                      std::vector<int> &marker, std::vector<int> &table, std::vector<int> &cols) {
+    cols.clear();
+    if (B.inner <= SPGEMM_DENSE_LIMIT) {
+        for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+            long long k = A.idx[p];
+            for (long long q = B.ptr[k]; q < B.ptr[k + 1]; q++) {
+                int j = B.idx[q];
+                if (marker[j] != i) {
+                    marker[j] = i;
+                    cols.push_back(j);
+                }
+            }
+        }
+    } else {
+        long long bound = 0;
+        for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+            bound += B.ptr[A.idx[p] + 1] - B.ptr[A.idx[p]];
+        }
+        size_t size = 16;
+        while ((long long) size < 2 * bound) size <<= 1;
+        table.assign(size, -1);
+        for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+            long long k = A.idx[p];
+            for (long long q = B.ptr[k]; q < B.ptr[k + 1]; q++) {
+                int j = B.idx[q];
+                size_t h = ((size_t) j * 2654435761u) & (size - 1);
+                while (table[h] != -1 && table[h] != j) h = (h + 1) & (size - 1);
+                if (table[h] == -1) {
+                    table[h] = j;
+                    cols.push_back(j);
+                }
+            }
+        }
+    }
+    std::sort(cols.begin(), cols.end());
+}
+
+template<class T>
+SpGemmPlan<T> spgemmSymbolic(const Mat<T> &lhs, const Mat<T> &rhs) {
+    if (lhs.col != rhs.row) {
+        throw (Multiply_DimensionsNotMatched(""));
+    }
+    const SparseStorage<T> &A = lhs.csr();
+    const SparseStorage<T> &B = rhs.csr();
+    SpGemmPlan<T> plan;
+    plan.rows = lhs.row;
+    plan.cols = rhs.col;
+    plan.inner = lhs.col;
+    plan.lhsPattern = A.pattern;
+    plan.rhsPattern = B.pattern;
+    plan.ptr.assign(plan.rows + 1, 0);
+    long long markerSize = B.inner <= SPGEMM_DENSE_LIMIT ? B.inner : 0;
+    std::vector<long long> bounds = sparseRowBlocks(A);
+    long long blocks = (long long) bounds.size() - 1;
+    std::vector<std::vector<int>> blockIdx(blocks); // sorted columns of the rows of each block, back to back
+    parallelFor(0, blocks, 1, [&](long long lo, long long hi) {
+        std::vector<int> marker(markerSize, -1);
+        std::vector<int> table, cols;
+        for (long long b = lo; b < hi; b++) {
+            for (long long i = bounds[b]; i < bounds[b + 1]; i++) {
+                spgemmRowPattern(A, B, i, marker, table, cols);
+                plan.ptr[i + 1] = (long long) cols.size();
+                blockIdx[b].insert(blockIdx[b].end(), cols.begin(), cols.end());
+            }
+        }
+    });
+    for (long long i = 0; i < plan.rows; i++) plan.ptr[i + 1] += plan.ptr[i];
+    plan.idx.resize(plan.ptr[plan.rows]);
+    parallelFor(0, blocks, 1, [&](long long lo, long long hi) {
+        for (long long b = lo; b < hi; b++) {
+            std::copy(blockIdx[b].begin(), blockIdx[b].end(), plan.idx.begin() + plan.ptr[bounds[b]]);
+            std::vector<int>().swap(blockIdx[b]);
+        }
+    });
+    return plan;
+}
+
+template<class T>
+Mat<T> spgemmNumeric(const SpGemmPlan<T> &plan, const Mat<T> &lhs, const Mat<T> &rhs) {
+    const SparseStorage<T> &A = lhs.csr();
+    const SparseStorage<T> &B = rhs.csr();
+    // the numeric phase relies on every product term landing in the planned pattern
+    if (lhs.row != plan.rows || rhs.col != plan.cols || lhs.col != plan.inner || A.pattern != plan.lhsPattern ||
+        B.pattern != plan.rhsPattern) {
+        throw InvalidDimensionsException("Sparsity pattern does not match the SpGEMM plan");
+    }
+    Mat<T> ans((int) plan.rows, (int) plan.cols, nullptr, true);
+    SparseStorage<T> &C = *ans.pSparse;
+    C.ptr = plan.ptr;
+    C.idx = plan.idx;
+    C.val.assign(plan.idx.size(), T(0));
+    bool dense = B.inner <= SPGEMM_DENSE_LIMIT;
+    std::vector<long long> bounds = sparseRowBlocks(A);
+    parallelFor(0, (long long) bounds.size() - 1, 1, [&](long long lo, long long hi) {
+        std::vector<int> pos(dense ? B.inner : 0); // column -> offset in the current row of C
+        for (long long i = bounds[lo]; i < bounds[hi]; i++) {
+            long long cb = C.ptr[i];
+            long long ce = C.ptr[i + 1];
+            if (dense) {
+                for (long long c = cb; c < ce; c++) pos[C.idx[c]] = (int) (c - cb);
+            }
+            for (long long p = A.ptr[i]; p < A.ptr[i + 1]; p++) {
+                T a = A.val[p];
+                long long k = A.idx[p];
+                for (long long q = B.ptr[k]; q < B.ptr[k + 1]; q++) {
+                    long long c = dense ? cb + pos[B.idx[q]]
+                                        : std::lower_bound(C.idx.begin() + cb, C.idx.begin() + ce, B.idx[q]) -
+                                          C.idx.begin();
+                    C.val[c] += a * B.val[q];
+                }
+            }
+        }
+    });
+    return ans;
+}
+
+template<class T2>
+Mat<T2> operator*(Mat<T2> const &lhs, Mat<T2> const &rhs) {
+    if (lhs.col != rhs.row) {
+        throw (Multiply_DimensionsNotMatched(""));
+    }
+    if (lhs.isSparse && rhs.isSparse) {
+        return spgemmNumeric(spgemmSymbolic(lhs, rhs), lhs, rhs);
+    }
+    Mat<T2> ans(lhs.row, rhs.col);
+    if (!lhs.isSparse && !rhs.isSparse) {
+        gemm<T2>(lhs.row, rhs.col, lhs.col, T2(1),
+                 lhs.pData.get(), lhs.step, 1,
+                 rhs.pData.get(), rhs.step, 1,
+                 T2(0), ans.pData.get(), ans.step);
+    } else if (lhs.isSparse && !rhs.isSparse) {
+        spmm(lhs.csr(), rhs.pData.get(), rhs.step, rhs.col, ans.pData.get(), ans.step);
+    } else if (!lhs.isSparse && rhs.isSparse) {
+        denseTimesSparse(lhs.row, lhs.pData.get(), lhs.step, rhs.csr(), ans.pData.get(), ans.step);
+    }
+    ans.setZero();
+    return ans;
+}
+
+// matrix-vector product, the vector is treated as a column and the result is a row x 1 matrix
+template<class T2>
+Mat<T2> operator*(Mat<T2> const &lhs, std::vector<T2> const &rhs) {
+    if (lhs.col != (long long) rhs.size()) {
+        std::cerr << "Dimension not matched for multiply" << "\n";
+        throw (Multiply_DimensionsNotMatched(""));
+    }
+    Mat<T2> ans(lhs.row, 1);
+    if (lhs.isSparse) {
+        spmv(lhs.csr(), rhs.data(), ans.pData.get());
+    } else {
+        gemm<T2>(lhs.row, 1, lhs.col, T2(1), lhs.pData.get(), lhs.step, 1, rhs.data(), 1, 1,
+                 T2(0), ans.pData.get(), 1);
+    }
+    return ans;
+}
+
+template<class T>
+Mat<T> Mat<T>::resize(int x, int y) {
+    Mat<T> ans(x, y);
+    int i_ = 1;
+    int j_ = 1;
+    for (int i = 1; i <= x; i++) {
+        for (int j = 1; j <= y; j++) {
+            if (i_ <= this->row && j_ <= this->col) {
+                ans.set(i, j, this->get(i_, j_));
+            } else {
+                ans.set(i, j, 0);
+            }
+            j_++;
+            if (j_ == this->col) {
+                j_ = 0;
+                i_++;
+            }
+        }
+    }
+    return ans;
+}
+
+//template <class T>
+//cv::Mat Mat<T>::toOpencv() {
+//    cv::Mat ans(this->row, this->col, CV_64F);
+//    for (int i = 1; i <= this->row; i++) {
+//        for (int j = 1; j <= this->col; j++) {
+//            ans.at<double>(i - 1, j - 1) = this->get(i, j);
+//        }
+//    }
+//    return Mat<T>(rhs.row, rhs.col, &list);
+//}
+
+template<class T>
+int Mat<T>::rank(double tol) {
+    std::vector<double> sv = this->singularValues();
+    if (tol < 0) {
+        tol = sv.empty() ? 0 : (double) std::max(this->row, this->col) * std::numeric_limits<double>::epsilon() * sv[0];
+    }
+    int res{};
+    for (double x: sv) res += x > tol;
+    return res;
+}
+
+template<class T>
+std::vector<double> Mat<T>::singularValues() {
+    MatCache<T> &c = this->cache();
+    if (!c.singularValues.valid(*c.version)) {
+        using Real = std::conditional_t<std::is_floating_point_v<T>, T, double>; // integers go through double
+        std::vector<Real> s;
+        if constexpr (std::is_floating_point_v<T>) {
+            s = SVD<Real>(*this, true, false).singularValues();
+        } else {
+            Mat<Real> d((int) this->row, (int) this->col);
+            for (int i = 1; i <= this->row; i++) {
+                for (int j = 1; j <= this->col; j++) d(i, j) = (Real) this->get(i, j);
+            }
+            s = SVD<Real>(d, true, false).singularValues();
+        }
+        std::vector<double> sv(s.begin(), s.end());
+        c.singularValues.value = std::make_shared<std::vector<double>>(std::move(sv));
+        c.singularValues.version = *c.version;
+    }
+    return *c.singularValues.value;
+}
+
+template<class T>
+double Mat<T>::cond() {
+    std::vector<double> sv = this->singularValues();
+    if (sv.empty()) return 0;
+    return sv.back() > 0 ? sv.front() / sv.back() : std::numeric_limits<double>::infinity();
+}
+
+template<class T>
+Mat<T> Mat<T>::pinv(double tol) {
+    if constexpr (std::is_floating_point_v<T>) {
+        return SVD<T>(*this).pinv(tol);
+    } else {
+        throw (ClassTypeNotSupport("pinv() requires a floating point matrix"));
+    }
+}
+
+
+template<class T2>
+Mat<T2> Mat<T2>::gauss() {
+    int cnt;
+    return this->gauss(cnt);
+}
+
+
+template<class T2>
+Mat<T2> Mat<T2>::gauss(int &cnt) {
+    Mat<T2> out = this->clone();
+    out.toDense();
+    int n = out.col;
+    int i = 1;
+    int pivot = 1;
+    int l_cnt = 0;
+
+    for (; i <= out.row && pivot <= out.col; i++, pivot++) {
+        for (int k = i + 1; k <= out.row; k++) {
+            if (out(i, pivot) != 0) {
+                break;
+            } else if (out(k, pivot) != 0) {
+                l_cnt++;
+                std::swap_ranges(out.rowPtr(i), out.rowPtr(i) + n, out.rowPtr(k));
+                break;
+            }
+        }
+    }
+
+    for (i = 1; i <= std::min(out.row, out.col); i++) {
+        int max = i;
+        for (int k = i; k <= out.row; k++) {
+            if (fabs(out(k, i)) > fabs(out(max, i))) max = k;
+        }
+        if (fabs(out(max, i)) < EPS) continue;
+        if (max != i) {
+            l_cnt++;
+            std::swap_ranges(out.rowPtr(i), out.rowPtr(i) + n, out.rowPtr(max));
+        }
+        const T2 *pr = out.rowPtr(i);
+        for (int k = i + 1; k <= out.row; k++) {
+            T2 a = -out(k, i) / pr[i - 1];
+            T2 *r = out.rowPtr(k);
+            for (int count = 0; count < n; count++) {
+                r[count] += a * pr[count];
+            }
+        }
+    }
+    out.setZero();
+    cnt = l_cnt;
+    return out;
+}
+
+template<class T>
+std::vector<T> Mat<T>::getRow(int l_row) {
+    if (this->isSparse) {
+        std::vector<T> res;
+        for (int i = 1; i <= this->col; ++i) {
+            res.template emplace_back(this->get(l_row, i));
+        }
+        return res;
+    }
+    if (l_row < 1 || l_row > this->row) throw InvalidCoordinatesException("Index out of range");
+    const T *r = this->rowPtr(l_row);
+    return std::vector<T>(r, r + this->col);
+}
+
+template<class T>
+std::vector<T> Mat<T>::getCol(int l_col) {
+    std::vector<T> res;
+    if (this->isSparse) {
+        for (int i = 1; i <= this->row; ++i) {
+            res.template emplace_back(this->get(i, l_col));
+        }
+        return res;
+    }
+    if (l_col < 1 || l_col > this->col) throw InvalidCoordinatesException("Index out of range");
+    StridedView<T> c = this->colView(l_col);
+    for (long long i = 0; i < c.size(); ++i) {
+        res.template emplace_back(c[i]);
+    }
+    return res;
+}
+
+template<class T>
+//获取代数余子式
+Mat<T> Mat<T>::getCominor(int x, int y) {
+    if (x > this->row || y > this->col) throw (Cominor_CoordinateExceedsBounds(""));
+    std::vector<T> res;
+    for (int i = 1; i <= this->row; ++i) {
+        for (int j = 1; j <= this->col; ++j) {
+            if (i != x || j != y) res.template emplace_back(this->get(i, j));
+        }
+    }
+    return Mat<T>(this->row - 1, this->col - 1, &res);
+}
+
+template<class T>
+T Mat<T>::det() {
+    if (this->col != this->row) throw (Determinant_NotSquareMatrix(""));
+    if constexpr (!std::is_integral_v<T>) {
+        MatCache<T> &c = this->cache();
+        if (!c.det.valid(*c.version)) {
+            c.det.value = std::make_shared<T>(this->lu().det());
+            c.det.version = *c.version;
+        }
+        return *c.det.value;
+    } else {
+        int cnt{};
+        T ans = 1;
+        Mat<T> res = this->gauss(cnt);
+        for (int i = 1; i <= this->col; ++i) {
+            ans *= res(i, i);
+        }
+        return pow(-1, cnt) * ans;
+    }
+}
+
+template<class T>
+double Mat<T>::trace() {
+    double ans{};
+    if (this->col != this->row) throw (Trace_NotSquareMatrix(""));
+    else if (this->isSparse) {
+        for (int i = 0; i < this->row; ++i) {
+            ans += this->get(i + 1, i + 1);
+        }
+    } else {
+        for (int i = 1; i <= this->row; ++i) {
+            ans += (*this)(i, i);
+        }
+    }
+    return ans;
+}
+
+template<class T>
+Mat<T> Mat<T>::inverse() {
+    if (this->row != this->col) {
+        throw Inverse_NotSquareMatrix("error: calculate the inverse of a non-square matrix");
+    }
+    if constexpr (!std::is_integral_v<T>) {
+        MatCache<T> &c = this->cache();
+        if (!c.inverse.valid(*c.version)) {
+            c.inverse.value = std::make_shared<Mat<T>>(this->lu().inverse());
+            c.inverse.version = *c.version;
+        }
+        return c.inverse.value->clone(); // callers may modify their copy
+    }
+    int n = this->row;
+    Mat<T> src = *this;
+    src.toDense();
+    Mat<T> a(n, 2 * n);
+    for (int i = 1; i <= n; i++) {
+        const T *r = src.rowPtr(i);
+        std::copy(r, r + n, a.rowPtr(i));
+        /* Augmenting Identity Matrix of Order n */
+        a(i, i + n) = 1;
+    }
+
+    /* Applying Gauss Jordan Elimination */
+    for (int i = 1; i <= n; i++) {
+        if (a(i, i) == 0) {
+            std::cout << "Mathematical Error!";
+            throw (Inverse_NotInvertible(""));
+        }
+        const T *pr = a.rowPtr(i);
+        for (int j = 1; j <= n; j++) {
+            if (i != j) {
+                T ratio = a(j, i) / pr[i - 1];
+                T *r = a.rowPtr(j);
+                for (int k = 0; k < 2 * n; k++) {
+                    r[k] -= ratio * pr[k];
+                }
+            }
+        }
+    }
+    /* Row Operation to Make Principal Diagonal to 1 */
+    Mat<T> rt(n, n);
+    for (int i = 1; i <= n; i++) {
+        const T *r = a.rowPtr(i);
+        T *out = rt.rowPtr(i);
+        for (int j = 0; j < n; j++) {
+            out[j] = r[j + n] / r[i - 1];
+        }
+    }
+    return rt;
+}
+
+template<class T>
+void Mat<T>::setZero() {
+    this->touch();
+    if (this->isSparse) {
+        for (T &v: this->pSparse->val) {
+            if (fabs(v) < EPS) v = 0.0;
+        }
+        return;
+    }
+    for (int i = 1; i <= row; ++i) {
+        T *r = this->rowPtr(i);
+        for (long long j = 0; j < col; ++j) {
+            if (fabs(r[j]) < EPS) r[j] = 0.0;
+        }
+    }
+}
+
+Mat<double> ranMatGen(int x, int y, int start = 1, int end = 10) {
+    std::vector<double> list;
+    for (int i = 0; i < x; ++i) {
+        for (int j = 0; j < y; ++j) {
+            list.emplace_back(random(start, end));
+        }
+    }
+    return Mat<double>(x, y, &list);
+}
+
+template<class T>
+Mat<T> unitMatGen(int x) {
+    std::vector<T> list;
+    for (int i = 0; i < x; ++i) {
+        for (int j = 0; j < x; ++j) {
+            if (i != j) list.template emplace_back(0);
+            else list.template emplace_back(1);
+        }
+    }
+    return Mat<T>(x, x, &list);
+}
+
+// xoshiro256** generator seeded through splitmix64: small state, fast, and good enough for random sketches
+struct Xoshiro256 {
+    unsigned long long s[4];
+
+    explicit Xoshiro256(unsigned long long seed) {
+        for (unsigned long long &x: s) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            unsigned long long z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            x = z ^ (z >> 31);
+        }
+    }
+
+    static unsigned long long rotl(unsigned long long x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    unsigned long long next() {
+        unsigned long long result = rotl(s[1] * 5, 7) * 9;
+        unsigned long long t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    double uniform() { return (double) (next() >> 11) * 0x1.0p-53; } // [0, 1)
+};
+
+// x x y matrix of independent standard normal entries (Box-Muller). Rows are generated in parallel blocks, each from
+// its own stream derived from seed, so the result does not depend on the number of threads.
+template<class T>
+Mat<T> gaussianMatGen(int x, int y, unsigned long long seed = 0) {
+    Mat<T> G(x, y);
+    const long long block = 64;
+    parallelFor(0, (x + block - 1) / block, 1, [&](long long lo, long long hi) {
+        for (long long b = lo; b < hi; b++) {
+            Xoshiro256 rng(seed ^ (0x5851f42d4c957f2dULL * (unsigned long long) (b + 1)));
+            for (long long i = b * block; i < std::min<long long>(x, (b + 1) * block); i++) {
+                T *r = G.rowPtr((int) i + 1);
+                for (long long j = 0; j < y; j += 2) {
+                    double radius = std::sqrt(-2.0 * std::log(1.0 - rng.uniform()));
+                    double angle = 6.283185307179586 * rng.uniform();
+                    r[j] = T(radius * std::cos(angle));
+                    if (j + 1 < y) r[j + 1] = T(radius * std::sin(angle));
+                }
+            }
+        }
+    });
+    return G;
+}
+
+template<class T2>
+void Mat<T2>::QR(Mat<T2> &Q, Mat<T2> &R, bool thin) {
+    HouseholderQR<T2> qr(*this);
+    Q = qr.Q(thin);
+    R = qr.R(thin);
+}
+
+template<class T2>
+void Mat<T2>::eigen(Mat<T2> &value, Mat<T2> &vector) {
+    Mat<T2> temp = this->clone();
+    if (temp.col != temp.row) {
+        throw (InvalidDimensionsException("Only square matrices have eigenvalues and eigenvectors."));
+    } else if (value.col != this->col || value.row != 1) {
+        throw (InvalidDimensionsException("Size of matrices for eigenvalue should be 1 X N."));
+    } else if (vector.col != vector.row || vector.row != this->row) {
+        throw (InvalidDimensionsException("Size for eigenvetor container mismatch"));
+    }
+    temp.toDense();
+    value.toDense();
+    vector.toDense();
+
+    if constexpr (std::is_floating_point_v<T2>) {
+        bool symmetric = true;
+        for (int i = 1; i <= temp.row && symmetric; i++) {
+            for (int j = 1; j < i; j++) {
+                if (std::abs(temp(i, j) - temp(j, i)) > EPS * std::max<T2>(1, std::abs(temp(i, j)))) {
+                    symmetric = false;
+                    break;
+                }
+            }
+        }
+        if (symmetric) {
+            SymmetricEigen<T2> es(temp);
+            Mat<T2> z = es.vectors();
+            for (int i = 1; i <= value.col; i++) value(1, i) = es.values()[i - 1];
+            for (int i = 1; i <= vector.row; i++) {
+                const T2 *r = z.rowPtr(i);
+                std::copy(r, r + vector.col, vector.rowPtr(i));
+            }
+            value.touch();
+            vector.touch();
+            return;
+        }
+
+        GeneralEigen<T2> ge(temp);
+        Mat<T2> z = ge.realVectors(); // throws Eigen_ComplexSpectrum when some eigenvalues are complex
+        std::vector<std::complex<T2>> ev = ge.values();
+        std::vector<int> order(ev.size());
+        for (int i = 0; i < (int) order.size(); i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int x, int y) { return ev[x].real() < ev[y].real(); });
+        for (int i = 1; i <= value.col; i++) {
+            value(1, i) = ev[order[i - 1]].real();
+            for (int j = 1; j <= vector.row; j++) vector(j, i) = z(j, order[i - 1] + 1);
+        }
+        value.touch();
+        vector.touch();
+        return;
+    }
+
+    Mat<T2> Q(temp.row, temp.col);
+    Mat<T2> R(temp.row, temp.col);
+    for (int count = 1; count <= 50; count++) {
+        temp.QR(Q, R);
+        temp = R * Q;
+    }
+
+    for (int i = 1; i <= value.col; i++)
+        value(1, i) = temp(i, i);
 
     T2 evalue;
     for (int i = 1; i <= value.col; i++) {
-        evalue = value.get(1, i);
+        evalue = value(1, i);
         temp = this->clone();
+        temp.toDense();
         //temp.print();
         for (int j = 1; j <= temp.col; j++)
-            temp.set(j, j, temp.get(j, j) - evalue);
+            temp(j, j) = temp(j, j) - evalue;
+
+        //temp.print();
+        temp = temp.gauss();
+        //std::cout << "After gauss" << std::endl;
+        //temp.print();
+        for (int j = temp.col; j >= 1; j--) {
+            if (temp(j, j) != 0) {
+                for (int k = 1; k <= j - 1; k++) {
+                    T2 ratio = -temp(k, j) / temp(j, j);
+                    for (int count = 1; count <= temp.col; count++) {
+                        temp(k, count) = temp(k, count) + ratio * temp(j, count);
+                    }
+                }
+            }
+        }
+        //std::cout << "Guass again" << std::endl;
+        //temp.print();
+        for (int j = 1; j <= vector.row; j++) {
+            vector(j, i) = temp(j, j);
+        }
+    }
+
+    value.touch();
+    vector.touch();
+}
+
+template<class T>
+T Mat<T>::minRow(int r) {
+    if (r < 1 || r > this->row) throw InvalidCoordinatesException("Index out of range");
+    if (this->isSparse) {
+        std::vector<T> v = this->getRow(r);
+        return rangeStats(v.data(), (long long) v.size()).min;
+    }
+    return rangeStats(this->rowPtr(r), this->col).min;
+}
+
+template<class T>
+T Mat<T>::minCol(int c) {
+    std::vector<T> v = this->getCol(c);
+    return rangeStats(v.data(), (long long) v.size()).min;
+}
+
+template<class T>
+T Mat<T>::maxCol(int c) {
+    std::vector<T> v = this->getCol(c);
+    return rangeStats(v.data(), (long long) v.size()).max;
+}
+
+template<class T>
+T Mat<T>::maxRow(int r) {
+    if (r < 1 || r > this->row) throw InvalidCoordinatesException("Index out of range");
+    if (this->isSparse) {
+        std::vector<T> v = this->getRow(r);
+        return rangeStats(v.data(), (long long) v.size()).max;
+    }
+    return rangeStats(this->rowPtr(r), this->col).max;
+}
+
+template<class T>
+T Mat<T>::sumRow(int r) {
+    if (r < 1 || r > this->row) throw InvalidCoordinatesException("Index out of range");
+    if (this->isSparse) {
+        std::vector<T> v = this->getRow(r);
+        return rangeSum(v.data(), (long long) v.size());
+    }
+    return rangeSum(this->rowPtr(r), this->col);
+}
+
+template<class T>
+T Mat<T>::sumCol(int c) {
+    std::vector<T> v = this->getCol(c);
+    return rangeSum(v.data(), (long long) v.size());
+}
+
+template<class T>
+AxisStats<T> Mat<T>::rowStats() {
+    if (this->isSparse) {
+        return sparseAxisStats(this->csr());
+    }
+    AxisStats<T> st;
+    st.sum.resize(this->row);
+    st.min.resize(this->row);
+    st.max.resize(this->row);
+    st.argmin.resize(this->row);
+    st.argmax.resize(this->row);
+    if (this->col == 0) return st;
+    parallelFor(0, this->row, std::max<long long>(1, 65536 / this->col), [&](long long lo, long long hi) {
+        for (long long i = lo; i < hi; i++) {
+            RangeStats<T> r = rangeStats(this->rowPtr((int) i + 1), this->col);
+            st.sum[i] = r.sum;
+            st.min[i] = r.min;
+            st.max[i] = r.max;
+            st.argmin[i] = (int) r.argmin + 1;
+            st.argmax[i] = (int) r.argmax + 1;
+        }
+    });
+    return st;
+}
+
+template<class T>
+AxisStats<T> Mat<T>::colStats() {
+    if (this->isSparse) {
+        return sparseAxisStats(this->csc());
+    }
+    long long n = this->col;
+    AxisStats<T> st;
+    if (this->row == 0) return st;
+    // every thread folds a contiguous block of rows into its own accumulators, blocks are merged in row order
+    long long parts = std::min<long long>(threadCount(), std::max<long long>(1, this->row * n / 65536));
+    parts = std::min<long long>(parts, this->row);
+    std::vector<std::vector<T>> sum(parts, std::vector<T>(n));
+    std::vector<std::vector<T>> mn(parts, std::vector<T>(n));
+    std::vector<std::vector<T>> mx(parts, std::vector<T>(n));
+    std::vector<std::vector<StatsIndex<T>>> amin(parts, std::vector<StatsIndex<T>>(n));
+    std::vector<std::vector<StatsIndex<T>>> amax(parts, std::vector<StatsIndex<T>>(n));
+    parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+        for (long long t = lo; t < hi; t++) {
+            long long b = this->row * t / parts;
+            long long e = this->row * (t + 1) / parts;
+            for (long long i = b; i < e; i++) {
+                columnStatsAccumulate(this->rowPtr((int) i + 1), n, (StatsIndex<T>) i, i == b,
+                                      sum[t].data(), mn[t].data(), mx[t].data(), amin[t].data(), amax[t].data());
+            }
+        }
+    });
+    for (long long t = 1; t < parts; t++) {
+        for (long long j = 0; j < n; j++) {
+            sum[0][j] += sum[t][j];
+            if (mn[t][j] < mn[0][j]) {
+                mn[0][j] = mn[t][j];
+                amin[0][j] = amin[t][j];
+            }
+            if (mx[t][j] > mx[0][j]) {
+                mx[0][j] = mx[t][j];
+                amax[0][j] = amax[t][j];
+            }
+        }
+    }
+    st.sum.swap(sum[0]);
+    st.min.swap(mn[0]);
+    st.max.swap(mx[0]);
+    st.argmin.resize(n);
+    st.argmax.resize(n);
+    for (long long j = 0; j < n; j++) {
+        st.argmin[j] = (int) amin[0][j] + 1;
+        st.argmax[j] = (int) amax[0][j] + 1;
+    }
+    return st;
+}
+
+template<class T>
+std::vector<T> Mat<T>::sumRows() {
+    std::vector<T> ans(this->row, T(0));
+    if (this->isSparse) {
+        const SparseStorage<T> &s = this->csr();
+        for (long long i = 0; i < this->row; i++) {
+            ans[i] = rangeSum(s.val.data() + s.ptr[i], s.ptr[i + 1] - s.ptr[i]);
+        }
+        return ans;
+    }
+    parallelFor(0, this->row, std::max<long long>(1, 65536 / std::max<long long>(1, this->col)),
+                [&](long long lo, long long hi) {
+                    for (long long i = lo; i < hi; i++) {
+                        ans[i] = rangeSum(this->rowPtr((int) i + 1), this->col);
+                    }
+                });
+    return ans;
+}
+
+template<class T>
+std::vector<T> Mat<T>::sumCols() {
+    std::vector<T> ans(this->col, T(0));
+    if (this->isSparse) {
+        const SparseStorage<T> &s = this->csr();
+        for (long long p = 0; p < s.nonZeros(); p++) ans[s.idx[p]] += s.val[p];
+        return ans;
+    }
+    for (int i = 1; i <= this->row; i++) {
+        elementwise(ElementwiseOp::Add, ans.data(), this->rowPtr(i), T(0), ans.data(), this->col);
+    }
+    return ans;
+}
+
+template<class T>
+std::pair<int, int> Mat<T>::argMin() {
+    AxisStats<T> st = this->rowStats();
+    RangeStats<T> r = rangeStats(st.min.data(), (long long) st.min.size());
+    return {(int) r.argmin + 1, st.argmin[r.argmin]};
+}
+
+template<class T>
+std::pair<int, int> Mat<T>::argMax() {
+    AxisStats<T> st = this->rowStats();
+    RangeStats<T> r = rangeStats(st.max.data(), (long long) st.max.size());
+    return {(int) r.argmax + 1, st.argmax[r.argmax]};
+}
+
+/*
+ * Triangular solve with many right-hand sides: B := A^-1 * B, where A is an n x n lower or upper triangular
+ * row-major matrix (leading dimension lda) and B is n x nrhs (leading dimension ldb), overwritten in place.
+ * A is processed in TRSM_BLOCK x TRSM_BLOCK diagonal blocks: each block is solved directly and the remaining rows
+ * are updated with one gemm() call. Wide right-hand sides are split into column panels solved on separate threads.
+ */
+constexpr int TRSM_BLOCK = 64;
+
+template<class T>
+void trsmUnblocked(bool lower, bool unitDiag, long long n, long long nrhs, const T *A, long long lda,
+                   T *B, long long ldb) {
+    for (long long s = 0; s < n; s++) {
+        long long i = lower ? s : n - 1 - s;
+        T *bi = B + i * ldb;
+        long long tb = lower ? 0 : i + 1;
+        long long te = lower ? i : n;
+        for (long long t = tb; t < te; t++) {
+            T a = A[i * lda + t];
+            if (a == T(0)) continue;
+            const T *bt = B + t * ldb;
+            for (long long j = 0; j < nrhs; j++) bi[j] -= a * bt[j];
+        }
+        if (!unitDiag) {
+            T inv = T(1) / A[i * lda + i];
+            for (long long j = 0; j < nrhs; j++) bi[j] *= inv;
+        }
+    }
+}
+
+template<class T>
+void trsmBlocked(bool lower, bool unitDiag, long long n, long long nrhs, const T *A, long long lda,
+                 T *B, long long ldb) {
+    for (long long s = 0; s < n; s += TRSM_BLOCK) {
+        long long nb = std::min<long long>(TRSM_BLOCK, n - s);
+        long long k = lower ? s : n - s - nb; // first row of the diagonal block
+        trsmUnblocked(lower, unitDiag, nb, nrhs, A + k * lda + k, lda, B + k * ldb, ldb);
+        if (lower && k + nb < n) {
+            gemm<T>(n - k - nb, nrhs, nb, T(-1), A + (k + nb) * lda + k, lda, 1, B + k * ldb, ldb, 1,
+                    T(1), B + (k + nb) * ldb, ldb);
+        } else if (!lower && k > 0) {
+            gemm<T>(k, nrhs, nb, T(-1), A + k, lda, 1, B + k * ldb, ldb, 1, T(1), B, ldb);
+        }
+    }
+}
+
+template<class T>
+void trsm(bool lower, bool unitDiag, long long n, long long nrhs, const T *A, long long lda, T *B, long long ldb) {
+    const long long panel = 256;
+    if (nrhs >= 2 * panel && threadCount() > 1) {
+        long long panels = (nrhs + panel - 1) / panel;
+        parallelFor(0, panels, 1, [&](long long lo, long long hi) {
+            long long jb = lo * panel;
+            long long je = std::min(nrhs, hi * panel);
+            trsmBlocked(lower, unitDiag, n, je - jb, A, lda, B + jb, ldb);
+        });
+        return;
+    }
+    trsmBlocked(lower, unitDiag, n, nrhs, A, lda, B, ldb);
+}
+
+/*
+ * LU factorization with partial pivoting, P * A = L * U, for an m x n matrix.
+ * L (unit lower, below the diagonal) and U (upper) are packed into one row-major buffer. Columns are factored in
+ * panels of LU_BLOCK; after each panel the rows of U to its right are solved against the panel's L and the trailing
+ * submatrix is updated with one gemm() call, which is where almost all of the O(n^3) work happens (multithreaded).
+ * A column without a nonzero pivot is skipped like in row echelon form; once that happens the rest is finished
+ * unblocked. det(), inverse() and solve() therefore only give up on an exactly zero pivot, however small the others
+ * are. The tolerance only applies to rank(), which counts the pivots with |pivot| > tol.
+ * One factorization serves det(), inverse(), rank() and any number of solve() calls.
+ */
+constexpr int LU_BLOCK = 64;
+
+template<class T>
+class LU {
+    long long m = 0;
+    long long n = 0;
+    std::vector<T> a; // packed L \ U, row-major m x n
+    std::vector<int> perm; // row i of P * A is row perm[i] of A
+    std::vector<int> pivotCols; // column of the k-th nonzero pivot
+    int swaps = 0;
+    int numericRank = 0; // pivots with |pivot| > tol
+    double tol = 0;
+
+    bool pivotRow(long long r, long long c); // pick and swap in the pivot of column c, false if it is zero
+
+    long long factorPanel(long long k, long long jb); // factor columns k .. k + jb - 1, return how many had a pivot
+
+    void factorUnblocked(long long r, long long c); // echelon elimination from pivot row r and column c
+
+public:
+    explicit LU(const Mat<T> &A, double tol = -1); // rank() tolerance, tol < 0: max(m, n) * eps * max|a_ij|
+
+    int rank() const { return numericRank; }
+
+    bool isInvertible() const { return m == n && (long long) pivotCols.size() == n; } // no zero pivot
+
+    T det() const;
+
+    Mat<T> inverse() const;
+
+    Mat<T> solve(const Mat<T> &B) const; // X with A * X = B, A must be square and invertible
+
+    Mat<T> lower() const; // m x min(m, n) unit lower factor L
+
+    Mat<T> upper() const; // min(m, n) x n upper factor U in row echelon form, P * A = L * U
+
+    const std::vector<int> &permutation() const { return perm; }
+};
+
+template<class T>
+LU<T>::LU(const Mat<T> &A, double tol) {
+    Mat<T> src = A;
+    src.toDense();
+    m = src.row;
+    n = src.col;
+    a.resize(m * n);
+    double maxAbs = 0;
+    for (long long i = 0; i < m; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, a.begin() + i * n);
+        for (long long j = 0; j < n; j++) maxAbs = std::max<double>(maxAbs, std::abs(r[j]));
+    }
+    perm.resize(m);
+    for (long long i = 0; i < m; i++) perm[i] = (int) i;
+    double eps = std::numeric_limits<decltype(std::abs(T()))>::epsilon();
+    this->tol = tol >= 0 ? tol : (double) std::max(m, n) * eps * maxAbs;
+
+    long long mn = std::min(m, n);
+    for (long long k = 0; k < mn; k += LU_BLOCK) {
+        long long jb = std::min<long long>(LU_BLOCK, mn - k);
+        long long done = factorPanel(k, jb);
+        long long right = k + jb; // first column outside the panel
+        if (done > 0 && right < n) {
+            // U12 = L11^-1 * A12
+            for (long long i = k + 1; i < k + done; i++) {
+                T *ui = &a[i * n + right];
+                for (long long t = k; t < i; t++) {
+                    T l = a[i * n + t];
+                    const T *ut = &a[t * n + right];
+                    for (long long j = 0; j < n - right; j++) ui[j] -= l * ut[j];
+                }
+            }
+            // A22 -= L21 * U12
+            gemm<T>(m - k - done, n - right, done, T(-1),
+                    a.data() + (k + done) * n + k, n, 1,
+                    a.data() + k * n + right, n, 1,
+                    T(1), a.data() + (k + done) * n + right, n);
+        }
+        if (done < jb) {
+            factorUnblocked(k + done, k + done);
+            break;
+        }
+    }
+    for (long long r = 0; r < (long long) pivotCols.size(); r++) {
+        if (std::abs(a[r * n + pivotCols[r]]) > this->tol) numericRank++;
+    }
+}
+
+template<class T>
+bool LU<T>::pivotRow(long long r, long long c) {
+    long long p = r;
+    double best = std::abs(a[r * n + c]);
+    for (long long i = r + 1; i < m; i++) {
+        double v = std::abs(a[i * n + c]);
+        if (v > best) {
+            best = v;
+            p = i;
+        }
+    }
+    if (!(best > 0)) return false;
+    if (p != r) {
+        std::swap_ranges(a.begin() + r * n, a.begin() + (r + 1) * n, a.begin() + p * n);
+        std::swap(perm[r], perm[p]);
+        swaps++;
+    }
+    return true;
+}
+
+template<class T>
+long long LU<T>::factorPanel(long long k, long long jb) {
+    long long end = k + jb;
+    for (long long j = k; j < end; j++) {
+        if (!pivotRow(j, j)) return j - k;
+        pivotCols.push_back((int) j);
+        T inv = T(1) / a[j * n + j];
+        const T *uj = a.data() + j * n + j + 1;
+        for (long long i = j + 1; i < m; i++) {
+            T *ri = &a[i * n];
+            T l = ri[j] * inv;
+            ri[j] = l;
+            for (long long c = 0; c < end - j - 1; c++) ri[j + 1 + c] -= l * uj[c];
+        }
+    }
+    return jb;
+}
+
+template<class T>
+void LU<T>::factorUnblocked(long long r, long long c) {
+    for (; r < m && c < n; c++) {
+        if (!pivotRow(r, c)) continue;
+        pivotCols.push_back((int) c);
+        T inv = T(1) / a[r * n + c];
+        const T *ur = a.data() + r * n + c + 1;
+        for (long long i = r + 1; i < m; i++) {
+            T *ri = &a[i * n];
+            T l = ri[c] * inv;
+            ri[c] = l;
+            for (long long j = 0; j < n - c - 1; j++) ri[c + 1 + j] -= l * ur[j];
+        }
+        r++;
+    }
+}
+
+template<class T>
+T LU<T>::det() const {
+    if (m != n) throw (Determinant_NotSquareMatrix(""));
+    if ((long long) pivotCols.size() < n) return T(0);
+    T ans = (swaps % 2) ? T(-1) : T(1);
+    for (long long i = 0; i < n; i++) ans *= a[i * n + i];
+    return ans;
+}
+
+template<class T>
+Mat<T> LU<T>::solve(const Mat<T> &B) const {
+    if (m != n) throw InvalidDimensionsException("solve() requires a square matrix");
+    if (B.row != n) throw (Multiply_DimensionsNotMatched("Right-hand side has the wrong number of rows"));
+    if (!isInvertible()) throw (Inverse_NotInvertible("Matrix is singular"));
+    Mat<T> src = B;
+    src.toDense();
+    long long nrhs = B.col;
+    Mat<T> X((int) n, (int) nrhs);
+    for (long long i = 0; i < n; i++) {
+        const T *r = src.rowPtr(perm[i] + 1);
+        std::copy(r, r + nrhs, X.rowPtr((int) i + 1));
+    }
+    trsm(true, true, n, nrhs, a.data(), n, X.pData.get(), X.step);   // L * Y = P * B
+    trsm(false, false, n, nrhs, a.data(), n, X.pData.get(), X.step); // U * X = Y
+    return X;
+}
+
+// X with A * X = B for a square invertible A and any number of right-hand sides (columns of B).
+// To solve against the same A repeatedly, keep an LU<T> and call its solve().
+template<class T>
+Mat<T> solve(const Mat<T> &A, const Mat<T> &B) {
+    if (A.row != A.col) throw InvalidDimensionsException("solve() requires a square matrix");
+    return LU<T>(A).solve(B);
+}
+
+template<class T>
+Mat<T> LU<T>::inverse() const {
+    if (m != n) throw Inverse_NotSquareMatrix("error: calculate the inverse of a non-square matrix");
+    if (!isInvertible()) throw (Inverse_NotInvertible(""));
+    return solve(unitMatGen<T>((int) n));
+}
+
+template<class T>
+Mat<T> LU<T>::lower() const {
+    long long k = std::min(m, n);
+    Mat<T> L((int) m, (int) k);
+    for (long long i = 0; i < m; i++) {
+        for (long long t = 0; t < std::min<long long>(i, (long long) pivotCols.size()); t++) {
+            L((int) i + 1, (int) t + 1) = a[i * n + pivotCols[t]];
+        }
+        if (i < k) L((int) i + 1, (int) i + 1) = T(1);
+    }
+    return L;
+}
+
+template<class T>
+Mat<T> LU<T>::upper() const {
+    Mat<T> U((int) std::min(m, n), (int) n);
+    for (long long r = 0; r < (long long) pivotCols.size(); r++) {
+        std::copy(a.begin() + r * n + pivotCols[r], a.begin() + (r + 1) * n, U.rowPtr((int) r + 1) + pivotCols[r]);
+    }
+    return U;
+}
+
+/*
+ * Cholesky factorization A = L * L^T of a symmetric positive definite matrix (only the lower triangle is read).
+ * Right-looking and blocked like LU: each CHOLESKY_BLOCK wide column panel is factored, the rows below it are solved
+ * against the diagonal block in parallel, and the lower triangle of the trailing matrix is updated band by band with
+ * gemm(). Half the work of LU and no pivoting. A pivot that is not positive means A is not positive definite: the
+ * factorization stops there and isPositiveDefinite() turns false, which makes it a cheap SPD test.
+ */
+constexpr int CHOLESKY_BLOCK = 64;
+
+// lower triangle of the m x m matrix C -= W * L^T (W, L: m x k), one row band at a time
+template<class T>
+void symmetricUpdateLower(long long m, long long k, const T *W, long long ldw, const T *L, long long ldl,
+                          T *C, long long ldc) {
+    const long long band = 128;
+    parallelFor(0, (m + band - 1) / band, 1, [&](long long lo, long long hi) {
+        for (long long b = lo; b < hi; b++) {
+            long long r0 = b * band;
+            long long r1 = std::min(m, r0 + band);
+            gemm<T>(r1 - r0, r1, k, T(-1), W + r0 * ldw, ldw, 1, L, 1, ldl, T(1), C + r0 * ldc, ldc);
+        }
+    });
+}
+
+template<class T>
+class Cholesky {
+    long long n = 0;
+    std::vector<T> a; // L in the lower triangle and L^T in the upper one, row-major n x n
+    bool spd = true;
+
+    bool factorPanel(long long k, long long jb); // columns k .. k + jb - 1, false at a pivot <= 0
+
+public:
+    explicit Cholesky(const Mat<T> &A);
+
+    bool isPositiveDefinite() const { return spd; }
+
+    Mat<T> lower() const; // L
+
+    Mat<T> solve(const Mat<T> &B) const; // X with A * X = B
+
+    Mat<T> inverse() const;
+
+    T logDet() const; // log(det(A)), finite where det() would overflow
+};
+
+template<class T>
+Cholesky<T>::Cholesky(const Mat<T> &A) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Cholesky factorization requires a square matrix."));
+    Mat<T> src = A;
+    src.toDense();
+    n = src.row;
+    a.resize(n * n);
+    for (long long i = 0; i < n; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, a.begin() + i * n);
+    }
+    for (long long k = 0; k < n && spd; k += CHOLESKY_BLOCK) {
+        long long jb = std::min<long long>(CHOLESKY_BLOCK, n - k);
+        spd = factorPanel(k, jb);
+        long long s = k + jb;
+        if (spd && s < n) symmetricUpdateLower(n - s, jb, &a[s * n + k], n, &a[s * n + k], n, &a[s * n + s], n);
+    }
+    if (!spd) return;
+    for (long long i = 0; i < n; i++) {
+        for (long long j = 0; j < i; j++) a[j * n + i] = a[i * n + j];
+    }
+}
+
+template<class T>
+bool Cholesky<T>::factorPanel(long long k, long long jb) {
+    long long end = k + jb;
+    for (long long j = k; j < end; j++) {
+        T *rj = &a[j * n];
+        T d = rj[j];
+        for (long long t = k; t < j; t++) d -= rj[t] * rj[t];
+        if (!(d > T(0))) return false;
+        rj[j] = std::sqrt(d);
+        for (long long i = j + 1; i < end; i++) {
+            T *ri = &a[i * n];
+            T s = ri[j];
+            for (long long t = k; t < j; t++) s -= ri[t] * rj[t];
+            ri[j] = s / rj[j];
+        }
+    }
+    // L21 = A21 * L11^-T, row by row
+    parallelFor(end, n, 64, [&](long long lo, long long hi) {
+        for (long long i = lo; i < hi; i++) {
+            T *ri = &a[i * n];
+            for (long long j = k; j < end; j++) {
+                const T *rj = &a[j * n];
+                T s = ri[j];
+                for (long long t = k; t < j; t++) s -= ri[t] * rj[t];
+                ri[j] = s / rj[j];
+            }
+        }
+    });
+    return true;
+}
+
+template<class T>
+Mat<T> Cholesky<T>::lower() const {
+    if (!spd) throw (Cholesky_NotPositiveDefinite("Matrix is not positive definite"));
+    Mat<T> L((int) n, (int) n);
+    for (long long i = 0; i < n; i++) std::copy(&a[i * n], &a[i * n] + i + 1, L.rowPtr((int) i + 1));
+    return L;
+}
+
+template<class T>
+Mat<T> Cholesky<T>::solve(const Mat<T> &B) const {
+    if (!spd) throw (Cholesky_NotPositiveDefinite("Matrix is not positive definite"));
+    if (B.row != n) throw (Multiply_DimensionsNotMatched("Right-hand side has the wrong number of rows"));
+    Mat<T> X = B;
+    X.toDense();
+    if (X.pData == B.pData) X = X.clone();
+    trsm(true, false, n, X.col, a.data(), n, X.pData.get(), X.step);  // L * Y = B
+    trsm(false, false, n, X.col, a.data(), n, X.pData.get(), X.step); // L^T * X = Y
+    return X;
+}
+
+template<class T>
+Mat<T> Cholesky<T>::inverse() const {
+    return solve(unitMatGen<T>((int) n));
+}
+
+template<class T>
+T Cholesky<T>::logDet() const {
+    if (!spd) throw (Cholesky_NotPositiveDefinite("Matrix is not positive definite"));
+    T sum = T(0);
+    for (long long i = 0; i < n; i++) sum += std::log(a[i * n + i]);
+    return T(2) * sum;
+}
+
+/*
+ * A = L * D * L^T with L unit lower triangular and D diagonal, for symmetric A (only the lower triangle is read).
+ * Blocked like Cholesky but without square roots, so it also covers symmetric quasi-definite and other indefinite
+ * matrices that need no pivoting. There is no pivoting: a pivot |d| <= tol stops the factorization and
+ * isFactored() turns false. A is positive definite exactly when every d is positive.
+ */
+template<class T>
+class LDLT {
+    long long n = 0;
+    std::vector<T> a; // L below and L^T above the diagonal, D on it, row-major n x n
+    bool ok = true;
+    double tol = 0;
+
+    bool factorPanel(long long k, long long jb, std::vector<T> &W); // W receives L21 * D1
+
+public:
+    explicit LDLT(const Mat<T> &A, double tol = -1); // tol < 0: n * eps * max|a_ij|
+
+    bool isFactored() const { return ok; }
+
+    bool isPositiveDefinite() const;
+
+    Mat<T> lower() const; // unit lower L
+
+    std::vector<T> diagonal() const; // D
+
+    Mat<T> solve(const Mat<T> &B) const; // X with A * X = B
+
+    T logAbsDet() const; // log|det(A)|
+
+    int detSign() const; // sign of det(A): 1 or -1
+};
+
+template<class T>
+LDLT<T>::LDLT(const Mat<T> &A, double tol) {
+    if (A.row != A.col) throw (InvalidDimensionsException("LDL^T factorization requires a square matrix."));
+    Mat<T> src = A;
+    src.toDense();
+    n = src.row;
+    a.resize(n * n);
+    double maxAbs = 0;
+    for (long long i = 0; i < n; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, a.begin() + i * n);
+        for (long long j = 0; j <= i; j++) maxAbs = std::max<double>(maxAbs, std::abs(r[j]));
+    }
+    this->tol = tol >= 0 ? tol : (double) n * std::numeric_limits<T>::epsilon() * maxAbs;
+    std::vector<T> W;
+    for (long long k = 0; k < n && ok; k += CHOLESKY_BLOCK) {
+        long long jb = std::min<long long>(CHOLESKY_BLOCK, n - k);
+        ok = factorPanel(k, jb, W);
+        long long s = k + jb;
+        if (ok && s < n) symmetricUpdateLower(n - s, jb, W.data(), jb, &a[s * n + k], n, &a[s * n + s], n);
+    }
+    if (!ok) return;
+    for (long long i = 0; i < n; i++) {
+        for (long long j = 0; j < i; j++) a[j * n + i] = a[i * n + j];
+    }
+}
+
+template<class T>
+bool LDLT<T>::factorPanel(long long k, long long jb, std::vector<T> &W) {
+    long long end = k + jb;
+    std::vector<T> dl(jb * jb, T(0)); // dl[j * jb + t] = d_t * l_jt
+    for (long long j = k; j < end; j++) {
+        T *rj = &a[j * n];
+        T *wj = &dl[(j - k) * jb];
+        T d = rj[j];
+        for (long long t = k; t < j; t++) d -= rj[t] * wj[t - k];
+        if (!(std::abs(d) > tol)) return false;
+        rj[j] = d;
+        for (long long i = j + 1; i < end; i++) {
+            T *ri = &a[i * n];
+            T s = ri[j];
+            for (long long t = k; t < j; t++) s -= ri[t] * wj[t - k];
+            ri[j] = s / d;
+            dl[(i - k) * jb + (j - k)] = s;
+        }
+    }
+    // L21 = A21 * L11^-T * D1^-1 row by row, W = L21 * D1 for the trailing update (rows indexed from 0 at k + jb)
+    W.assign((n - end) * jb, T(0));
+    parallelFor(end, n, 64, [&](long long lo, long long hi) {
+        for (long long i = lo; i < hi; i++) {
+            T *ri = &a[i * n];
+            T *wi = &W[(i - end) * jb];
+            for (long long j = k; j < end; j++) {
+                const T *dj = &dl[(j - k) * jb];
+                T s = ri[j];
+                for (long long t = k; t < j; t++) s -= ri[t] * dj[t - k];
+                wi[j - k] = s;
+                ri[j] = s / a[j * n + j];
+            }
+        }
+    });
+    return true;
+}
+
+template<class T>
+bool LDLT<T>::isPositiveDefinite() const {
+    if (!ok) return false;
+    for (long long i = 0; i < n; i++) {
+        if (!(a[i * n + i] > T(0))) return false;
+    }
+    return true;
+}
+
+template<class T>
+Mat<T> LDLT<T>::lower() const {
+    if (!ok) throw (Inverse_NotInvertible("LDL^T factorization failed"));
+    Mat<T> L((int) n, (int) n);
+    for (long long i = 0; i < n; i++) {
+        std::copy(&a[i * n], &a[i * n] + i, L.rowPtr((int) i + 1));
+        L((int) i + 1, (int) i + 1) = T(1);
+    }
+    return L;
+}
+
+template<class T>
+std::vector<T> LDLT<T>::diagonal() const {
+    if (!ok) throw (Inverse_NotInvertible("LDL^T factorization failed"));
+    std::vector<T> d(n);
+    for (long long i = 0; i < n; i++) d[i] = a[i * n + i];
+    return d;
+}
+
+template<class T>
+Mat<T> LDLT<T>::solve(const Mat<T> &B) const {
+    if (!ok) throw (Inverse_NotInvertible("LDL^T factorization failed"));
+    if (B.row != n) throw (Multiply_DimensionsNotMatched("Right-hand side has the wrong number of rows"));
+    Mat<T> X = B;
+    X.toDense();
+    if (X.pData == B.pData) X = X.clone();
+    trsm(true, true, n, X.col, a.data(), n, X.pData.get(), X.step); // L * Y = B
+    for (long long i = 0; i < n; i++) {
+        T inv = T(1) / a[i * n + i];
+        T *r = X.rowPtr((int) i + 1);
+        for (long long j = 0; j < X.col; j++) r[j] *= inv;
+    }
+    trsm(false, true, n, X.col, a.data(), n, X.pData.get(), X.step); // L^T * X = D^-1 * Y
+    return X;
+}
+
+template<class T>
+T LDLT<T>::logAbsDet() const {
+    if (!ok) throw (Inverse_NotInvertible("LDL^T factorization failed"));
+    T sum = T(0);
+    for (long long i = 0; i < n; i++) sum += std::log(std::abs(a[i * n + i]));
+    return sum;
+}
+
+template<class T>
+int LDLT<T>::detSign() const {
+    if (!ok) throw (Inverse_NotInvertible("LDL^T factorization failed"));
+    int sign = 1;
+    for (long long i = 0; i < n; i++) {
+        if (a[i * n + i] < T(0)) sign = -sign;
+    }
+    return sign;
+}
+
+/*
+ * Blocks of Householder reflectors H_j = I - tau_j * v_j * v_j^T in compact WY form: H_1 * ... * H_jb = I - V * T * V^T
+ * with V the r x jb matrix of the vectors (unit diagonal, zero above it) and T a jb x jb upper triangular matrix.
+ */
+
+// copy the reflectors stored below the diagonal of a panel (a points at its first diagonal element) into V, r x jb
+template<class T>
+void householderV(const T *a, long long lda, long long r, long long jb, std::vector<T> &V) {
+    V.assign(r * jb, T(0));
+    for (long long i = 0; i < r; i++) {
+        T *vi = &V[i * jb];
+        std::copy(a + i * lda, a + i * lda + std::min(i, jb), vi);
+        if (i < jb) vi[i] = T(1);
+    }
+}
+
+// T(0:i, i) = -tau_i * T(0:i, 0:i) * V(:, 0:i)^T * v_i, with all the V^T * V products from one gemm()
+template<class T>
+void householderT(long long r, long long jb, const T *V, const T *tau, std::vector<T> &Tb) {
+    std::vector<T> G(jb * jb, T(0));
+    Tb.assign(jb * jb, T(0));
+    gemm<T>(jb, jb, r, T(1), V, 1, jb, V, jb, 1, T(0), G.data(), jb);
+    for (long long i = 0; i < jb; i++) {
+        Tb[i * jb + i] = tau[i];
+        for (long long p = 0; p < i; p++) {
+            T s = T(0);
+            for (long long q = p; q < i; q++) s += Tb[p * jb + q] * G[q * jb + i];
+            Tb[p * jb + i] = -tau[i] * s;
+        }
+    }
+}
+
+// B := (I - V * T * V^T) * B, or with T^T (the reflectors in reverse order) when trans, for an r x nc block B
+template<class T>
+void applyHouseholder(long long r, long long jb, const T *V, const T *Tb, bool trans, T *B, long long ldb, long long nc) {
+    std::vector<T> W(jb * nc, T(0)), W2(jb * nc, T(0));
+    gemm<T>(jb, nc, r, T(1), V, 1, jb, B, ldb, 1, T(0), W.data(), nc); // W = V^T * B
+    if (trans) {
+        gemm<T>(jb, nc, jb, T(1), Tb, 1, jb, W.data(), nc, 1, T(0), W2.data(), nc);
+    } else {
+        gemm<T>(jb, nc, jb, T(1), Tb, jb, 1, W.data(), nc, 1, T(0), W2.data(), nc);
+    }
+    gemm<T>(r, nc, jb, T(-1), V, jb, 1, W2.data(), nc, 1, T(1), B, ldb); // B -= V * W2
+}
+
+/*
+ * Householder QR factorization A = Q * R of an m x n matrix (any shape), for real element types.
+ * R is stored on and above the diagonal and the Householder vectors below it (their leading 1 is implicit).
+ * Columns are factored in panels of QR_BLOCK; the panel's reflectors H_1 ... H_b are combined into the compact WY
+ * form I - V * T * V^T (T upper triangular) and applied to the trailing columns with three gemm() calls.
+ * Q is kept implicit: applyQ()/applyQt() multiply by it without forming it, Q() builds it when needed.
+ * A column that is already zero below the diagonal gets no reflection (tau = 0).
+ */
+constexpr int QR_BLOCK = 32;
+
+template<class T>
+class HouseholderQR {
+    long long m = 0;
+    long long n = 0;
+    std::vector<T> a; // R \ V, row-major m x n
+    std::vector<T> tau; // scalar factor of each reflector, H_j = I - tau_j * v_j * v_j^T
+    std::vector<std::vector<T>> blockT; // T factor of each panel, jb x jb row-major
+
+    void factorPanel(long long k, long long jb); // unblocked factorization of columns k .. k + jb - 1
+
+    // B := (I - V * T * V^T) * B, or with T^T when trans, for the (m - k) x nc block B of panel k
+    void applyBlock(long long k, bool trans, T *B, long long ldb, long long nc) const;
+
+public:
+    explicit HouseholderQR(const Mat<T> &A);
+
+    long long rows() const { return m; }
+
+    long long cols() const { return n; }
+
+    Mat<T> R(bool thin = true) const; // min(m, n) x n, or m x n when !thin
+
+    Mat<T> Q(bool thin = true) const; // m x min(m, n), or m x m when !thin
+
+    Mat<T> applyQ(const Mat<T> &B) const; // Q * B for an m-row B
+
+    Mat<T> applyQt(const Mat<T> &B) const; // Q^T * B for an m-row B
+
+    Mat<T> solve(const Mat<T> &B) const; // least-squares X minimizing ||A * X - B||, A must have full column rank
+};
+
+template<class T>
+HouseholderQR<T>::HouseholderQR(const Mat<T> &A) {
+    Mat<T> src = A;
+    src.toDense();
+    m = src.row;
+    n = src.col;
+    a.resize(m * n);
+    for (long long i = 0; i < m; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, a.begin() + i * n);
+    }
+    long long mn = std::min(m, n);
+    tau.assign(mn, T(0));
+    for (long long k = 0; k < mn; k += QR_BLOCK) {
+        long long jb = std::min<long long>(QR_BLOCK, mn - k);
+        factorPanel(k, jb);
+        std::vector<T> V, Tb;
+        householderV(&a[k * n + k], n, m - k, jb, V);
+        householderT(m - k, jb, V.data(), &tau[k], Tb);
+        blockT.push_back(std::move(Tb));
+
+        if (k + jb < n) applyBlock(k, true, &a[k * n + k + jb], n, n - k - jb);
+    }
+}
+
+template<class T>
+void HouseholderQR<T>::factorPanel(long long k, long long jb) {
+    // One pass over the rows per column: while H_j is applied to a row, the sums that define H_{j+1}
+    // (|x|^2 of column j + 1 below the diagonal and its dot products with the columns to its right) are gathered.
+    long long end = k + jb;
+    std::vector<T> dot(jb, T(0)), w(jb);
+    T xnorm2 = T(0);
+    auto gather = [&](long long j, long long i) {
+        const T *ri = &a[i * n + j];
+        xnorm2 += ri[0] * ri[0];
+        for (long long c = 1; c < end - j; c++) dot[c - 1] += ri[0] * ri[c];
+    };
+    for (long long i = k + 1; i < m; i++) gather(k, i);
+    for (long long j = k; j < end; j++) {
+        long long nc = end - j - 1;
+        T alpha = a[j * n + j];
+        T s2 = xnorm2;
+        xnorm2 = T(0);
+        if (s2 == T(0)) { // nothing to eliminate, H_j = I
+            std::fill(dot.begin(), dot.end(), T(0));
+            if (nc > 0) for (long long i = j + 2; i < m; i++) gather(j + 1, i);
+            continue;
+        }
+        T norm = std::sqrt(alpha * alpha + s2);
+        T beta = alpha >= T(0) ? -norm : norm;
+        tau[j] = (beta - alpha) / beta;
+        T scale = T(1) / (alpha - beta); // v = x * scale below the diagonal
+        a[j * n + j] = beta;
+        for (long long c = 0; c < nc; c++) {
+            w[c] = tau[j] * (a[j * n + j + 1 + c] + scale * dot[c]);
+            a[j * n + j + 1 + c] -= w[c];
+        }
+        std::fill(dot.begin(), dot.end(), T(0));
+        for (long long i = j + 1; i < m; i++) {
+            T *ri = &a[i * n + j];
+            T v = ri[0] * scale;
+            ri[0] = v;
+            for (long long c = 0; c < nc; c++) ri[1 + c] -= v * w[c];
+            if (nc > 0 && i > j + 1) gather(j + 1, i);
+        }
+    }
+}
+
+
+template<class T>
+void HouseholderQR<T>::applyBlock(long long k, bool trans, T *B, long long ldb, long long nc) const {
+    long long jb = std::min<long long>(QR_BLOCK, std::min(m, n) - k);
+    std::vector<T> V;
+    householderV(&a[k * n + k], n, m - k, jb, V);
+    applyHouseholder(m - k, jb, V.data(), blockT[k / QR_BLOCK].data(), trans, B, ldb, nc);
+}
+
+template<class T>
+Mat<T> HouseholderQR<T>::applyQt(const Mat<T> &B) const {
+    if (B.row != m) throw (Multiply_DimensionsNotMatched("Q^T * B: B has the wrong number of rows"));
+    Mat<T> X = B;
+    X.toDense();
+    if (X.pData == B.pData) X = X.clone();
+    for (long long k = 0; k < std::min(m, n); k += QR_BLOCK) {
+        applyBlock(k, true, X.rowPtr((int) k + 1), X.step, X.col);
+    }
+    return X;
+}
+
+template<class T>
+Mat<T> HouseholderQR<T>::applyQ(const Mat<T> &B) const {
+    if (B.row != m) throw (Multiply_DimensionsNotMatched("Q * B: B has the wrong number of rows"));
+    Mat<T> X = B;
+    X.toDense();
+    if (X.pData == B.pData) X = X.clone();
+    long long mn = std::min(m, n);
+    for (long long k = (mn - 1) / QR_BLOCK * QR_BLOCK; mn > 0 && k >= 0; k -= QR_BLOCK) {
+        applyBlock(k, false, X.rowPtr((int) k + 1), X.step, X.col);
+    }
+    return X;
+}
+
+template<class T>
+Mat<T> HouseholderQR<T>::Q(bool thin) const {
+    long long c = thin ? std::min(m, n) : m;
+    Mat<T> E((int) m, (int) c);
+    for (long long i = 0; i < c; i++) E((int) i + 1, (int) i + 1) = T(1);
+    return applyQ(E);
+}
+
+template<class T>
+Mat<T> HouseholderQR<T>::R(bool thin) const {
+    long long r = thin ? std::min(m, n) : m;
+    Mat<T> ans((int) r, (int) n);
+    for (long long i = 0; i < std::min(r, n); i++) {
+        std::copy(a.begin() + i * n + i, a.begin() + (i + 1) * n, ans.rowPtr((int) i + 1) + i);
+    }
+    return ans;
+}
+
+template<class T>
+Mat<T> HouseholderQR<T>::solve(const Mat<T> &B) const {
+    if (m < n) throw InvalidDimensionsException("least squares needs at least as many rows as columns");
+    double maxDiag = 0;
+    for (long long i = 0; i < n; i++) maxDiag = std::max<double>(maxDiag, std::abs(a[i * n + i]));
+    double tol = (double) m * std::numeric_limits<T>::epsilon() * maxDiag;
+    for (long long i = 0; i < n; i++) {
+        if (!(std::abs(a[i * n + i]) > tol)) throw (Inverse_NotInvertible("Matrix does not have full column rank"));
+    }
+    Mat<T> C = applyQt(B);
+    Mat<T> X((int) n, (int) C.col);
+    for (long long i = 0; i < n; i++) {
+        const T *r = C.rowPtr((int) i + 1);
+        std::copy(r, r + C.col, X.rowPtr((int) i + 1));
+    }
+    trsm(false, false, n, (long long) X.col, a.data(), n, X.pData.get(), X.step); // R * X = (Q^T * B)(0:n)
+    return X;
+}
+
+/*
+ * Eigen decomposition A = Z * diag(d) * Z^T of a real symmetric matrix (only the lower triangle is read).
+ * A is first reduced to tridiagonal form by Householder reflectors in panels of TRIDIAG_BLOCK columns: inside a
+ * panel the updates are deferred (A - V * W^T - W * V^T) and the trailing lower triangle is updated afterwards
+ * with gemm(). The tridiagonal matrix is then diagonalized by implicit-shift QL. Eigenvectors are kept as the rows
+ * of Z^T so every Givens rotation combines two contiguous rows. The rotations are recorded and applied QL_SWEEPS
+ * sweeps at a time in one wavefront pass over the rows (sweep t trails sweep t - 1 by two rows, which keeps every
+ * dependency), so the rows are streamed through the cache once per batch instead of once per sweep. The columns are
+ * split into chunks processed on separate threads.
+ * Eigenvalues are sorted in ascending order.
+ */
+constexpr int TRIDIAG_BLOCK = 32;
+constexpr int QL_SWEEPS = 32;
+
+template<class T>
+class SymmetricEigen {
+    long long n = 0;
+    std::vector<T> d; // eigenvalues
+    std::vector<T> zt; // eigenvectors as rows, n x n
+    bool hasVectors = false;
+
+    // d and e (e[i] couples i and i + 1), the reflectors are left below the subdiagonal of a
+    void tridiagonalize(std::vector<T> &a, std::vector<T> &e, std::vector<T> &tau);
+
+    void formQt(const std::vector<T> &a, const std::vector<T> &tau); // zt = Q^T of the tridiagonal reduction
+
+    // recorded QL sweeps: sweep t rotates rows (i, i + 1) for i = sweepM[t] - 1 down to sweepL[t]
+    std::vector<long long> sweepL, sweepM, sweepOff;
+    std::vector<T> sweepC, sweepS;
+
+    void ql(std::vector<T> &e); // implicit QL on (d, e), rotations applied to zt
+
+    void applySweeps(); // apply and clear the recorded sweeps
+
+public:
+    explicit SymmetricEigen(const Mat<T> &A, bool vectors = true);
+
+    const std::vector<T> &values() const { return d; }
+
+    Mat<T> vectors() const; // n x n, column i belongs to values()[i]
+};
+
+template<class T>
+SymmetricEigen<T>::SymmetricEigen(const Mat<T> &A, bool vectors) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Only square matrices have eigenvalues and eigenvectors."));
+    Mat<T> src = A;
+    src.toDense();
+    n = src.row;
+    hasVectors = vectors;
+    std::vector<T> a(n * n), e, tau;
+    for (long long i = 0; i < n; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, a.begin() + i * n);
+    }
+    tridiagonalize(a, e, tau);
+    if (vectors) formQt(a, tau);
+    ql(e);
+
+    std::vector<long long> order(n);
+    for (long long i = 0; i < n; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](long long x, long long y) { return d[x] < d[y]; });
+    std::vector<T> sorted(n);
+    for (long long i = 0; i < n; i++) sorted[i] = d[order[i]];
+    d.swap(sorted);
+    if (vectors) {
+        std::vector<T> rows(n * n);
+        for (long long i = 0; i < n; i++) std::copy(&zt[order[i] * n], &zt[order[i] * n] + n, &rows[i * n]);
+        zt.swap(rows);
+    }
+}
+
+template<class T>
+void SymmetricEigen<T>::tridiagonalize(std::vector<T> &a, std::vector<T> &e, std::vector<T> &tau) {
+    d.assign(n, T(0));
+    e.assign(n, T(0));
+    long long nref = n - 1; // column c gets the reflector that zeroes a(c + 2 :, c)
+    tau.assign(std::max<long long>(nref, 0), T(0));
+    std::vector<T> v(n), y(n);
+    for (long long k = 0; k < nref; k += TRIDIAG_BLOCK) {
+        long long jb = std::min<long long>(TRIDIAG_BLOCK, nref - k);
+        std::vector<T> V(n * jb, T(0)), W(n * jb, T(0)); // indexed by global row
+        for (long long i = 0; i < jb; i++) {
+            long long c = k + i;
+            // bring column c up to date with the reflectors already taken in this panel
+            for (long long r = c; r < n; r++) {
+                T s = T(0);
+                for (long long t = 0; t < i; t++) s += V[r * jb + t] * W[c * jb + t] + W[r * jb + t] * V[c * jb + t];
+                a[r * n + c] -= s;
+            }
+            d[c] = a[c * n + c];
+
+            T alpha = a[(c + 1) * n + c];
+            T xnorm2 = T(0);
+            for (long long r = c + 2; r < n; r++) xnorm2 += a[r * n + c] * a[r * n + c];
+            std::fill(v.begin(), v.end(), T(0));
+            v[c + 1] = T(1);
+            if (xnorm2 == T(0)) {
+                e[c] = alpha; // already tridiagonal in this column, H_c = I and w = 0
+                V[(c + 1) * jb + i] = T(1);
+                continue;
+            }
+            T norm = std::sqrt(alpha * alpha + xnorm2);
+            T beta = alpha >= T(0) ? -norm : norm;
+            tau[c] = (beta - alpha) / beta;
+            T scale = T(1) / (alpha - beta);
+            for (long long r = c + 2; r < n; r++) {
+                a[r * n + c] *= scale;
+                v[r] = a[r * n + c];
+            }
+            a[(c + 1) * n + c] = beta;
+            e[c] = beta;
+            for (long long r = c + 1; r < n; r++) V[r * jb + i] = v[r];
+
+            // y = A22 * v from the lower triangle, then remove what the deferred updates would have changed
+            std::fill(y.begin(), y.end(), T(0));
+            for (long long r = c + 1; r < n; r++) {
+                const T *ar = &a[r * n];
+                T acc = T(0);
+                T vr = v[r];
+                for (long long j = c + 1; j < r; j++) {
+                    acc += ar[j] * v[j];
+                    y[j] += ar[j] * vr;
+                }
+                y[r] += acc + ar[r] * vr;
+            }
+            std::vector<T> wv(i, T(0)), vv(i, T(0));
+            for (long long r = c + 1; r < n; r++) {
+                for (long long t = 0; t < i; t++) {
+                    wv[t] += W[r * jb + t] * v[r];
+                    vv[t] += V[r * jb + t] * v[r];
+                }
+            }
+            T vw = T(0);
+            for (long long r = c + 1; r < n; r++) {
+                T s = T(0);
+                for (long long t = 0; t < i; t++) s += V[r * jb + t] * wv[t] + W[r * jb + t] * vv[t];
+                y[r] = tau[c] * (y[r] - s);
+                vw += y[r] * v[r];
+            }
+            T half = T(-0.5) * tau[c] * vw;
+            for (long long r = c + 1; r < n; r++) W[r * jb + i] = y[r] + half * v[r];
+        }
+
+        // lower triangle of the trailing block: A -= [V W] * [W V]^T, one row band at a time
+        long long s = k + jb;
+        std::vector<T> VW(n * 2 * jb), WV(n * 2 * jb);
+        for (long long r = s; r < n; r++) {
+            std::copy(&V[r * jb], &V[r * jb] + jb, &VW[r * 2 * jb]);
+            std::copy(&W[r * jb], &W[r * jb] + jb, &VW[r * 2 * jb + jb]);
+            std::copy(&W[r * jb], &W[r * jb] + jb, &WV[r * 2 * jb]);
+            std::copy(&V[r * jb], &V[r * jb] + jb, &WV[r * 2 * jb + jb]);
+        }
+        const long long band = 128;
+        parallelFor(0, (n - s + band - 1) / band, 1, [&](long long lo, long long hi) {
+            for (long long b = lo; b < hi; b++) {
+                long long r0 = s + b * band;
+                long long r1 = std::min(n, r0 + band);
+                gemm<T>(r1 - r0, r1 - s, 2 * jb, T(-1), &VW[r0 * 2 * jb], 2 * jb, 1, &WV[s * 2 * jb], 1, 2 * jb,
+                        T(1), &a[r0 * n + s], n);
+            }
+        });
+    }
+    if (n > 0) d[n - 1] = a[(n - 1) * n + n - 1];
+}
+
+template<class T>
+void SymmetricEigen<T>::formQt(const std::vector<T> &a, const std::vector<T> &tau) {
+    // Q = H_0 * ... * H_(n-2) built from the right end, then transposed; H_c acts on rows c + 1 ..
+    std::vector<T> q(n * n, T(0));
+    for (long long i = 0; i < n; i++) q[i * n + i] = T(1);
+    long long nref = n - 1;
+    for (long long k = (nref - 1) / TRIDIAG_BLOCK * TRIDIAG_BLOCK; nref > 0 && k >= 0; k -= TRIDIAG_BLOCK) {
+        long long jb = std::min<long long>(TRIDIAG_BLOCK, nref - k);
+        long long r = n - k - 1;
+        std::vector<T> V, Tb;
+        householderV(&a[(k + 1) * n + k], n, r, jb, V);
+        householderT(r, jb, V.data(), &tau[k], Tb);
+        applyHouseholder(r, jb, V.data(), Tb.data(), false, &q[(k + 1) * n + k + 1], n, r);
+    }
+    zt.resize(n * n);
+    for (long long i = 0; i < n; i++) {
+        for (long long j = 0; j < n; j++) zt[j * n + i] = q[i * n + j];
+    }
+}
+
+template<class T>
+void SymmetricEigen<T>::ql(std::vector<T> &e) {
+    const T eps = std::numeric_limits<T>::epsilon();
+    T f = T(0);
+    T tst1 = T(0);
+    for (long long l = 0; l < n; l++) {
+        tst1 = std::max(tst1, std::abs(d[l]) + std::abs(e[l]));
+        long long m = l;
+        while (m < n - 1 && std::abs(e[m]) > eps * tst1) m++;
+        if (m > l) {
+            int iter = 0;
+            do {
+                if (++iter > 60) throw (Eigen_NotConverged("QL iteration did not converge"));
+                // Wilkinson-like shift from the leading 2 x 2 block
+                T g = d[l];
+                T p = (d[l + 1] - g) / (T(2) * e[l]);
+                T r = std::hypot(p, T(1));
+                if (p < 0) r = -r;
+                d[l] = e[l] / (p + r);
+                d[l + 1] = e[l] * (p + r);
+                T dl1 = d[l + 1];
+                T h = g - d[l];
+                for (long long i = l + 2; i < n; i++) d[i] -= h;
+                f += h;
+
+                // chase the bulge from m - 1 up to l
+                p = d[m];
+                T c = T(1), c2 = c, c3 = c;
+                T el1 = e[l + 1];
+                T s = T(0), s2 = T(0);
+                long long off = (long long) sweepC.size();
+                sweepC.resize(off + m - l);
+                sweepS.resize(off + m - l);
+                for (long long i = m - 1; i >= l; i--) {
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = std::hypot(p, e[i]);
+                    e[i + 1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i + 1] = h + s * (c * g + s * d[i]);
+                    sweepC[off + i - l] = c;
+                    sweepS[off + i - l] = s;
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+                sweepL.push_back(l);
+                sweepM.push_back(m);
+                sweepOff.push_back(off);
+                if (!hasVectors) {
+                    sweepL.clear(), sweepM.clear(), sweepOff.clear(), sweepC.clear(), sweepS.clear();
+                } else if ((long long) sweepL.size() == QL_SWEEPS) {
+                    applySweeps();
+                }
+            } while (std::abs(e[l]) > eps * tst1);
+        }
+        d[l] += f;
+        e[l] = T(0);
+    }
+    if (hasVectors) applySweeps();
+}
+
+template<class T>
+void SymmetricEigen<T>::applySweeps() {
+    long long K = (long long) sweepL.size();
+    if (K == 0) return;
+    long long top = 0, bottom = n;
+    for (long long t = 0; t < K; t++) {
+        top = std::max(top, sweepM[t] - 1 - 2 * t);
+        bottom = std::min(bottom, sweepL[t] - 2 * t);
+    }
+    long long rotations = (long long) sweepC.size();
+    long long grain = std::max<long long>(64, 65536 / std::max<long long>(rotations, 1));
+    parallelFor(0, n, grain, [&](long long lo, long long hi) {
+        for (long long k0 = lo; k0 < hi; k0 += 256) { // rows of the wavefront stay in cache
+            long long k1 = std::min(hi, k0 + 256);
+            for (long long p = top; p >= bottom; p--) {
+                for (long long t = 0; t < K; t++) {
+                    long long i = p + 2 * t; // sweep t is two rows behind sweep t - 1
+                    if (i < sweepL[t] || i >= sweepM[t]) continue;
+                    long long r = sweepOff[t] + i - sweepL[t];
+                    planeRotation(&zt[i * n + k0], &zt[(i + 1) * n + k0], sweepC[r], sweepS[r], k1 - k0);
+                }
+            }
+        }
+    });
+    sweepL.clear();
+    sweepM.clear();
+    sweepOff.clear();
+    sweepC.clear();
+    sweepS.clear();
+}
+
+template<class T>
+Mat<T> SymmetricEigen<T>::vectors() const {
+    if (!hasVectors) throw (InvalidDimensionsException("Eigenvectors were not computed"));
+    Mat<T> Z((int) n, (int) n);
+    for (long long i = 0; i < n; i++) {
+        for (long long j = 0; j < n; j++) Z((int) j + 1, (int) i + 1) = zt[i * n + j];
+    }
+    return Z;
+}
+
+/*
+ * Eigenvalues and eigenvectors of a general real square matrix.
+ * A is reduced to upper Hessenberg form H = Q^T * A * Q by Householder reflectors, then to real Schur form by the
+ * Francis double-shift QR iteration with deflation (a subdiagonal entry below eps times its neighbours splits the
+ * problem) and exceptional shifts when it stalls. Eigenvectors come from back-substitution on the Schur form,
+ * transformed back with one gemm(). A complex pair lambda = a +- ib is stored as two real columns (re, im).
+ */
+template<class T>
+class GeneralEigen {
+    long long n = 0;
+    std::vector<T> wr, wi; // real and imaginary parts of the eigenvalues
+    std::vector<T> v; // eigenvectors, n x n row-major, columns j and j + 1 hold re and im of a complex pair
+    bool hasVectors = false;
+
+    void hessenberg(std::vector<T> &h, std::vector<T> &vt); // vt = Q^T, the rows of vt are the columns of Q
+
+    void schur(std::vector<T> &h, std::vector<T> &vt, T norm); // Francis QR, accumulated into vt
+
+    void backSubstitute(std::vector<T> &h, const std::vector<T> &vt, T norm);
+
+public:
+    explicit GeneralEigen(const Mat<T> &A, bool vectors = true);
+
+    std::vector<std::complex<T>> values() const;
+
+    bool isReal() const; // no eigenvalue has a nonzero imaginary part
+
+    Mat<std::complex<T>> vectors() const; // column j belongs to values()[j], unit 2-norm
+
+    Mat<T> realVectors() const; // same as vectors() for a real spectrum, throws Eigen_ComplexSpectrum otherwise
+};
+
+template<class T>
+GeneralEigen<T>::GeneralEigen(const Mat<T> &A, bool vectors) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Only square matrices have eigenvalues and eigenvectors."));
+    Mat<T> src = A;
+    src.toDense();
+    n = src.row;
+    hasVectors = vectors;
+    std::vector<T> h(n * n), vt;
+    for (long long i = 0; i < n; i++) {
+        const T *r = src.rowPtr((int) i + 1);
+        std::copy(r, r + n, h.begin() + i * n);
+    }
+    hessenberg(h, vt);
+    T norm = T(0);
+    for (long long i = 0; i < n; i++) {
+        for (long long j = std::max<long long>(i - 1, 0); j < n; j++) norm += std::abs(h[i * n + j]);
+    }
+    schur(h, vt, norm);
+    if (vectors) backSubstitute(h, vt, norm);
+}
+
+template<class T>
+void GeneralEigen<T>::hessenberg(std::vector<T> &h, std::vector<T> &vt) {
+    std::vector<T> ort(n, T(0)), f(n);
+    for (long long m = 1; m < n - 1; m++) {
+        T scale = T(0);
+        for (long long i = m; i < n; i++) scale += std::abs(h[i * n + m - 1]);
+        if (scale == T(0)) continue;
+        T hh = T(0);
+        for (long long i = n - 1; i >= m; i--) {
+            ort[i] = h[i * n + m - 1] / scale;
+            hh += ort[i] * ort[i];
+        }
+        T g = std::sqrt(hh);
+        if (ort[m] > 0) g = -g;
+        hh -= ort[m] * g;
+        ort[m] -= g;
+
+        // H = (I - u * u^T / hh) * H * (I - u * u^T / hh), the left product as row sweeps
+        std::fill(f.begin() + m, f.end(), T(0));
+        for (long long i = m; i < n; i++) {
+            const T *hi = &h[i * n];
+            for (long long j = m; j < n; j++) f[j] += ort[i] * hi[j];
+        }
+        for (long long i = m; i < n; i++) {
+            T *hi = &h[i * n];
+            T o = ort[i] / hh;
+            for (long long j = m; j < n; j++) hi[j] -= f[j] * o;
+        }
+        for (long long i = 0; i < n; i++) {
+            T *hi = &h[i * n];
+            T s = T(0);
+            for (long long j = m; j < n; j++) s += ort[j] * hi[j];
+            s /= hh;
+            for (long long j = m; j < n; j++) hi[j] -= s * ort[j];
+        }
+        ort[m] *= scale;
+        h[m * n + m - 1] = scale * g;
+    }
+
+    if (hasVectors) {
+        vt.assign(n * n, T(0));
+        for (long long i = 0; i < n; i++) vt[i * n + i] = T(1);
+        for (long long m = n - 2; m >= 1; m--) {
+            if (h[m * n + m - 1] == T(0)) continue;
+            for (long long i = m + 1; i < n; i++) ort[i] = h[i * n + m - 1];
+            for (long long j = m; j < n; j++) {
+                T *col = &vt[j * n]; // column j of Q
+                T g = T(0);
+                for (long long i = m; i < n; i++) g += ort[i] * col[i];
+                g = (g / ort[m]) / h[m * n + m - 1]; // double division avoids possible underflow
+                for (long long i = m; i < n; i++) col[i] += g * ort[i];
+            }
+        }
+    }
+    for (long long i = 2; i < n; i++) std::fill(&h[i * n], &h[i * n + i - 1], T(0));
+}
+
+template<class T>
+void GeneralEigen<T>::schur(std::vector<T> &h, std::vector<T> &vt, T norm) {
+    auto H = [&](long long i, long long j) -> T & { return h[i * n + j]; };
+    auto V = [&](long long i, long long j) -> T & { return vt[j * n + i]; };
+    const T eps = std::numeric_limits<T>::epsilon();
+    wr.assign(n, T(0));
+    wi.assign(n, T(0));
+    long long nn = n;
+    long long hi = n - 1; // last row of the active block
+    T exshift = T(0);
+    T p = 0, q = 0, r = 0, s = 0, z = 0, w, x, y;
+    int iter = 0;
+    while (hi >= 0) {
+        // look for a single small subdiagonal element
+        long long l = hi;
+        while (l > 0) {
+            s = std::abs(H(l - 1, l - 1)) + std::abs(H(l, l));
+            if (s == T(0)) s = norm;
+            if (std::abs(H(l, l - 1)) <= eps * s) break;
+            l--;
+        }
+        // rows and columns that still have to be transformed: all of them when the Schur form is wanted
+        long long jEnd = hasVectors ? nn : hi + 1;
+
+        if (l == hi) { // one root found
+            H(hi, hi) += exshift;
+            wr[hi] = H(hi, hi);
+            wi[hi] = T(0);
+            hi--;
+            iter = 0;
+        } else if (l == hi - 1) { // two roots found
+            w = H(hi, hi - 1) * H(hi - 1, hi);
+            p = (H(hi - 1, hi - 1) - H(hi, hi)) / T(2);
+            q = p * p + w;
+            z = std::sqrt(std::abs(q));
+            H(hi, hi) += exshift;
+            H(hi - 1, hi - 1) += exshift;
+            x = H(hi, hi);
+            if (q >= 0) { // real pair, split the 2 x 2 block with a rotation
+                z = p >= 0 ? p + z : p - z;
+                wr[hi - 1] = x + z;
+                wr[hi] = z != T(0) ? x - w / z : wr[hi - 1];
+                wi[hi - 1] = T(0);
+                wi[hi] = T(0);
+                x = H(hi, hi - 1);
+                s = std::abs(x) + std::abs(z);
+                p = x / s;
+                q = z / s;
+                r = std::sqrt(p * p + q * q);
+                p /= r;
+                q /= r;
+                for (long long j = hi - 1; j < jEnd; j++) {
+                    z = H(hi - 1, j);
+                    H(hi - 1, j) = q * z + p * H(hi, j);
+                    H(hi, j) = q * H(hi, j) - p * z;
+                }
+                for (long long i = hasVectors ? 0 : l; i <= hi; i++) {
+                    z = H(i, hi - 1);
+                    H(i, hi - 1) = q * z + p * H(i, hi);
+                    H(i, hi) = q * H(i, hi) - p * z;
+                }
+                if (hasVectors) planeRotation(&V(0, hi), &V(0, hi - 1), q, p, n);
+            } else { // complex pair
+                wr[hi - 1] = x + p;
+                wr[hi] = x + p;
+                wi[hi - 1] = z;
+                wi[hi] = -z;
+            }
+            hi -= 2;
+            iter = 0;
+        } else { // no convergence yet
+            if (++iter > 100) throw (Eigen_NotConverged("Francis QR iteration did not converge"));
+            x = H(hi, hi);
+            y = T(0);
+            w = T(0);
+            if (l < hi) {
+                y = H(hi - 1, hi - 1);
+                w = H(hi, hi - 1) * H(hi - 1, hi);
+            }
+            if (iter == 10) { // Wilkinson's exceptional shift
+                exshift += x;
+                for (long long i = 0; i <= hi; i++) H(i, i) -= x;
+                s = std::abs(H(hi, hi - 1)) + std::abs(H(hi - 1, hi - 2));
+                x = y = T(0.75) * s;
+                w = T(-0.4375) * s * s;
+            }
+            if (iter == 30) { // a second exceptional shift
+                s = (y - x) / T(2);
+                s = s * s + w;
+                if (s > 0) {
+                    s = std::sqrt(s);
+                    if (y < x) s = -s;
+                    s = x - w / ((y - x) / T(2) + s);
+                    for (long long i = 0; i <= hi; i++) H(i, i) -= s;
+                    exshift += s;
+                    x = y = w = T(0.964);
+                }
+            }
+
+            // look for two consecutive small subdiagonal elements
+            long long m = hi - 2;
+            while (m >= l) {
+                z = H(m, m);
+                r = x - z;
+                s = y - z;
+                p = (r * s - w) / H(m + 1, m) + H(m, m + 1);
+                q = H(m + 1, m + 1) - z - r - s;
+                r = H(m + 2, m + 1);
+                s = std::abs(p) + std::abs(q) + std::abs(r);
+                p /= s;
+                q /= s;
+                r /= s;
+                if (m == l) break;
+                if (std::abs(H(m, m - 1)) * (std::abs(q) + std::abs(r)) <
+                    eps * (std::abs(p) * (std::abs(H(m - 1, m - 1)) + std::abs(z) + std::abs(H(m + 1, m + 1))))) {
+                    break;
+                }
+                m--;
+            }
+            for (long long i = m + 2; i <= hi; i++) {
+                H(i, i - 2) = T(0);
+                if (i > m + 2) H(i, i - 3) = T(0);
+            }
+
+            // double QR step on rows l .. hi and columns m .. hi, chasing the bulge with 3 x 3 reflectors
+            for (long long k = m; k <= hi - 1; k++) {
+                bool notlast = k != hi - 1;
+                if (k != m) {
+                    p = H(k, k - 1);
+                    q = H(k + 1, k - 1);
+                    r = notlast ? H(k + 2, k - 1) : T(0);
+                    x = std::abs(p) + std::abs(q) + std::abs(r);
+                    if (x == T(0)) continue;
+                    p /= x;
+                    q /= x;
+                    r /= x;
+                }
+                s = std::sqrt(p * p + q * q + r * r);
+                if (p < 0) s = -s;
+                if (s == T(0)) continue;
+                if (k != m) {
+                    H(k, k - 1) = -s * x;
+                } else if (l != m) {
+                    H(k, k - 1) = -H(k, k - 1);
+                }
+                p += s;
+                x = p / s;
+                y = q / s;
+                z = r / s;
+                q /= p;
+                r /= p;
+                for (long long j = k; j < jEnd; j++) {
+                    p = H(k, j) + q * H(k + 1, j);
+                    if (notlast) {
+                        p += r * H(k + 2, j);
+                        H(k + 2, j) -= p * z;
+                    }
+                    H(k, j) -= p * x;
+                    H(k + 1, j) -= p * y;
+                }
+                for (long long i = hasVectors ? 0 : l; i <= std::min(hi, k + 3); i++) {
+                    p = x * H(i, k) + y * H(i, k + 1);
+                    if (notlast) {
+                        p += z * H(i, k + 2);
+                        H(i, k + 2) -= p * r;
+                    }
+                    H(i, k) -= p;
+                    H(i, k + 1) -= p * q;
+                }
+                if (hasVectors) {
+                    T *v0 = &V(0, k), *v1 = &V(0, k + 1), *v2 = notlast ? &V(0, k + 2) : nullptr;
+                    for (long long i = 0; i < n; i++) {
+                        p = x * v0[i] + y * v1[i];
+                        if (notlast) {
+                            p += z * v2[i];
+                            v2[i] -= p * r;
+                        }
+                        v0[i] -= p;
+                        v1[i] -= p * q;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<class T>
+void GeneralEigen<T>::backSubstitute(std::vector<T> &h, const std::vector<T> &vt, T norm) {
+    auto H = [&](long long i, long long j) -> T & { return h[i * n + j]; };
+    const T eps = std::numeric_limits<T>::epsilon();
+    v.assign(n * n, T(0));
+    if (norm == T(0)) { // zero matrix: every vector is an eigenvector
+        for (long long i = 0; i < n; i++) v[i * n + i] = T(1);
+        return;
+    }
+    T p, q, r = 0, s = 0, t, w, x, y, z = 0;
+    for (long long k = n - 1; k >= 0; k--) {
+        p = wr[k];
+        q = wi[k];
+        if (q == T(0)) { // real vector
+            long long l = k;
+            H(k, k) = T(1);
+            for (long long i = k - 1; i >= 0; i--) {
+                w = H(i, i) - p;
+                r = T(0);
+                for (long long j = l; j <= k; j++) r += H(i, j) * H(j, k);
+                if (wi[i] < T(0)) {
+                    z = w;
+                    s = r;
+                    continue;
+                }
+                l = i;
+                if (wi[i] == T(0)) {
+                    H(i, k) = w != T(0) ? -r / w : -r / (eps * norm);
+                } else { // solve the real 2 x 2 system of a complex pair block
+                    x = H(i, i + 1);
+                    y = H(i + 1, i);
+                    q = (wr[i] - p) * (wr[i] - p) + wi[i] * wi[i];
+                    t = (x * s - z * r) / q;
+                    H(i, k) = t;
+                    H(i + 1, k) = std::abs(x) > std::abs(z) ? (-r - w * t) / x : (-s - y * t) / z;
+                }
+                t = std::abs(H(i, k)); // overflow control
+                if ((eps * t) * t > 1) {
+                    for (long long j = i; j <= k; j++) H(j, k) /= t;
+                }
+            }
+        } else if (q < T(0)) { // complex vector, columns k - 1 (re) and k (im)
+            long long l = k - 1;
+            if (std::abs(H(k, k - 1)) > std::abs(H(k - 1, k))) {
+                H(k - 1, k - 1) = q / H(k, k - 1);
+                H(k - 1, k) = -(H(k, k) - p) / H(k, k - 1);
+            } else {
+                std::complex<T> c = std::complex<T>(T(0), -H(k - 1, k)) / std::complex<T>(H(k - 1, k - 1) - p, q);
+                H(k - 1, k - 1) = c.real();
+                H(k - 1, k) = c.imag();
+            }
+            H(k, k - 1) = T(0);
+            H(k, k) = T(1);
+            for (long long i = k - 2; i >= 0; i--) {
+                T ra = T(0), sa = T(0), vr, vi;
+                for (long long j = l; j <= k; j++) {
+                    ra += H(i, j) * H(j, k - 1);
+                    sa += H(i, j) * H(j, k);
+                }
+                w = H(i, i) - p;
+                if (wi[i] < T(0)) {
+                    z = w;
+                    r = ra;
+                    s = sa;
+                    continue;
+                }
+                l = i;
+                if (wi[i] == T(0)) {
+                    std::complex<T> c = std::complex<T>(-ra, -sa) / std::complex<T>(w, q);
+                    H(i, k - 1) = c.real();
+                    H(i, k) = c.imag();
+                } else { // solve the complex 2 x 2 system
+                    x = H(i, i + 1);
+                    y = H(i + 1, i);
+                    vr = (wr[i] - p) * (wr[i] - p) + wi[i] * wi[i] - q * q;
+                    vi = (wr[i] - p) * T(2) * q;
+                    if (vr == T(0) && vi == T(0)) {
+                        vr = eps * norm * (std::abs(w) + std::abs(q) + std::abs(x) + std::abs(y) + std::abs(z));
+                    }
+                    std::complex<T> c = std::complex<T>(x * r - z * ra + q * sa, x * s - z * sa - q * ra) /
+                                        std::complex<T>(vr, vi);
+                    H(i, k - 1) = c.real();
+                    H(i, k) = c.imag();
+                    if (std::abs(x) > std::abs(z) + std::abs(q)) {
+                        H(i + 1, k - 1) = (-ra - w * H(i, k - 1) + q * H(i, k)) / x;
+                        H(i + 1, k) = (-sa - w * H(i, k) - q * H(i, k - 1)) / x;
+                    } else {
+                        std::complex<T> d = std::complex<T>(-r - y * H(i, k - 1), -s - y * H(i, k)) /
+                                            std::complex<T>(z, q);
+                        H(i + 1, k - 1) = d.real();
+                        H(i + 1, k) = d.imag();
+                    }
+                }
+                t = std::max(std::abs(H(i, k - 1)), std::abs(H(i, k))); // overflow control
+                if ((eps * t) * t > 1) {
+                    for (long long j = i; j <= k; j++) {
+                        H(j, k - 1) /= t;
+                        H(j, k) /= t;
+                    }
+                }
+            }
+        }
+    }
+
+    // eigenvectors of A = Q * (upper triangle of the back-substituted Schur form)
+    for (long long i = 1; i < n; i++) std::fill(&h[i * n], &h[i * n + i], T(0));
+    gemm<T>(n, n, n, T(1), vt.data(), 1, n, h.data(), n, 1, T(0), v.data(), n);
+
+    for (long long j = 0; j < n; j++) { // unit 2-norm, a complex pair is normalized as one vector
+        long long cols = wi[j] > T(0) ? 2 : 1;
+        T sq = T(0);
+        for (long long i = 0; i < n; i++) {
+            for (long long c = 0; c < cols; c++) sq += v[i * n + j + c] * v[i * n + j + c];
+        }
+        T inv = sq > T(0) ? T(1) / std::sqrt(sq) : T(1);
+        for (long long i = 0; i < n; i++) {
+            for (long long c = 0; c < cols; c++) v[i * n + j + c] *= inv;
+        }
+        j += cols - 1;
+    }
+}
+
+template<class T>
+std::vector<std::complex<T>> GeneralEigen<T>::values() const {
+    std::vector<std::complex<T>> ans(n);
+    for (long long i = 0; i < n; i++) ans[i] = std::complex<T>(wr[i], wi[i]);
+    return ans;
+}
+
+template<class T>
+bool GeneralEigen<T>::isReal() const {
+    return std::all_of(wi.begin(), wi.end(), [](T x) { return x == T(0); });
+}
+
+template<class T>
+Mat<std::complex<T>> GeneralEigen<T>::vectors() const {
+    if (!hasVectors) throw (InvalidDimensionsException("Eigenvectors were not computed"));
+    Mat<std::complex<T>> Z((int) n, (int) n);
+    for (long long j = 0; j < n; j++) {
+        for (long long i = 0; i < n; i++) {
+            if (wi[j] == T(0)) {
+                Z((int) i + 1, (int) j + 1) = v[i * n + j];
+            } else if (wi[j] > T(0)) { // re in column j, im in column j + 1
+                Z((int) i + 1, (int) j + 1) = std::complex<T>(v[i * n + j], v[i * n + j + 1]);
+            } else { // conjugate of the previous column
+                Z((int) i + 1, (int) j + 1) = std::complex<T>(v[i * n + j - 1], -v[i * n + j]);
+            }
+        }
+    }
+    return Z;
+}
+
+template<class T>
+Mat<T> GeneralEigen<T>::realVectors() const {
+    if (!isReal()) throw (Eigen_ComplexSpectrum("Matrix has complex eigenvalues"));
+    if (!hasVectors) throw (InvalidDimensionsException("Eigenvectors were not computed"));
+    Mat<T> Z((int) n, (int) n);
+    for (long long i = 0; i < n; i++) std::copy(&v[i * n], &v[i * n] + n, Z.rowPtr((int) i + 1));
+    return Z;
+}
+
+// algorithm used by SVD: Golub-Kahan bidiagonalization with implicit QR, or parallel one-sided Jacobi
+enum class SVDMethod {
+    GolubKahan,
+    Jacobi
+};
+
+/*
+ * Singular value decomposition A = U * diag(s) * V^T of an m x n matrix, singular values in descending order.
+ * Thin: U is m x k and V is n x k with k = min(m, n); otherwise both are square. A tall A is first reduced to its
+ * k x k triangular factor by HouseholderQR (a wide A is handled through A^T), and U is recovered with applyQ().
+ * GolubKahan bidiagonalizes the square factor with Householder reflectors, each step in a single pass over the
+ * trailing rows, accumulates the reflectors blockwise and diagonalizes the bidiagonal matrix with implicit
+ * zero-shift-safe QR steps (as in LINPACK/JAMA), rotating rows of U^T and V^T.
+ * Jacobi orthogonalizes the columns of the factor by plane rotations until every pair is orthogonal; the pairs of a
+ * round-robin round are disjoint and run in parallel. Slower but with high relative accuracy for small singular values.
+ */
+template<class T>
+class SVD {
+    long long m = 0;
+    long long n = 0;
+    std::vector<T> s;
+    Mat<T> u, v;
+    bool withVectors = false;
+
+    // square k x k problem in b (row-major), singular vectors as the rows of ut and vt
+    void golubKahan(std::vector<T> &b, long long k, std::vector<T> &ut, std::vector<T> &vt);
+
+    void jacobi(std::vector<T> &b, long long k, std::vector<T> &ut, std::vector<T> &vt);
+
+    void bidiagonalize(std::vector<T> &b, long long k, std::vector<T> &e, std::vector<T> &tauU, std::vector<T> &tauV);
+
+    void diagonalize(std::vector<T> &e, long long k, std::vector<T> &ut, std::vector<T> &vt); // on s and e
+
+public:
+    explicit SVD(const Mat<T> &A, bool thin = true, bool vectors = true, SVDMethod method = SVDMethod::GolubKahan);
+
+    const std::vector<T> &singularValues() const { return s; }
+
+    const Mat<T> &U() const { return u; } // left singular vectors as columns, empty without vectors
+
+    const Mat<T> &V() const { return v; } // right singular vectors as columns, empty without vectors
+
+    T tolerance(double tol = -1) const; // tol < 0: max(m, n) * eps * s[0]
+
+    int rank(double tol = -1) const; // number of singular values > tolerance(tol)
+
+    T cond() const; // s[0] / s[k - 1], infinite for a rank deficient A
+
+    Mat<T> pinv(double tol = -1) const; // Moore-Penrose pseudo-inverse, singular values <= tolerance(tol) dropped
+};
+
+template<class T>
+SVD<T>::SVD(const Mat<T> &A, bool thin, bool vectors, SVDMethod method) : m(A.row), n(A.col), withVectors(vectors) {
+    Mat<T> src = A;
+    src.toDense();
+    bool wide = m < n;
+    if (wide) src = src.transpose();
+    long long p = src.row, k = src.col; // p >= k
+    std::vector<T> b(k * k);
+    std::unique_ptr<HouseholderQR<T>> qr;
+    if (p > k) {
+        qr = std::make_unique<HouseholderQR<T>>(src);
+        Mat<T> R = qr->R(true);
+        for (long long i = 0; i < k; i++) {
+            const T *r = R.rowPtr((int) i + 1);
+            std::copy(r, r + k, b.begin() + i * k);
+        }
+    } else {
+        for (long long i = 0; i < k; i++) {
+            const T *r = src.rowPtr((int) i + 1);
+            std::copy(r, r + k, b.begin() + i * k);
+        }
+    }
+    std::vector<T> ut, vt;
+    if (method == SVDMethod::Jacobi) jacobi(b, k, ut, vt);
+    else golubKahan(b, k, ut, vt);
+
+    std::vector<long long> order(k);
+    for (long long i = 0; i < k; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](long long x, long long y) { return s[x] > s[y]; });
+    std::vector<T> sorted(k);
+    for (long long i = 0; i < k; i++) sorted[i] = s[order[i]];
+    s.swap(sorted);
+    if (!vectors) return;
+
+    // left vectors of the p x k problem: Q * [Ur 0; 0 I]
+    Mat<T> L((int) p, (int) (thin || p == k ? k : p));
+    for (long long i = 0; i < k; i++) {
+        for (long long c = 0; c < k; c++) L((int) i + 1, (int) c + 1) = ut[order[c] * k + i];
+    }
+    for (long long i = k; i < L.col; i++) L((int) i + 1, (int) i + 1) = T(1);
+    if (qr) L = qr->applyQ(L);
+    Mat<T> R((int) k, (int) k);
+    for (long long i = 0; i < k; i++) {
+        for (long long c = 0; c < k; c++) R((int) i + 1, (int) c + 1) = vt[order[c] * k + i];
+    }
+    u = wide ? R : L;
+    v = wide ? L : R;
+}
+
+template<class T>
+void SVD<T>::bidiagonalize(std::vector<T> &b, long long k, std::vector<T> &e, std::vector<T> &tauU,
+                           std::vector<T> &tauV) {
+    // B = H_0 ... H_(k-1) * bidiag(s, e) * (G_0 ... G_(k-3))^T. The vector of H_j is stored below the diagonal in
+    // column j, the one of G_j right of the superdiagonal in row j. While a trailing row gets H_j and G_j, the sums
+    // that define H_(j+1) (norm of column j + 1 and its products with the columns to its right) are gathered.
+    s.assign(k, T(0));
+    e.assign(k, T(0));
+    tauU.assign(k, T(0));
+    tauV.assign(k, T(0));
+    std::vector<T> dot(k, T(0)), w(k), vr(k);
+    T s2 = T(0);
+    for (long long i = 1; i < k; i++) {
+        const T *ri = &b[i * k];
+        s2 += ri[0] * ri[0];
+        for (long long c = 0; c < k - 1; c++) dot[c] += ri[0] * ri[1 + c];
+    }
+    for (long long j = 0; j < k; j++) {
+        long long nc = k - j - 1;
+        T *rj = &b[j * k];
+        T scale = T(0);
+        if (s2 > T(0)) {
+            T alpha = rj[j];
+            T norm = std::sqrt(alpha * alpha + s2);
+            T beta = alpha >= T(0) ? -norm : norm;
+            tauU[j] = (beta - alpha) / beta;
+            scale = T(1) / (alpha - beta);
+            rj[j] = beta;
+        }
+        s[j] = rj[j];
+        for (long long c = 0; c < nc; c++) {
+            w[c] = tauU[j] * (rj[j + 1 + c] + scale * dot[c]);
+            rj[j + 1 + c] -= w[c];
+        }
+        if (nc > 0) {
+            T alpha = rj[j + 1];
+            T r2 = T(0);
+            for (long long c = 1; c < nc; c++) r2 += rj[j + 1 + c] * rj[j + 1 + c];
+            if (r2 > T(0)) {
+                T norm = std::sqrt(alpha * alpha + r2);
+                T beta = alpha >= T(0) ? -norm : norm;
+                tauV[j] = (beta - alpha) / beta;
+                T sc = T(1) / (alpha - beta);
+                rj[j + 1] = beta;
+                for (long long c = 1; c < nc; c++) rj[j + 1 + c] *= sc;
+            }
+            e[j] = rj[j + 1];
+            vr[0] = T(1);
+            for (long long c = 1; c < nc; c++) vr[c] = rj[j + 1 + c];
+        }
+        T tr = tauV[j];
+        long long rows = k - j - 1;
+        long long parts = std::min<long long>(threadCount(), std::max<long long>(1, rows * nc / 32768));
+        std::vector<T> partial(parts * (nc + 1), T(0)); // per part: |column j + 1|^2, then the products
+        parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+            for (long long part = lo; part < hi; part++) {
+                T *acc = &partial[part * (nc + 1)];
+                for (long long i = j + 1 + rows * part / parts; i < j + 1 + rows * (part + 1) / parts; i++) {
+                    T *ri = &b[i * k + j];
+                    T x = ri[0] * scale;
+                    ri[0] = x;
+                    for (long long c = 0; c < nc; c++) ri[1 + c] -= x * w[c];
+                    if (tr != T(0)) {
+                        T z = T(0);
+                        for (long long c = 0; c < nc; c++) z += ri[1 + c] * vr[c];
+                        z *= tr;
+                        for (long long c = 0; c < nc; c++) ri[1 + c] -= z * vr[c];
+                    }
+                    if (i > j + 1 && nc > 1) {
+                        T y = ri[1];
+                        acc[0] += y * y;
+                        for (long long c = 0; c < nc - 1; c++) acc[1 + c] += y * ri[2 + c];
+                    }
+                }
+            }
+        });
+        s2 = T(0);
+        std::fill(dot.begin(), dot.end(), T(0));
+        for (long long part = 0; part < parts; part++) {
+            const T *acc = &partial[part * (nc + 1)];
+            s2 += acc[0];
+            for (long long c = 0; c + 1 < nc; c++) dot[c] += acc[1 + c];
+        }
+    }
+}
+
+template<class T>
+void SVD<T>::golubKahan(std::vector<T> &b, long long k, std::vector<T> &ut, std::vector<T> &vt) {
+    std::vector<T> e, tauU, tauV;
+    bidiagonalize(b, k, e, tauU, tauV);
+    if (withVectors) {
+        // U_B = H_0 ... H_(k-1) and V_B = G_0 ... G_(k-2), applied to I panel by panel from the last one
+        std::vector<T> Ub(k * k, T(0)), Vb(k * k, T(0)), V, Tb;
+        for (long long i = 0; i < k; i++) Ub[i * k + i] = Vb[i * k + i] = T(1);
+        for (long long c = (k - 1) / QR_BLOCK * QR_BLOCK; k > 0 && c >= 0; c -= QR_BLOCK) {
+            long long jb = std::min<long long>(QR_BLOCK, k - c);
+            householderV(&b[c * k + c], k, k - c, jb, V);
+            householderT(k - c, jb, V.data(), &tauU[c], Tb);
+            applyHouseholder(k - c, jb, V.data(), Tb.data(), false, &Ub[c * k + c], k, k - c);
+        }
+        long long nr = k - 1; // G_j acts on rows j + 1 .. k - 1; its vector, transposed, sits below row j + 1
+        std::vector<T> bt(k * k, T(0));
+        for (long long j = 0; j < nr; j++) {
+            for (long long c = j + 2; c < k; c++) bt[c * k + j] = b[j * k + c];
+        }
+        for (long long c = (nr - 1) / QR_BLOCK * QR_BLOCK; nr > 0 && c >= 0; c -= QR_BLOCK) {
+            long long jb = std::min<long long>(QR_BLOCK, nr - c);
+            householderV(&bt[(c + 1) * k + c], k, k - 1 - c, jb, V);
+            householderT(k - 1 - c, jb, V.data(), &tauV[c], Tb);
+            applyHouseholder(k - 1 - c, jb, V.data(), Tb.data(), false, &Vb[(c + 1) * k + c + 1], k, k - 1 - c);
+        }
+        ut.resize(k * k);
+        vt.resize(k * k);
+        for (long long i = 0; i < k; i++) {
+            for (long long j = 0; j < k; j++) {
+                ut[j * k + i] = Ub[i * k + j];
+                vt[j * k + i] = Vb[i * k + j];
+            }
+        }
+    }
+    diagonalize(e, k, ut, vt);
+}
+
+template<class T>
+void SVD<T>::diagonalize(std::vector<T> &e, long long k, std::vector<T> &ut, std::vector<T> &vt) {
+    const T eps = std::numeric_limits<T>::epsilon();
+    const T tiny = std::numeric_limits<T>::min() / eps;
+    // Rotations of rows x, y of U^T or V^T (x' = c * x + s * y, y' = -s * x + c * y) are recorded and replayed on
+    // column chunks that stay in cache, in parallel. A converged index is never rotated again, so its sign flip waits
+    // until the end.
+    struct Rotations {
+        std::vector<long long> x, y;
+        std::vector<T> c, s;
+    } rotU, rotV;
+    auto flush = [&](Rotations &r, std::vector<T> &z) {
+        long long count = (long long) r.c.size();
+        parallelFor(0, (k + 63) / 64, 1, [&](long long lo, long long hi) {
+            long long c0 = lo * 64, c1 = std::min(k, hi * 64);
+            for (long long q = 0; q < count; q++) planeRotation(&z[r.x[q] * k + c0], &z[r.y[q] * k + c0], r.c[q], -r.s[q], c1 - c0);
+        });
+        r.x.clear(), r.y.clear(), r.c.clear(), r.s.clear();
+    };
+    auto rotate = [&](Rotations &r, long long x, long long y, T c, T sn) {
+        if (!withVectors) return;
+        r.x.push_back(x), r.y.push_back(y), r.c.push_back(c), r.s.push_back(sn);
+    };
+    std::vector<char> flip(k, 0);
+    long long p = k, steps = 0;
+    while (p > 0) {
+        long long i, kase;
+        for (i = p - 2; i >= 0; i--) {
+            if (std::abs(e[i]) <= tiny + eps * (std::abs(s[i]) + std::abs(s[i + 1]))) {
+                e[i] = T(0);
+                break;
+            }
+        }
+        if (i == p - 2) {
+            kase = 4; // s[p - 1] has converged
+        } else {
+            long long ks;
+            for (ks = p - 1; ks > i; ks--) {
+                T t = (ks != p ? std::abs(e[ks]) : T(0)) + (ks != i + 1 ? std::abs(e[ks - 1]) : T(0));
+                if (std::abs(s[ks]) <= tiny + eps * t) {
+                    s[ks] = T(0);
+                    break;
+                }
+            }
+            if (ks == i) {
+                kase = 3; // QR step on s[i + 1 .. p - 1]
+            } else if (ks == p - 1) {
+                kase = 1; // s[p - 1] is zero, chase e[p - 2] out
+            } else {
+                kase = 2; // s[ks] is zero, split there
+                i = ks;
+            }
+        }
+        i++;
+        if (kase == 1) {
+            T f = e[p - 2];
+            e[p - 2] = T(0);
+            for (long long j = p - 2; j >= i; j--) {
+                T t = std::hypot(s[j], f);
+                T c = s[j] / t, sn = f / t;
+                s[j] = t;
+                if (j != i) {
+                    f = -sn * e[j - 1];
+                    e[j - 1] = c * e[j - 1];
+                }
+                rotate(rotV, j, p - 1, c, sn);
+            }
+        } else if (kase == 2) {
+            T f = e[i - 1];
+            e[i - 1] = T(0);
+            for (long long j = i; j < p; j++) {
+                T t = std::hypot(s[j], f);
+                T c = s[j] / t, sn = f / t;
+                s[j] = t;
+                f = -sn * e[j];
+                e[j] = c * e[j];
+                rotate(rotU, j, i - 1, c, sn);
+            }
+        } else if (kase == 3) {
+            if (++steps > 75 * std::max<long long>(k, 1)) throw (SVD_NotConverged("SVD: QR iteration did not converge"));
+            T scale = std::max({std::abs(s[p - 1]), std::abs(s[p - 2]), std::abs(e[p - 2]), std::abs(s[i]),
+                                std::abs(e[i])});
+            T sp = s[p - 1] / scale, spm1 = s[p - 2] / scale, epm1 = e[p - 2] / scale;
+            T si = s[i] / scale, ei = e[i] / scale;
+            T bb = ((spm1 + sp) * (spm1 - sp) + epm1 * epm1) / T(2);
+            T cc = (sp * epm1) * (sp * epm1);
+            T shift = T(0);
+            if (bb != T(0) || cc != T(0)) {
+                shift = std::sqrt(bb * bb + cc);
+                if (bb < T(0)) shift = -shift;
+                shift = cc / (bb + shift);
+            }
+            T f = (si + sp) * (si - sp) + shift;
+            T g = si * ei;
+            for (long long j = i; j < p - 1; j++) {
+                T t = std::hypot(f, g);
+                T c = f / t, sn = g / t;
+                if (j != i) e[j - 1] = t;
+                f = c * s[j] + sn * e[j];
+                e[j] = c * e[j] - sn * s[j];
+                g = sn * s[j + 1];
+                s[j + 1] = c * s[j + 1];
+                rotate(rotV, j, j + 1, c, sn);
+                t = std::hypot(f, g);
+                c = f / t;
+                sn = g / t;
+                s[j] = t;
+                f = c * e[j] + sn * s[j + 1];
+                s[j + 1] = -sn * e[j] + c * s[j + 1];
+                g = sn * e[j + 1];
+                e[j + 1] = c * e[j + 1];
+                rotate(rotU, j, j + 1, c, sn);
+            }
+            e[p - 2] = f;
+            if ((long long) rotU.c.size() >= 32 * k) flush(rotU, ut);
+            if ((long long) rotV.c.size() >= 32 * k) flush(rotV, vt);
+        } else {
+            if (s[i] <= T(0)) {
+                s[i] = s[i] < T(0) ? -s[i] : T(0);
+                flip[i] = 1;
+            }
+            p--;
+        }
+    }
+    if (!withVectors) return;
+    flush(rotU, ut);
+    flush(rotV, vt);
+    for (long long i = 0; i < k; i++) {
+        if (flip[i]) for (long long c = 0; c < k; c++) vt[i * k + c] = -vt[i * k + c];
+    }
+}
+
+template<class T>
+void SVD<T>::jacobi(std::vector<T> &b, long long k, std::vector<T> &ut, std::vector<T> &vt) {
+    // rows of w are the columns of B; rotating pairs of them until all are orthogonal gives B * V = U * diag(s)
+    std::vector<T> w(k * k);
+    for (long long i = 0; i < k; i++) {
+        for (long long j = 0; j < k; j++) w[j * k + i] = b[i * k + j];
+    }
+    if (withVectors) {
+        vt.assign(k * k, T(0));
+        for (long long i = 0; i < k; i++) vt[i * k + i] = T(1);
+    }
+    const T eps = std::numeric_limits<T>::epsilon();
+    long long players = k + (k % 2); // round-robin schedule, index k is a bye when k is odd
+    std::vector<long long> seat(players);
+    for (long long i = 0; i < players; i++) seat[i] = i;
+    std::atomic<long long> rotations{0};
+    for (int sweep = 0;; sweep++) {
+        if (sweep == 60) throw (SVD_NotConverged("SVD: Jacobi sweeps did not converge"));
+        rotations = 0;
+        for (long long round = 0; round + 1 < players; round++) {
+            parallelFor(0, players / 2, std::max<long long>(1, 4096 / std::max<long long>(k, 1)),
+                        [&](long long lo, long long hi) {
+                long long local = 0;
+                for (long long q = lo; q < hi; q++) {
+                    long long x = std::min(seat[q], seat[players - 1 - q]);
+                    long long y = std::max(seat[q], seat[players - 1 - q]);
+                    if (y >= k) continue;
+                    T *wx = &w[x * k], *wy = &w[y * k];
+                    T alpha = T(0), beta = T(0), gamma = T(0);
+                    for (long long c = 0; c < k; c++) {
+                        alpha += wx[c] * wx[c];
+                        beta += wy[c] * wy[c];
+                        gamma += wx[c] * wy[c];
+                    }
+                    if (!(std::abs(gamma) > eps * std::sqrt(alpha * beta))) continue;
+                    T zeta = (beta - alpha) / (T(2) * gamma);
+                    T t = (zeta >= T(0) ? T(1) : T(-1)) / (std::abs(zeta) + std::sqrt(T(1) + zeta * zeta));
+                    T c = T(1) / std::sqrt(T(1) + t * t);
+                    planeRotation(wx, wy, c, c * t, k);
+                    if (withVectors) planeRotation(&vt[x * k], &vt[y * k], c, c * t, k);
+                    local++;
+                }
+                rotations += local;
+            });
+            std::rotate(seat.begin() + 1, seat.end() - 1, seat.end()); // seat 0 stays, the others move one place
+        }
+        if (rotations == 0) break;
+    }
+    s.resize(k);
+    for (long long i = 0; i < k; i++) s[i] = std::sqrt(std::inner_product(&w[i * k], &w[i * k] + k, &w[i * k], T(0)));
+    if (!withVectors) return;
+    ut.assign(k * k, T(0));
+    T smax = k > 0 ? *std::max_element(s.begin(), s.end()) : T(0);
+    std::vector<long long> empty; // zero singular values get orthonormal completions
+    for (long long i = 0; i < k; i++) {
+        if (s[i] > std::numeric_limits<T>::min() && s[i] > eps * eps * smax) {
+            for (long long c = 0; c < k; c++) ut[i * k + c] = w[i * k + c] / s[i];
+        } else {
+            empty.push_back(i);
+        }
+    }
+    long long unit = 0;
+    for (long long i: empty) {
+        T norm = T(0);
+        while (!(norm > T(0.5)) && unit < k) {
+            std::fill(&ut[i * k], &ut[i * k] + k, T(0));
+            ut[i * k + unit++] = T(1);
+            for (int pass = 0; pass < 2; pass++) {
+                for (long long r = 0; r < k; r++) {
+                    if (r == i) continue;
+                    T d = std::inner_product(&ut[r * k], &ut[r * k] + k, &ut[i * k], T(0));
+                    for (long long c = 0; c < k; c++) ut[i * k + c] -= d * ut[r * k + c];
+                }
+            }
+            norm = std::sqrt(std::inner_product(&ut[i * k], &ut[i * k] + k, &ut[i * k], T(0)));
+        }
+        for (long long c = 0; c < k; c++) ut[i * k + c] /= norm;
+    }
+}
+
+template<class T>
+T SVD<T>::tolerance(double tol) const {
+    if (tol >= 0) return T(tol);
+    return s.empty() ? T(0) : T(std::max(m, n)) * std::numeric_limits<T>::epsilon() * s[0];
+}
+
+template<class T>
+int SVD<T>::rank(double tol) const {
+    T t = tolerance(tol);
+    int r = 0;
+    for (const T &x: s) r += x > t;
+    return r;
+}
+
+template<class T>
+T SVD<T>::cond() const {
+    if (s.empty()) return T(0);
+    return s.back() > T(0) ? s.front() / s.back() : std::numeric_limits<T>::infinity();
+}
+
+template<class T>
+Mat<T> SVD<T>::pinv(double tol) const {
+    if (!withVectors) throw (ClassTypeNotSupport("pinv() needs an SVD computed with vectors"));
+    long long k = (long long) s.size();
+    T t = tolerance(tol);
+    Mat<T> Vs((int) n, (int) k); // V * diag(1 / s)
+    for (long long i = 1; i <= n; i++) {
+        for (long long c = 0; c < k; c++) Vs((int) i, (int) c + 1) = s[c] > t ? v((int) i, (int) c + 1) / s[c] : T(0);
+    }
+    Mat<T> P((int) n, (int) m);
+    gemm<T>(n, m, k, T(1), Vs.pData.get(), Vs.step, 1, u.pData.get(), 1, u.step, T(0), P.pData.get(), P.step);
+    return P;
+}
+
+/*
+ * Rank-r truncated SVD A ~ U * diag(s) * V^T by randomized range finding (Halko, Martinsson, Tropp).
+ * The range of A is sampled with Y = A * G for an n x (r + oversample) Gaussian G; powerIterations rounds of
+ * A * (A^T * Q), each re-orthonormalized by QR, sharpen the decay of the sampled spectrum. With Q an orthonormal
+ * basis of Y, the small problem A^T * Q = W * diag(s) * Z^T is solved by SVD, giving U = Q * Z and V = W.
+ * A is only touched by tall-skinny products (gemm() for dense A, spmm() on the CSR/CSC storage for sparse A).
+ */
+template<class T>
+class RandomizedSVD {
+    std::vector<T> s;
+    Mat<T> u, v;
+
+public:
+    RandomizedSVD(const Mat<T> &A, int rank, int oversample = 10, int powerIterations = 2,
+                  unsigned long long seed = 0);
+
+    const std::vector<T> &singularValues() const { return s; } // descending, rank values
+
+    const Mat<T> &U() const { return u; } // m x rank
+
+    const Mat<T> &V() const { return v; } // n x rank
+};
+
+template<class T>
+RandomizedSVD<T>::RandomizedSVD(const Mat<T> &A, int rank, int oversample, int powerIterations,
+                                unsigned long long seed) {
+    long long m = A.row, n = A.col;
+    if (rank < 1 || rank > std::min(m, n)) throw (InvalidDimensionsException("rank must be between 1 and min(m, n)"));
+    long long l = std::min<long long>(rank + std::max(oversample, 0), std::min(m, n));
+    Mat<T> src = A;
+    SparseStorage<T> at; // CSR of A^T for a sparse A
+    if (src.isSparse) at = src.csc();
+    else src.toDense();
+    // C = A * X, or A^T * X when trans, for a dense X with l columns
+    auto product = [&](bool trans, const Mat<T> &X) {
+        Mat<T> C((int) (trans ? n : m), (int) l);
+        if (!src.isSparse) {
+            gemm<T>(C.row, l, X.row, T(1), src.pData.get(), trans ? 1 : src.step, trans ? src.step : 1,
+                    X.pData.get(), X.step, 1, T(0), C.pData.get(), C.step);
+        } else {
+            spmm(trans ? at : src.csr(), X.pData.get(), X.step, l, C.pData.get(), C.step);
+        }
+        return C;
+    };
+    Mat<T> Q = HouseholderQR<T>(product(false, gaussianMatGen<T>((int) n, (int) l, seed))).Q();
+    for (int it = 0; it < powerIterations; it++) {
+        Mat<T> W = HouseholderQR<T>(product(true, Q)).Q();
+        Q = HouseholderQR<T>(product(false, W)).Q();
+    }
+    SVD<T> small(product(true, Q)); // A^T * Q = W * diag(s) * Z^T, n x l
+    s.assign(small.singularValues().begin(), small.singularValues().begin() + rank);
+    const Mat<T> &Z = small.V();
+    u = Mat<T>((int) m, rank);
+    gemm<T>(m, rank, l, T(1), Q.pData.get(), Q.step, 1, Z.pData.get(), Z.step, 1, T(0), u.pData.get(), u.step);
+    v = Mat<T>((int) n, rank);
+    const Mat<T> &W = small.U();
+    for (long long i = 1; i <= n; i++) {
+        const T *r = W.rowPtr((int) i);
+        std::copy(r, r + rank, v.rowPtr((int) i));
+    }
+}
+
+// y = A * x for a matrix that is only known through its action; x has cols elements and y has rows
+template<class T>
+struct LinearOperator {
+    long long rows = 0;
+    long long cols = 0;
+    std::function<void(const T *x, T *y)> apply;
+
+    LinearOperator() = default;
+
+    LinearOperator(long long rows, long long cols, std::function<void(const T *, T *)> apply)
+            : rows(rows), cols(cols), apply(std::move(apply)) {}
+
+    LinearOperator(const Mat<T> &A); // spmv() on the CSR storage of a sparse matrix, row dot products otherwise
+};
+
+template<class T>
+LinearOperator<T>::LinearOperator(const Mat<T> &A) {
+    rows = A.row;
+    cols = A.col;
+    if (A.isSparse) {
+        A.csr(); // compress once, the copy below shares the storage
+        Mat<T> src = A;
+        std::shared_ptr<std::vector<long long>> bounds = std::make_shared<std::vector<long long>>(sparseRowBlocks(A.csr()));
+        apply = [src, bounds](const T *x, T *y) { spmv(src.csr(), *bounds, x, y); };
+    } else {
+        Mat<T> src = A;
+        apply = [src](const T *x, T *y) {
+            parallelFor(0, src.row, 256, [&](long long lo, long long hi) {
+                for (long long i = lo; i < hi; i++) {
+                    const T *r = src.rowPtr((int) i + 1);
+                    T sum = T(0);
+                    for (long long j = 0; j < src.col; j++) sum += r[j] * x[j];
+                    y[i] = sum;
+                }
+            });
+        };
+    }
+}
+
+// which end of the spectrum an iterative eigensolver converges to (Arnoldi compares real parts for *Algebraic)
+enum class EigenTarget {
+    LargestMagnitude,
+    LargestAlgebraic,
+    SmallestAlgebraic
+};
+
+/*
+ * Arnoldi factorization A * V = V * H + f * e_m^T with m orthonormal basis vectors, shared by Lanczos and Arnoldi.
+ * The basis vectors are the rows of V (m x n). New vectors are orthogonalized against the whole basis twice
+ * (classical Gram-Schmidt with one refinement), which also gives a stable Lanczos process in the symmetric case.
+ * restart() compresses the basis to V * U for an orthonormal U spanning the wanted invariant subspace of H
+ * (thick restart / Krylov-Schur). This equals an implicit restart with the unwanted Ritz values as exact shifts,
+ * but needs no sequence of shifted QR steps, whose rounding errors grow with the number of shifts. After a restart
+ * H is Hessenberg apart from the full row k that couples the kept vectors to the residual. The vector operations
+ * are split across threads.
+ */
+template<class T>
+class KrylovFactorization {
+public:
+    long long n = 0;
+    long long m = 0;
+    bool symmetric = false;
+    std::vector<T> V; // basis, m x n
+    Mat<T> H; // projected matrix, m x m upper Hessenberg (tridiagonal when symmetric)
+    std::vector<T> f; // residual vector
+    T beta = T(0); // ||f||
+
+    KrylovFactorization(const LinearOperator<T> &A, long long m, bool symmetric);
+
+    void extend(long long from); // Arnoldi steps from .. m - 1, v_from must be set
+
+    void restart(const Mat<T> &U); // keep the k = U.col vectors V^T * U (U: m x k, orthonormal), extend again
+
+private:
+    const LinearOperator<T> &A;
+    std::mt19937_64 rng{20240611};
+
+    void dots(long long k, const T *w, T *h) const; // h = V(0:k) * w
+
+    void subtract(long long k, const T *h, T *w) const; // w -= V(0:k)^T * h
+
+    T orthogonalize(long long k, T *w, T *h); // w against V(0:k), h receives the coefficients, returns ||w||
+
+    void randomVector(long long k); // unit vector orthogonal to V(0:k) into row k
+};
 
-        //temp.print();
-        temp = temp.gauss();
-        //std::cout << "After gauss" << std::endl;
-        //temp.print();
-        for (int j = temp.col; j >= 1; j--) {
-            if (temp.get(j, j) != 0) {
-                for (int k = 1; k <= j - 1; k++) {
-                    T2 ratio = -temp.get(k, j) / temp.get(j, j);
-                    for (int count = 1; count <= temp.col; count++) {
-                        temp.set(k, count, temp.get(k, count) + ratio * temp.get(j, count));
-                    }
+template<class T>
+KrylovFactorization<T>::KrylovFactorization(const LinearOperator<T> &A, long long m, bool symmetric)
+        : n(A.rows), m(m), symmetric(symmetric), A(A) {
+    if (A.rows != A.cols) throw (InvalidDimensionsException("Only square matrices have eigenvalues and eigenvectors."));
+    V.assign(m * n, T(0));
+    H = Mat<T>((int) m, (int) m);
+    f.assign(n, T(0));
+    randomVector(0);
+    extend(0);
+}
+
+template<class T>
+void KrylovFactorization<T>::dots(long long k, const T *w, T *h) const {
+    long long parts = std::min<long long>(threadCount(), std::max<long long>(1, n / 16384));
+    std::vector<T> partial(parts * k, T(0));
+    parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+        for (long long p = lo; p < hi; p++) {
+            long long b = n * p / parts, e = n * (p + 1) / parts;
+            for (long long i = 0; i < k; i++) {
+                const T *vi = &V[i * n];
+                T sum = T(0);
+                for (long long j = b; j < e; j++) sum += vi[j] * w[j];
+                partial[p * k + i] = sum;
+            }
+        }
+    });
+    for (long long i = 0; i < k; i++) {
+        h[i] = T(0);
+        for (long long p = 0; p < parts; p++) h[i] += partial[p * k + i];
+    }
+}
+
+template<class T>
+void KrylovFactorization<T>::subtract(long long k, const T *h, T *w) const {
+    parallelFor(0, n, 16384, [&](long long lo, long long hi) {
+        for (long long i = 0; i < k; i++) {
+            const T *vi = &V[i * n];
+            T c = h[i];
+            for (long long j = lo; j < hi; j++) w[j] -= c * vi[j];
+        }
+    });
+}
+
+template<class T>
+T KrylovFactorization<T>::orthogonalize(long long k, T *w, T *h) {
+    std::vector<T> h2(k);
+    dots(k, w, h);
+    subtract(k, h, w);
+    dots(k, w, h2.data());
+    subtract(k, h2.data(), w);
+    for (long long i = 0; i < k; i++) h[i] += h2[i];
+    T norm = T(0);
+    for (long long j = 0; j < n; j++) norm += w[j] * w[j];
+    return std::sqrt(norm);
+}
+
+template<class T>
+void KrylovFactorization<T>::randomVector(long long k) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    std::vector<T> w(n), h(k);
+    T norm = T(0);
+    for (int attempt = 0; attempt < 3 && !(norm > T(0)); attempt++) {
+        for (long long j = 0; j < n; j++) w[j] = T(dist(rng));
+        norm = orthogonalize(k, w.data(), h.data());
+    }
+    for (long long j = 0; j < n; j++) V[k * n + j] = norm > T(0) ? w[j] / norm : T(0);
+}
+
+template<class T>
+void KrylovFactorization<T>::extend(long long from) {
+    std::vector<T> h(m);
+    for (long long j = from; j < m; j++) {
+        A.apply(&V[j * n], f.data());
+        T norm = orthogonalize(j + 1, f.data(), h.data());
+        for (long long i = 0; i <= j; i++) H((int) i + 1, (int) j + 1) = h[i];
+        if (symmetric) { // column j mirrors row j: the coupling row after a restart, then tridiagonal
+            for (long long i = 0; i < j; i++) {
+                if (j == from || i + 1 == j) {
+                    H((int) i + 1, (int) j + 1) = H((int) j + 1, (int) i + 1);
+                } else {
+                    H((int) i + 1, (int) j + 1) = T(0);
                 }
             }
         }
-        //std::cout << "Guass again" << std::endl;
-        //temp.print();
-        for (int j = 1; j <= vector.row; j++) {
-            vector.set(j, i, temp.get(j, j));
+        beta = norm;
+        if (j + 1 == m) break;
+        T scale = std::max<T>(std::abs(H((int) j + 1, (int) j + 1)), T(1));
+        if (norm <= std::numeric_limits<T>::epsilon() * scale) { // invariant subspace found, continue elsewhere
+            H((int) j + 2, (int) j + 1) = T(0);
+            randomVector(j + 1);
+        } else {
+            H((int) j + 2, (int) j + 1) = norm;
+            for (long long t = 0; t < n; t++) V[(j + 1) * n + t] = f[t] / norm;
         }
     }
+    H.touch();
+}
+
+template<class T>
+void KrylovFactorization<T>::restart(const Mat<T> &U) {
+    long long k = U.col;
+    Mat<T> HU = H * U;
+    Mat<T> Hk((int) k, (int) k); // U^T * H * U
+    gemm<T>(k, k, m, T(1), U.pData.get(), 1, U.step, HU.pData.get(), HU.step, 1, T(0), Hk.pData.get(), Hk.step);
 
+    // A * (V^T U) = (V^T U) * Hk + f * b^T with b = U(m - 1, :)
+    std::vector<T> Vk(k * n);
+    gemm<T>(k, n, m, T(1), U.pData.get(), 1, U.step, V.data(), n, 1, T(0), Vk.data(), n);
+    std::copy(Vk.begin(), Vk.end(), V.begin());
+    for (int i = 1; i <= m; i++) std::fill(H.rowPtr(i), H.rowPtr(i) + m, T(0));
+    for (int i = 1; i <= k; i++) std::copy(Hk.rowPtr(i), Hk.rowPtr(i) + k, H.rowPtr(i));
+    std::vector<T> h(k);
+    T norm = orthogonalize(k, f.data(), h.data());
+    if (norm > std::numeric_limits<T>::epsilon() * std::max<T>(beta, T(1))) {
+        for (long long j = 0; j < n; j++) V[k * n + j] = f[j] / norm;
+        for (int i = 1; i <= k; i++) H((int) k + 1, i) = norm * U((int) m, i);
+    } else {
+        randomVector(k);
+    }
+    H.touch();
+    extend(k);
 }
 
+// order in which Ritz values are wanted
 template<class T>
-T Mat<T>::minRow(int r) {
-    T min = this->get(1, 1);
-    for (int i = 1; i <= col; ++i) {
-        if (this->get(r, i) < min) min = this->get(r, i);
+bool eigenTargetBefore(EigenTarget target, std::complex<T> a, std::complex<T> b) {
+    switch (target) {
+        case EigenTarget::LargestAlgebraic:
+            return a.real() > b.real();
+        case EigenTarget::SmallestAlgebraic:
+            return a.real() < b.real();
+        default:
+            return std::abs(a) > std::abs(b);
     }
-    return min;
 }
 
+/*
+ * A few eigenpairs at one end of the spectrum of a large symmetric matrix, which is only used through products
+ * A * x (a sparse Mat is multiplied with spmv() on all threads). Restarted Lanczos: a Krylov basis of ncv vectors
+ * is built, the Ritz pairs are taken from the projection with SymmetricEigen, and the basis is compressed to the
+ * wanted Ritz vectors until all nev residual norms |beta * y_m| are below tol * ||A|| (estimated by the largest
+ * Ritz value, so zero eigenvalues of a graph Laplacian converge too). ncv defaults to max(2 * nev + 1, 20) and tol
+ * to 1e-10; clustered eigenvalues converge much faster with a larger ncv.
+ */
 template<class T>
-T Mat<T>::minCol(int c) {
-    T min = this->get(1, 1);
-    for (int i = 1; i <= row; ++i) {
-        if (this->get(i, c) < min) min = this->get(i, c);
+class Lanczos {
+    std::vector<T> d;
+    Mat<T> x; // n x nev Ritz vectors
+    int iterations = 0;
+    bool ok = false;
+
+public:
+    Lanczos(const LinearOperator<T> &A, int nev, EigenTarget target = EigenTarget::LargestMagnitude, int ncv = 0,
+            double tol = 0, int maxRestarts = 300);
+
+    const std::vector<T> &values() const { return d; }
+
+    const Mat<T> &vectors() const { return x; } // column i belongs to values()[i]
+
+    bool converged() const { return ok; }
+
+    int restarts() const { return iterations; }
+};
+
+template<class T>
+Lanczos<T>::Lanczos(const LinearOperator<T> &A, int nev, EigenTarget target, int ncv, double tol, int maxRestarts) {
+    long long n = A.rows;
+    if (nev < 1 || nev > n) throw (InvalidDimensionsException("nev must be between 1 and the matrix size"));
+    long long m = ncv > 0 ? ncv : std::max(2 * nev + 1, 20);
+    m = std::min(std::max<long long>(m, nev + 1), n);
+    T tolerance = tol > 0 ? T(tol) : T(1e-10);
+    KrylovFactorization<T> kf(A, m, true);
+    std::vector<long long> order(m);
+    for (iterations = 0;; iterations++) {
+        SymmetricEigen<T> es(kf.H);
+        const Mat<T> Y = es.vectors();
+        for (long long i = 0; i < m; i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](long long a, long long b) {
+            return eigenTargetBefore<T>(target, es.values()[a], es.values()[b]);
+        });
+        T scale = std::max(std::abs(es.values().front()), std::abs(es.values().back())); // estimate of ||A||
+        int done = 0;
+        for (int i = 0; i < nev; i++) {
+            T res = std::abs(kf.beta * Y((int) m, (int) order[i] + 1));
+            if (res <= tolerance * scale) done++;
+        }
+        ok = done == nev || m == n;
+        if (ok || iterations >= maxRestarts) {
+            d.resize(nev);
+            Mat<T> Yk((int) m, nev);
+            for (int i = 0; i < nev; i++) {
+                d[i] = es.values()[order[i]];
+                for (int r = 1; r <= m; r++) Yk(r, i + 1) = Y(r, (int) order[i] + 1);
+            }
+            x = Mat<T>((int) n, nev);
+            gemm<T>(n, nev, m, T(1), kf.V.data(), 1, n, Yk.pData.get(), Yk.step, 1, T(0), x.pData.get(), x.step);
+            return;
+        }
+        // keep a few more than nev while some have converged, which speeds up the rest (as ARPACK does)
+        long long k = std::min<long long>(nev + std::min<long long>(done, (m - nev) / 2), m - 1);
+        Mat<T> U((int) m, (int) k);
+        for (int i = 0; i < k; i++) {
+            for (int r = 1; r <= m; r++) U(r, i + 1) = Y(r, (int) order[i] + 1);
+        }
+        kf.restart(U);
     }
-    return min;
 }
 
+/*
+ * A few eigenpairs of a large general matrix, used only through products A * x: implicitly restarted Arnoldi.
+ * Same scheme as Lanczos with the projection solved by GeneralEigen. The kept subspace is spanned by the real and
+ * imaginary parts of the wanted Ritz vectors (orthonormalized by QR), so a conjugate pair is kept or dropped as a
+ * whole and everything stays in real arithmetic.
+ */
 template<class T>
-T Mat<T>::maxCol(int c) {
-    T max = this->get(1, 1);
-    for (int i = 1; i <= row; ++i) {
-        if (this->get(i, c) > max) max = this->get(i, c);
+class Arnoldi {
+    std::vector<std::complex<T>> d;
+    Mat<std::complex<T>> x; // n x nev Ritz vectors
+    int iterations = 0;
+    bool ok = false;
+
+public:
+    Arnoldi(const LinearOperator<T> &A, int nev, EigenTarget target = EigenTarget::LargestMagnitude, int ncv = 0,
+            double tol = 0, int maxRestarts = 300);
+
+    const std::vector<std::complex<T>> &values() const { return d; }
+
+    const Mat<std::complex<T>> &vectors() const { return x; } // column i belongs to values()[i]
+
+    bool converged() const { return ok; }
+
+    int restarts() const { return iterations; }
+};
+
+template<class T>
+Arnoldi<T>::Arnoldi(const LinearOperator<T> &A, int nev, EigenTarget target, int ncv, double tol, int maxRestarts) {
+    long long n = A.rows;
+    if (nev < 1 || nev > n) throw (InvalidDimensionsException("nev must be between 1 and the matrix size"));
+    long long m = ncv > 0 ? ncv : std::max(2 * nev + 1, 20);
+    m = std::min(std::max<long long>(m, nev + 2), n);
+    T tolerance = tol > 0 ? T(tol) : T(1e-10);
+    KrylovFactorization<T> kf(A, m, false);
+    std::vector<long long> order(m);
+    for (iterations = 0;; iterations++) {
+        GeneralEigen<T> ge(kf.H);
+        std::vector<std::complex<T>> theta = ge.values();
+        const Mat<std::complex<T>> Y = ge.vectors();
+        for (long long i = 0; i < m; i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](long long a, long long b) {
+            return eigenTargetBefore<T>(target, theta[a], theta[b]);
+        });
+        T scale = T(0); // estimate of ||A||
+        for (const std::complex<T> &t: theta) scale = std::max(scale, std::abs(t));
+        int done = 0;
+        for (int i = 0; i < nev; i++) {
+            T res = kf.beta * std::abs(Y((int) m, (int) order[i] + 1));
+            if (res <= tolerance * scale) done++;
+        }
+        ok = done == nev || m == n;
+        if (ok || iterations >= maxRestarts) {
+            d.resize(nev);
+            Mat<T> Yr((int) m, nev), Yi((int) m, nev);
+            for (int i = 0; i < nev; i++) {
+                d[i] = theta[order[i]];
+                for (int r = 1; r <= m; r++) {
+                    Yr(r, i + 1) = Y(r, (int) order[i] + 1).real();
+                    Yi(r, i + 1) = Y(r, (int) order[i] + 1).imag();
+                }
+            }
+            std::vector<T> xr(n * nev), xi(n * nev);
+            gemm<T>(n, nev, m, T(1), kf.V.data(), 1, n, Yr.pData.get(), Yr.step, 1, T(0), xr.data(), nev);
+            gemm<T>(n, nev, m, T(1), kf.V.data(), 1, n, Yi.pData.get(), Yi.step, 1, T(0), xi.data(), nev);
+            x = Mat<std::complex<T>>((int) n, nev);
+            for (long long r = 0; r < n; r++) {
+                for (int i = 0; i < nev; i++) x((int) r + 1, i + 1) = std::complex<T>(xr[r * nev + i], xi[r * nev + i]);
+            }
+            return;
+        }
+        long long k = std::min<long long>(nev + std::min<long long>(done, (m - nev) / 2), m - 2);
+        if (theta[order[k - 1]].imag() != T(0) && theta[order[k]] == std::conj(theta[order[k - 1]])) k++;
+        // real basis of the wanted subspace: Re and Im of a complex pair span the same space as the pair
+        Mat<T> W((int) m, (int) k);
+        for (int i = 0; i < k; i++) {
+            std::complex<T> t = theta[order[i]];
+            bool second = i > 0 && t.imag() != T(0) && t == std::conj(theta[order[i - 1]]);
+            for (int r = 1; r <= m; r++) {
+                std::complex<T> y = Y(r, (int) order[second ? i - 1 : i] + 1);
+                W(r, i + 1) = second ? y.imag() : y.real();
+            }
+        }
+        kf.restart(HouseholderQR<T>(W).Q());
     }
-    return max;
 }
 
+/*
+ * Sparse triangular matrix for repeated solves: the strictly triangular part in CSR form plus the diagonal. Rows are
+ * grouped into levels such that a row only depends on rows of earlier levels, so the rows of one level are solved
+ * in parallel. All levels run inside one parallelFor() with a barrier after each level; when the levels are too
+ * narrow to pay for the synchronization the solve runs serially.
+ */
 template<class T>
-T Mat<T>::maxRow(int r) {
-    T max = this->get(1, 1);
-    for (int i = 1; i <= col; ++i) {
-        if (this->get(r, i) > max) max = this->get(r, i);
+class TriangularFactor {
+public:
+    long long n = 0;
+    bool lower = true;
+    std::vector<long long> ptr; // strictly triangular part, CSR
+    std::vector<int> idx;
+    std::vector<T> val;
+    std::vector<T> diag; // empty for a unit diagonal
+
+    static constexpr long long LEVEL_GRAIN = 256; // minimum average rows per level and thread for a parallel solve
+
+    TriangularFactor() = default;
+
+    // the lower or upper triangle of s (CSR, n x n), off-diagonal entries scaled by `scale`
+    TriangularFactor(const SparseStorage<T> &s, bool lower, bool unitDiag, T scale = T(1));
+
+    void solve(const T *b, T *x) const; // x = inv(L) * b or inv(U) * b, x may be b
+
+    long long levels() const { return (long long) levelPtr.size() - 1; }
+
+private:
+    std::vector<long long> levelPtr; // rows of level l are levelRows[levelPtr[l] .. levelPtr[l + 1] - 1]
+    std::vector<int> levelRows;
+
+    void solveRow(long long i, const T *b, T *x) const;
+};
+
+template<class T>
+TriangularFactor<T>::TriangularFactor(const SparseStorage<T> &s, bool lower, bool unitDiag, T scale)
+        : n(s.outer), lower(lower), ptr(s.outer + 1, 0) {
+    if (!unitDiag) diag.assign(n, T(0));
+    for (long long i = 0; i < n; i++) {
+        for (long long p = s.ptr[i]; p < s.ptr[i + 1]; p++) {
+            if (s.idx[p] == i) {
+                if (!unitDiag) diag[i] = s.val[p];
+            } else if ((s.idx[p] < i) == lower) {
+                idx.push_back(s.idx[p]);
+                val.push_back(scale * s.val[p]);
+            }
+        }
+        ptr[i + 1] = (long long) idx.size();
+    }
+    for (long long i = 0; i < (long long) diag.size(); i++) {
+        if (diag[i] == T(0)) throw (Preconditioner_Breakdown("Zero on the diagonal of a triangular factor."));
+    }
+    // level of a row = 1 + the deepest level it depends on, rows in the order they are solved
+    std::vector<int> level(n, 0);
+    int depth = 0;
+    for (long long t = 0; t < n; t++) {
+        long long i = lower ? t : n - 1 - t;
+        int l = 0;
+        for (long long p = ptr[i]; p < ptr[i + 1]; p++) l = std::max(l, level[idx[p]] + 1);
+        level[i] = l;
+        depth = std::max(depth, l + 1);
+    }
+    levelPtr.assign(depth + 1, 0);
+    for (long long i = 0; i < n; i++) levelPtr[level[i] + 1]++;
+    for (int l = 0; l < depth; l++) levelPtr[l + 1] += levelPtr[l];
+    levelRows.resize(n);
+    std::vector<long long> next(levelPtr.begin(), levelPtr.end() - 1);
+    for (long long i = 0; i < n; i++) levelRows[next[level[i]]++] = (int) i;
+}
+
+template<class T>
+void TriangularFactor<T>::solveRow(long long i, const T *b, T *x) const {
+    T sum = b[i];
+    for (long long p = ptr[i]; p < ptr[i + 1]; p++) sum -= val[p] * x[idx[p]];
+    x[i] = diag.empty() ? sum : sum / diag[i];
+}
+
+template<class T>
+void TriangularFactor<T>::solve(const T *b, T *x) const {
+    long long depth = levels();
+    long long parts = depth > 0 ? std::min<long long>(threadCount(), n / (depth * LEVEL_GRAIN)) : 0;
+    if (parts <= 1 || inParallelRegion()) {
+        for (long long t = 0; t < n; t++) solveRow(lower ? t : n - 1 - t, b, x);
+        return;
+    }
+    std::atomic<long long> arrived{0};
+    parallelFor(0, parts, 1, [&](long long lo, long long hi) {
+        for (long long part = lo; part < hi; part++) { // one part per thread
+            for (long long l = 0; l < depth; l++) {
+                long long first = levelPtr[l], count = levelPtr[l + 1] - first;
+                for (long long r = first + count * part / parts; r < first + count * (part + 1) / parts; r++) {
+                    solveRow(levelRows[r], b, x);
+                }
+                arrived.fetch_add(1);
+                while (arrived.load() < (l + 1) * parts) std::this_thread::yield();
+            }
+        }
+    });
+}
+
+// z = inv(M) * r for an approximation M of A; z may be r
+template<class T>
+class Preconditioner {
+public:
+    virtual ~Preconditioner() = default;
+
+    virtual void apply(const T *r, T *z) const = 0;
+};
+
+// M = diag(A)
+template<class T>
+class JacobiPreconditioner : public Preconditioner<T> {
+    std::vector<T> inv; // 1 / a_ii
+
+public:
+    explicit JacobiPreconditioner(const Mat<T> &A);
+
+    void apply(const T *r, T *z) const override;
+};
+
+template<class T>
+JacobiPreconditioner<T>::JacobiPreconditioner(const Mat<T> &A) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Preconditioners need a square matrix."));
+    Mat<T> S = A;
+    S.toSparse();
+    const SparseStorage<T> &s = S.csr();
+    inv.resize(A.row);
+    for (long long i = 0; i < A.row; i++) {
+        long long p = s.find(i, i);
+        if (p < 0) throw (Preconditioner_Breakdown("Zero on the diagonal, Jacobi preconditioning is undefined."));
+        inv[i] = T(1) / s.val[p];
+    }
+}
+
+template<class T>
+void JacobiPreconditioner<T>::apply(const T *r, T *z) const {
+    for (size_t i = 0; i < inv.size(); i++) z[i] = inv[i] * r[i];
+}
+
+/*
+ * Symmetric successive over-relaxation, M = (D + w L) * inv(D) * (D + w U) / (w (2 - w)) with A = L + D + U.
+ * Symmetric positive definite for symmetric positive definite A and 0 < w < 2.
+ */
+template<class T>
+class SSORPreconditioner : public Preconditioner<T> {
+    TriangularFactor<T> L, U;
+    T omega;
+
+public:
+    explicit SSORPreconditioner(const Mat<T> &A, double omega = 1.0);
+
+    void apply(const T *r, T *z) const override;
+};
+
+template<class T>
+SSORPreconditioner<T>::SSORPreconditioner(const Mat<T> &A, double omega) : omega(T(omega)) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Preconditioners need a square matrix."));
+    if (!(omega > 0 && omega < 2)) throw (InvalidDimensionsException("The SSOR weight must lie in (0, 2)."));
+    Mat<T> S = A;
+    S.toSparse();
+    L = TriangularFactor<T>(S.csr(), true, false, T(omega));
+    U = TriangularFactor<T>(S.csr(), false, false, T(omega));
+}
+
+template<class T>
+void SSORPreconditioner<T>::apply(const T *r, T *z) const {
+    L.solve(r, z);
+    T c = omega * (T(2) - omega);
+    for (long long i = 0; i < L.n; i++) z[i] *= c * L.diag[i];
+    U.solve(z, z);
+}
+
+/*
+ * Incomplete LU factorization without fill-in: A ~ L * U with L unit lower triangular, both restricted to the
+ * nonzero pattern of A.
+ */
+template<class T>
+class ILUPreconditioner : public Preconditioner<T> {
+    TriangularFactor<T> L, U;
+
+public:
+    explicit ILUPreconditioner(const Mat<T> &A);
+
+    void apply(const T *r, T *z) const override;
+};
+
+template<class T>
+ILUPreconditioner<T>::ILUPreconditioner(const Mat<T> &A) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Preconditioners need a square matrix."));
+    Mat<T> S = A;
+    S.toSparse();
+    SparseStorage<T> f = S.csr(); // factorized in place
+    long long n = f.outer;
+    std::vector<long long> pos(n, -1), diagPos(n, -1);
+    for (long long i = 0; i < n; i++) {
+        for (long long p = f.ptr[i]; p < f.ptr[i + 1]; p++) pos[f.idx[p]] = p;
+        for (long long p = f.ptr[i]; p < f.ptr[i + 1] && f.idx[p] < i; p++) {
+            long long k = f.idx[p];
+            f.val[p] /= f.val[diagPos[k]];
+            for (long long q = diagPos[k] + 1; q < f.ptr[k + 1]; q++) {
+                if (pos[f.idx[q]] >= 0) f.val[pos[f.idx[q]]] -= f.val[p] * f.val[q];
+            }
+        }
+        diagPos[i] = pos[i];
+        if (diagPos[i] < 0 || f.val[diagPos[i]] == T(0)) {
+            throw (Preconditioner_Breakdown("Zero pivot in the incomplete LU factorization."));
+        }
+        for (long long p = f.ptr[i]; p < f.ptr[i + 1]; p++) pos[f.idx[p]] = -1;
+    }
+    L = TriangularFactor<T>(f, true, true);
+    U = TriangularFactor<T>(f, false, false);
+}
+
+template<class T>
+void ILUPreconditioner<T>::apply(const T *r, T *z) const {
+    L.solve(r, z);
+    U.solve(z, z);
+}
+
+/*
+ * Incomplete Cholesky factorization without fill-in, A ~ L * L^T on the lower triangle of a symmetric A. When a
+ * pivot is not positive the factorization is restarted on A + a * diag(A) with a growing shift a.
+ */
+template<class T>
+class ICPreconditioner : public Preconditioner<T> {
+    TriangularFactor<T> L, Lt;
+    T shift = T(0);
+
+public:
+    explicit ICPreconditioner(const Mat<T> &A);
+
+    void apply(const T *r, T *z) const override;
+
+    T diagonalShift() const { return shift; } // the a used, 0 when A was factorized as given
+};
+
+template<class T>
+ICPreconditioner<T>::ICPreconditioner(const Mat<T> &A) {
+    if (A.row != A.col) throw (InvalidDimensionsException("Preconditioners need a square matrix."));
+    Mat<T> S = A;
+    S.toSparse();
+    const SparseStorage<T> &s = S.csr();
+    long long n = s.outer;
+    SparseStorage<T> f(n, n); // lower triangle of A, factorized in place
+    for (long long i = 0; i < n; i++) {
+        for (long long p = s.ptr[i]; p < s.ptr[i + 1] && s.idx[p] <= i; p++) {
+            f.idx.push_back(s.idx[p]);
+            f.val.push_back(s.val[p]);
+        }
+        f.ptr[i + 1] = (long long) f.idx.size();
+        if (f.ptr[i + 1] == f.ptr[i] || f.idx.back() != i) {
+            throw (Preconditioner_Breakdown("Zero on the diagonal, incomplete Cholesky is undefined."));
+        }
+    }
+    const std::vector<T> a = f.val;
+    std::vector<long long> pos(n, -1);
+    for (int attempt = 0;; attempt++) {
+        bool ok = true;
+        for (long long i = 0; i < n && ok; i++) {
+            for (long long p = f.ptr[i]; p < f.ptr[i + 1]; p++) pos[f.idx[p]] = p;
+            for (long long p = f.ptr[i]; p < f.ptr[i + 1]; p++) {
+                long long k = f.idx[p];
+                T sum = k == i ? a[p] * (T(1) + shift) : a[p];
+                for (long long q = f.ptr[k]; q < f.ptr[k + 1] - 1; q++) { // row k without its diagonal
+                    if (pos[f.idx[q]] >= 0 && pos[f.idx[q]] < p) sum -= f.val[pos[f.idx[q]]] * f.val[q];
+                }
+                if (k < i) {
+                    f.val[p] = sum / f.val[f.ptr[k + 1] - 1];
+                } else if (sum > T(0)) {
+                    f.val[p] = std::sqrt(sum);
+                } else {
+                    ok = false;
+                }
+            }
+            for (long long p = f.ptr[i]; p < f.ptr[i + 1]; p++) pos[f.idx[p]] = -1;
+        }
+        if (ok) break;
+        if (attempt == 30) throw (Preconditioner_Breakdown("Incomplete Cholesky failed, the matrix is not positive definite."));
+        shift = shift == T(0) ? T(1e-3) : T(2) * shift;
+    }
+    L = TriangularFactor<T>(f, true, false);
+    Lt = TriangularFactor<T>(f.transpose(), false, false);
+}
+
+template<class T>
+void ICPreconditioner<T>::apply(const T *r, T *z) const {
+    L.solve(r, z);
+    Lt.solve(z, z);
+}
+
+// Outcome of an iterative solve. residual is ||b - A x|| / ||b|| as tracked by the iteration.
+struct SolverInfo {
+    bool converged = false;
+    int iterations = 0;
+    double residual = 0;
+};
+
+// Called after every iteration with the iteration count and the relative residual; returning false stops the solve.
+using SolverMonitor = std::function<bool(int iteration, double residual)>;
+
+template<class T>
+T vectorDot(long long n, const T *x, const T *y) {
+    T sum = T(0);
+    for (long long i = 0; i < n; i++) sum += x[i] * y[i];
+    return sum;
+}
+
+// y += a * x
+template<class T>
+void vectorAxpy(long long n, T a, const T *x, T *y) {
+    for (long long i = 0; i < n; i++) y[i] += a * x[i];
+}
+
+/*
+ * Common part of the Krylov solvers for A * x = b. The operator is kept by value (a LinearOperator built from a Mat
+ * shares its storage). Work vectors are allocated in the constructor and parallel products run on the persistent
+ * pool, so solve(const T *, T *) performs no allocation once the pool has been started by the first parallel loop
+ * of the process; apart from A.apply the iterations run on the calling thread. x holds the initial guess on entry.
+ */
+template<class T>
+class IterativeSolver {
+public:
+    double tol = 1e-10; // stop when ||b - A x|| <= tol * ||b||
+    int maxIterations = 0; // 0: the size of A
+    SolverMonitor monitor;
+
+    virtual ~IterativeSolver() = default;
+
+    virtual SolverInfo solve(const T *b, T *x) = 0;
+
+    SolverInfo solve(const Mat<T> &b, Mat<T> &x); // b: n x 1, x is reset to zeros unless it is a dense n x 1 guess
+
+protected:
+    LinearOperator<T> A;
+    long long n = 0;
+
+    IterativeSolver(LinearOperator<T> A, double tol, int maxIterations);
+
+    int iterationLimit() const { return maxIterations > 0 ? maxIterations : (int) std::min<long long>(n, std::numeric_limits<int>::max()); }
+
+    bool report(SolverInfo &info, double residual); // records an iteration, true when the solve should stop
+};
+
+template<class T>
+IterativeSolver<T>::IterativeSolver(LinearOperator<T> A, double tol, int maxIterations)
+        : tol(tol), maxIterations(maxIterations), A(std::move(A)) {
+    if (this->A.rows != this->A.cols) throw (InvalidDimensionsException("Iterative solvers need a square matrix."));
+    n = this->A.rows;
+}
+
+template<class T>
+bool IterativeSolver<T>::report(SolverInfo &info, double residual) {
+    info.iterations++;
+    info.residual = residual;
+    info.converged = residual <= tol;
+    bool stop = monitor && !monitor(info.iterations, residual);
+    return info.converged || stop || info.iterations >= iterationLimit();
+}
+
+template<class T>
+SolverInfo IterativeSolver<T>::solve(const Mat<T> &b, Mat<T> &x) {
+    if (b.row != n || b.col != 1) throw (InvalidDimensionsException("The right-hand side must be an n x 1 matrix."));
+    if (x.isSparse || x.row != n || x.col != 1) x = Mat<T>((int) n, 1);
+    std::vector<T> rhs(n), sol(n);
+    for (long long i = 0; i < n; i++) {
+        rhs[i] = b.get((int) i + 1, 1);
+        sol[i] = x((int) i + 1, 1);
+    }
+    SolverInfo info = solve(rhs.data(), sol.data());
+    for (long long i = 0; i < n; i++) x((int) i + 1, 1) = sol[i];
+    x.touch();
+    return info;
+}
+
+// Conjugate gradient for symmetric positive definite A, preconditioned when a symmetric positive definite M is set
+template<class T>
+class ConjugateGradient : public IterativeSolver<T> {
+    std::vector<T> r, p, q, z;
+
+public:
+    std::shared_ptr<const Preconditioner<T>> preconditioner;
+
+    explicit ConjugateGradient(LinearOperator<T> A, double tol = 1e-10, int maxIterations = 0);
+
+    ConjugateGradient(LinearOperator<T> A, std::shared_ptr<const Preconditioner<T>> M, double tol = 1e-10,
+                      int maxIterations = 0);
+
+    using IterativeSolver<T>::solve;
+
+    SolverInfo solve(const T *b, T *x) override;
+};
+
+template<class T>
+ConjugateGradient<T>::ConjugateGradient(LinearOperator<T> A, double tol, int maxIterations)
+        : IterativeSolver<T>(std::move(A), tol, maxIterations), r(this->n), p(this->n), q(this->n), z(this->n) {}
+
+template<class T>
+ConjugateGradient<T>::ConjugateGradient(LinearOperator<T> A, std::shared_ptr<const Preconditioner<T>> M, double tol,
+                                        int maxIterations)
+        : ConjugateGradient(std::move(A), tol, maxIterations) {
+    preconditioner = std::move(M);
+}
+
+template<class T>
+SolverInfo ConjugateGradient<T>::solve(const T *b, T *x) {
+    long long n = this->n;
+    SolverInfo info;
+    double normb = std::sqrt(double(vectorDot(n, b, b)));
+    if (normb == 0) {
+        std::fill(x, x + n, T(0));
+        info.converged = true;
+        return info;
+    }
+    this->A.apply(x, r.data());
+    for (long long i = 0; i < n; i++) r[i] = b[i] - r[i];
+    info.residual = std::sqrt(double(vectorDot(n, r.data(), r.data()))) / normb;
+    if (info.residual <= this->tol) {
+        info.converged = true;
+        return info;
+    }
+    const T *zp = preconditioner ? z.data() : r.data(); // z = inv(M) * r
+    if (preconditioner) preconditioner->apply(r.data(), z.data());
+    T rho = vectorDot(n, r.data(), zp);
+    std::copy(zp, zp + n, p.begin());
+    for (;;) {
+        this->A.apply(p.data(), q.data());
+        T pq = vectorDot(n, p.data(), q.data());
+        if (!(pq > T(0))) break; // A is not positive definite along p
+        T alpha = rho / pq;
+        vectorAxpy(n, alpha, p.data(), x);
+        vectorAxpy(n, -alpha, q.data(), r.data());
+        if (this->report(info, std::sqrt(double(vectorDot(n, r.data(), r.data()))) / normb)) break;
+        if (preconditioner) preconditioner->apply(r.data(), z.data());
+        T rhoNext = vectorDot(n, r.data(), zp);
+        T beta = rhoNext / rho;
+        rho = rhoNext;
+        for (long long i = 0; i < n; i++) p[i] = zp[i] + beta * p[i];
+    }
+    return info;
+}
+
+// Stabilized bi-conjugate gradient for general nonsingular A, two products with A per iteration
+template<class T>
+class BiCGSTAB : public IterativeSolver<T> {
+    std::vector<T> r, r0, p, v, t;
+
+public:
+    explicit BiCGSTAB(LinearOperator<T> A, double tol = 1e-10, int maxIterations = 0);
+
+    using IterativeSolver<T>::solve;
+
+    SolverInfo solve(const T *b, T *x) override;
+};
+
+template<class T>
+BiCGSTAB<T>::BiCGSTAB(LinearOperator<T> A, double tol, int maxIterations)
+        : IterativeSolver<T>(std::move(A), tol, maxIterations), r(this->n), r0(this->n), p(this->n), v(this->n),
+          t(this->n) {}
+
+template<class T>
+SolverInfo BiCGSTAB<T>::solve(const T *b, T *x) {
+    long long n = this->n;
+    SolverInfo info;
+    double normb = std::sqrt(double(vectorDot(n, b, b)));
+    if (normb == 0) {
+        std::fill(x, x + n, T(0));
+        info.converged = true;
+        return info;
+    }
+    this->A.apply(x, r.data());
+    for (long long i = 0; i < n; i++) r[i] = b[i] - r[i];
+    info.residual = std::sqrt(double(vectorDot(n, r.data(), r.data()))) / normb;
+    if (info.residual <= this->tol) {
+        info.converged = true;
+        return info;
+    }
+    std::copy(r.begin(), r.end(), r0.begin());
+    std::fill(p.begin(), p.end(), T(0));
+    std::fill(v.begin(), v.end(), T(0));
+    T rho = T(1), alpha = T(1), omega = T(1);
+    for (;;) {
+        T rhoNext = vectorDot(n, r0.data(), r.data());
+        if (rhoNext == T(0) || omega == T(0)) break; // breakdown
+        T beta = (rhoNext / rho) * (alpha / omega);
+        rho = rhoNext;
+        for (long long i = 0; i < n; i++) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        this->A.apply(p.data(), v.data());
+        T r0v = vectorDot(n, r0.data(), v.data());
+        if (r0v == T(0)) break;
+        alpha = rho / r0v;
+        vectorAxpy(n, alpha, p.data(), x);
+        vectorAxpy(n, -alpha, v.data(), r.data()); // r is now s = r - alpha * v
+        double res = std::sqrt(double(vectorDot(n, r.data(), r.data()))) / normb;
+        if (res <= this->tol) {
+            this->report(info, res);
+            break;
+        }
+        this->A.apply(r.data(), t.data());
+        T tt = vectorDot(n, t.data(), t.data());
+        omega = tt > T(0) ? vectorDot(n, t.data(), r.data()) / tt : T(0);
+        vectorAxpy(n, omega, r.data(), x);
+        vectorAxpy(n, -omega, t.data(), r.data());
+        if (this->report(info, std::sqrt(double(vectorDot(n, r.data(), r.data()))) / normb)) break;
+    }
+    return info;
+}
+
+/*
+ * GMRES restarted every `restart` iterations, for general nonsingular A. The Krylov basis is built with modified
+ * Gram-Schmidt and the least-squares problem is updated with Givens rotations, so the residual norm is known at every
+ * iteration without forming x. maxIterations counts inner iterations over all cycles.
+ */
+template<class T>
+class GMRES : public IterativeSolver<T> {
+    int m;
+    std::vector<T> V; // basis, (m + 1) x n
+    std::vector<T> H; // Hessenberg matrix, column j at H[j * (m + 1)], reduced to triangular by the rotations
+    std::vector<T> cs, sn, g;
+
+public:
+    explicit GMRES(LinearOperator<T> A, int restart = 30, double tol = 1e-10, int maxIterations = 0);
+
+    using IterativeSolver<T>::solve;
+
+    SolverInfo solve(const T *b, T *x) override;
+};
+
+template<class T>
+GMRES<T>::GMRES(LinearOperator<T> A, int restart, double tol, int maxIterations)
+        : IterativeSolver<T>(std::move(A), tol, maxIterations) {
+    if (restart < 1) throw (InvalidDimensionsException("The GMRES restart length must be positive."));
+    m = (int) std::min<long long>(restart, std::max<long long>(this->n, 1));
+    V.resize((m + 1) * this->n);
+    H.resize((m + 1) * m);
+    cs.resize(m);
+    sn.resize(m);
+    g.resize(m + 1);
+}
+
+template<class T>
+SolverInfo GMRES<T>::solve(const T *b, T *x) {
+    long long n = this->n;
+    SolverInfo info;
+    double normb = std::sqrt(double(vectorDot(n, b, b)));
+    if (normb == 0) {
+        std::fill(x, x + n, T(0));
+        info.converged = true;
+        return info;
+    }
+    for (;;) {
+        T *v0 = V.data();
+        this->A.apply(x, v0);
+        for (long long i = 0; i < n; i++) v0[i] = b[i] - v0[i];
+        T beta = std::sqrt(vectorDot(n, v0, v0));
+        info.residual = double(beta) / normb;
+        if (info.residual <= this->tol) {
+            info.converged = true;
+            return info;
+        }
+        for (long long i = 0; i < n; i++) v0[i] /= beta;
+        std::fill(g.begin(), g.end(), T(0));
+        g[0] = beta;
+        int j = 0;
+        bool stop = false;
+        while (j < m && !stop) {
+            T *h = &H[j * (m + 1)];
+            T *w = &V[(j + 1) * n];
+            this->A.apply(&V[j * n], w);
+            for (int i = 0; i <= j; i++) {
+                h[i] = vectorDot(n, &V[i * n], w);
+                vectorAxpy(n, -h[i], &V[i * n], w);
+            }
+            h[j + 1] = std::sqrt(vectorDot(n, w, w));
+            bool breakdown = !(h[j + 1] > T(0)); // the Krylov space is invariant, the solution is exact
+            if (!breakdown) {
+                for (long long i = 0; i < n; i++) w[i] /= h[j + 1];
+            }
+            for (int i = 0; i < j; i++) {
+                T a = h[i], c = h[i + 1];
+                h[i] = cs[i] * a + sn[i] * c;
+                h[i + 1] = -sn[i] * a + cs[i] * c;
+            }
+            T r = std::hypot(h[j], h[j + 1]);
+            cs[j] = r > T(0) ? h[j] / r : T(1);
+            sn[j] = r > T(0) ? h[j + 1] / r : T(0);
+            h[j] = r;
+            h[j + 1] = T(0);
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+            j++;
+            stop = this->report(info, double(std::abs(g[j])) / normb) || breakdown;
+        }
+        // x += V(0:j)^T * y with H(0:j, 0:j) * y = g(0:j); g is reused for y
+        for (int i = j - 1; i >= 0; i--) {
+            for (int k = i + 1; k < j; k++) g[i] -= H[k * (m + 1) + i] * g[k];
+            g[i] = H[i * (m + 1) + i] != T(0) ? g[i] / H[i * (m + 1) + i] : T(0);
+        }
+        for (int i = 0; i < j; i++) vectorAxpy(n, g[i], &V[i * n], x);
+        if (stop) return info;
     }
-    return max;
 }
 
 #endif //MATRIX_MATRIX_HPP
\ No newline at end of file
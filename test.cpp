@@ -0,0 +1,827 @@
+#include "Matrix.hpp"
+#include <iostream>
+
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        cout << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// dense matrix with entries drawn uniformly from [-1, 1), reproducible from seed
+template<class T>
+static Mat<T> randomMat(int m, int n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    Mat<T> a(m, n);
+    for (int i = 1; i <= m; i++) {
+        for (int j = 1; j <= n; j++) a.set(i, j, T(dist(rng)));
+    }
+    return a;
+}
+
+// largest absolute difference of two matrices of the same shape, infinity if the shapes differ
+template<class T>
+static double maxDiff(const Mat<T> &a, const Mat<T> &b) {
+    if (a.row != b.row || a.col != b.col) return std::numeric_limits<double>::infinity();
+    double d = 0;
+    for (int i = 1; i <= a.row; i++) {
+        for (int j = 1; j <= a.col; j++) d = std::max(d, (double) std::abs(a.get(i, j) - b.get(i, j)));
+    }
+    return d;
+}
+
+// largest deviation of Q^T * Q from the identity
+template<class T>
+static double orthoError(const Mat<T> &Q) {
+    Mat<T> q = Q;
+    return maxDiff(q.transpose() * q, unitMatGen<T>(q.col));
+}
+
+// sparse 5-point Laplacian of an nx x ny grid; drift != 0 adds a first-order term that makes it nonsymmetric
+static Mat<double> gridLaplacian(int nx, int ny, double drift = 0) {
+    int n = nx * ny;
+    Mat<double> L(n, n, nullptr, true);
+    for (int x = 0; x < nx; x++) {
+        for (int y = 0; y < ny; y++) {
+            int i = x * ny + y + 1;
+            L.set(i, i, 4);
+            if (x > 0) L.set(i, i - ny, -1 - drift);
+            if (x + 1 < nx) L.set(i, i + ny, -1 + drift);
+            if (y > 0) L.set(i, i - 1, -1);
+            if (y + 1 < ny) L.set(i, i + 1, -1);
+        }
+    }
+    return L;
+}
+
+// a plan built for one sparsity pattern must not be applied to another with the same shape and nnz
+static void testSpGemmPlanPattern() {
+    Mat<double> A(2, 2, nullptr, true), A2(2, 2, nullptr, true), B(2, 2, nullptr, true);
+    A.set(1, 1, 1), A.set(2, 2, 2);
+    A2.set(1, 2, 3), A2.set(2, 1, 4);
+    B.set(1, 1, 1), B.set(2, 2, 1);
+    SpGemmPlan<double> plan = spgemmSymbolic(A, B);
+    Mat<double> C = spgemmNumeric(plan, A, B);
+    check(C.get(1, 1) == 1 && C.get(2, 2) == 2 && C.get(1, 2) == 0, "spgemm with its own plan");
+    bool thrown = false;
+    try {
+        spgemmNumeric(plan, A2, B);
+    } catch (InvalidDimensionsException &) {
+        thrown = true;
+    }
+    check(thrown, "spgemm plan rejects a different pattern");
+    Mat<double> C2 = spgemmNumeric(spgemmSymbolic(A2, B), A2, B);
+    check(C2.get(1, 2) == 3 && C2.get(2, 1) == 4 && C2.get(1, 1) == 0, "spgemm with a rebuilt plan");
+
+    // new values keep the pattern, and so does a clone; a new entry or a dropped one changes it
+    A.set(2, 2, 6);
+    Mat<double> Ac = A.clone();
+    C = spgemmNumeric(plan, Ac, B);
+    check(C.get(1, 1) == 1 && C.get(2, 2) == 6, "spgemm plan survives value updates and clones");
+    A.set(1, 2, 1);
+    A.csr();
+    thrown = false;
+    try {
+        spgemmNumeric(plan, A, B);
+    } catch (InvalidDimensionsException &) {
+        thrown = true;
+    }
+    check(thrown, "spgemm plan rejects an added entry");
+    Ac.set(1, 1, 0);
+    Ac.csr();
+    thrown = false;
+    try {
+        spgemmNumeric(plan, Ac, B);
+    } catch (InvalidDimensionsException &) {
+        thrown = true;
+    }
+    check(thrown, "spgemm plan rejects a dropped entry");
+
+    // a product large enough for several row blocks when threads exist: (L * L) * x = L * (L * x)
+    Mat<double> L = gridLaplacian(120, 100), LL = spgemmNumeric(spgemmSymbolic(L, L), L, L);
+    std::vector<double> x(L.col);
+    for (size_t i = 0; i < x.size(); i++) x[i] = std::sin((double) i);
+    Mat<double> Lx = L * x;
+    check(maxDiff(LL * x, L * Lx.getCol(1)) < 1e-12 && LL.nonZeros() == (L * L).nonZeros(), "spgemm of a Laplacian");
+}
+
+// point reads see staged writes, and writing zero over a stored entry removes it
+static void testSparseSetGet() {
+    Mat<double> A(3, 3, nullptr, true);
+    A.set(1, 1, 1), A.set(2, 3, 2);
+    check(A.nonZeros() == 2, "sparse nonzeros after compress");
+    A.set(3, 2, 5);
+    check(A.get(3, 2) == 5 && A.get(1, 1) == 1 && A.get(2, 2) == 0, "sparse get with staged writes");
+    A.set(3, 2, A.get(3, 2) + 1);
+    A.set(1, 1, 0);
+    A.set(2, 2, 0);
+    check(A.get(3, 2) == 6 && A.get(1, 1) == 0, "sparse get after overwrites");
+    check(A.nonZeros() == 2, "sparse set to zero drops the entry");
+    A.set(1, 1, 7);
+    check(A.get(1, 1) == 7 && A.nonZeros() == 3, "sparse set after the entry was dropped");
+}
+
+// Winograd only exists for float and double, other element types must still convolve on the direct path
+static void testConvLongDouble() {
+    Mat<long double> a(6, 6), k(3, 3);
+    for (int i = 1; i <= 6; i++) {
+        for (int j = 1; j <= 6; j++) a.set(i, j, i * 6 + j);
+    }
+    for (int i = 1; i <= 3; i++) {
+        for (int j = 1; j <= 3; j++) k.set(i, j, i == j ? 2 : i - j);
+    }
+    Mat<long double> d = a.conv(k, ConvMethod::Direct), w = a.conv(k, ConvMethod::Winograd);
+    bool same = true;
+    for (int i = 1; i <= 6; i++) {
+        for (int j = 1; j <= 6; j++) same = same && d.get(i, j) == w.get(i, j);
+    }
+    check(same, "long double conv falls back to direct");
+}
+
+// integer separable factors must not scale the result up by the pivot, and unsigned kernels must compile
+static void testConvIntegerSeparable() {
+    Mat<int> a(8, 8), k(3, 3);
+    for (int i = 1; i <= 8; i++) {
+        for (int j = 1; j <= 8; j++) a.set(i, j, 1000);
+    }
+    for (int i = 1; i <= 3; i++) {
+        for (int j = 1; j <= 3; j++) k.set(i, j, 50000);
+    }
+    check(a.conv(k).get(4, 4) == 450000000 && a.conv(k, ConvMethod::Direct).get(4, 4) == 450000000,
+          "integer separable conv without overflow");
+    Mat<unsigned> u(6, 6), ku(3, 3);
+    for (int i = 1; i <= 6; i++) {
+        for (int j = 1; j <= 6; j++) u.set(i, j, i + j);
+    }
+    for (int i = 1; i <= 3; i++) {
+        for (int j = 1; j <= 3; j++) ku.set(i, j, i * j);
+    }
+    Mat<unsigned> s = u.conv(ku), d = u.conv(ku, ConvMethod::Direct);
+    bool same = true;
+    for (int i = 1; i <= 6; i++) {
+        for (int j = 1; j <= 6; j++) same = same && s.get(i, j) == d.get(i, j);
+    }
+    check(same, "unsigned separable conv");
+}
+
+// writes through the unchecked accessors invalidate cached results, reads through const accessors keep them
+static void testCacheVersion() {
+    Mat<double> A(3, 3);
+    for (int i = 1; i <= 3; i++) {
+        for (int j = 1; j <= 3; j++) A.set(i, j, i == j ? 2 : 1);
+    }
+    double before = A.det();
+    unsigned long long v = A.version();
+    A.det();
+    A.normFro();
+    A.max();
+    A.transposed();
+    check(A.version() == v, "cached computations keep the version");
+    A(1, 1);
+    A.rowPtr(2);
+    A.colView(3);
+    check(A.getRow(2)[1] == 2 && A.getCol(3)[0] == 1, "getRow and getCol");
+    check(A.version() == v, "plain accessor reads keep the version");
+    A(1, 1) = 5;
+    A.touch();
+    check(A.det() != before, "touch() after a write invalidates the cached determinant");
+    double after = A.det();
+    A.set(2, 2, 7);
+    check(A.det() != after, "set() invalidates the cached determinant");
+}
+
+// an exception thrown by a chunk reaches the caller and leaves the thread outside the parallel region
+static void testParallelForException() {
+    bool caught = false;
+    try {
+        parallelFor(0, 1 << 16, 1, [](long long, long long hi) {
+            if (hi == 1 << 16) throw InvalidDimensionsException("chunk failed");
+        });
+    } catch (InvalidDimensionsException &) {
+        caught = true;
+    }
+    check(caught && !inParallelRegion(), "parallelFor propagates exceptions");
+    std::atomic<long long> sum{0};
+    parallelFor(0, 1000, 1, [&](long long lo, long long hi) {
+        for (long long i = lo; i < hi; i++) sum += i;
+    });
+    check(sum == 499500, "parallelFor after an exception");
+}
+
+// vector * sparse matrix against the dense product
+static void testSpmvTransposed() {
+    SparseBuilder<double> sb(300, 200);
+    for (int k = 0; k < 6000; k++) sb.add(k * 7 % 300 + 1, k * 13 % 200 + 1, k % 5 + 1);
+    Mat<double> S = sb.build(), D = S;
+    D.toDense();
+    std::vector<double> x(300);
+    for (int i = 0; i < 300; i++) x[i] = i % 11 - 5;
+    Mat<double> ys = x * S, yd = x * D;
+    bool same = true;
+    for (int j = 1; j <= 200; j++) same = same && std::abs(ys.get(1, j) - yd.get(1, j)) < 1e-9;
+    check(same, "vector times sparse matrix");
+}
+
+// max()/min() of dense matrices and strided submatrix views
+static void testDenseMaxMin() {
+    Mat<double> A(40, 37);
+    for (int i = 1; i <= 40; i++) {
+        for (int j = 1; j <= 37; j++) A.set(i, j, (i * 53 + j * 17) % 101 - 50.5);
+    }
+    A.set(23, 5, 1000);
+    A.set(7, 30, -1000);
+    check(A.max() == 1000 && A.min() == -1000, "dense max and min");
+    Mat<double> V = A.getSubmatrix(2, 39, 2, 36);
+    V.set(1, 1, 2000);
+    check(V.max() == 2000 && V.min() == -1000, "max and min of a submatrix view");
+}
+
+// FFT convolution against the direct path for odd and prime image and kernel sizes (odd FFT lengths leave the last
+// spectrum row unpaired)
+static void testConvFFTOddSizes() {
+    int sizes[][4] = {{5, 5, 21, 21}, {7, 11, 13, 17}, {13, 3, 23, 19}, {31, 29, 5, 7}, {1, 17, 1, 23}};
+    for (auto &sz: sizes) {
+        Mat<double> a = randomMat<double>(sz[0], sz[1], 11), k = randomMat<double>(sz[2], sz[3], 12);
+        for (ConvShape shape: {ConvShape::Same, ConvShape::Valid, ConvShape::Full}) {
+            Mat<double> f = a.conv(k, ConvBorder::Zero, shape, ConvMethod::FFT);
+            Mat<double> d = a.conv(k, ConvBorder::Zero, shape, ConvMethod::Direct);
+            check(maxDiff(f, d) < 1e-9, "FFT conv matches direct for odd sizes");
+        }
+    }
+}
+
+// blocked GEMM against a plain triple loop; sizes straddle MR / NR and the MC / KC blocks, A is read transposed
+// and C has a leading dimension wider than n, so the packing edges and the alpha / beta update are all exercised
+template<class T>
+static void testGemmEdges(double tol) {
+    long long sizes[][3] = {{7, 9, 5}, {13, 3, 17}, {131, 67, 259}, {257, 11, 389}};
+    std::mt19937 rng(21);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (auto &sz: sizes) {
+        long long m = sz[0], n = sz[1], k = sz[2], ldc = n + 3;
+        std::vector<T> At(k * m), B(k * n), C(m * ldc);
+        for (T &v: At) v = T(dist(rng));
+        for (T &v: B) v = T(dist(rng));
+        for (T &v: C) v = T(dist(rng));
+        std::vector<T> ref = C;
+        T alpha = T(1.5), beta = T(0.5);
+        for (long long i = 0; i < m; i++) {
+            for (long long j = 0; j < n; j++) {
+                long double sum = 0;
+                for (long long p = 0; p < k; p++) sum += (long double) At[p * m + i] * B[p * n + j];
+                ref[i * ldc + j] = T(alpha * sum + beta * (long double) C[i * ldc + j]);
+            }
+        }
+        gemm<T>(m, n, k, alpha, At.data(), 1, m, B.data(), n, 1, beta, C.data(), ldc);
+        double err = 0;
+        for (long long i = 0; i < m; i++) {
+            for (long long j = 0; j < ldc; j++) err = std::max(err, (double) std::abs(C[i * ldc + j] - ref[i * ldc + j]));
+        }
+        check(err < tol * (double) k, "blocked gemm matches the reference product");
+    }
+}
+
+// LU solve and inverse residuals past one LU_BLOCK panel, the determinant sign under row swaps, and a tiny pivot
+// that only counts against rank()
+static void testLU() {
+    const int n = 150;
+    Mat<double> A = randomMat<double>(n, n, 31), B = randomMat<double>(n, 3, 32);
+    LU<double> lu(A);
+    check(lu.isInvertible() && lu.rank() == n, "LU of a random matrix has full rank");
+    check(maxDiff(A * lu.solve(B), B) < 1e-10, "LU solve residual");
+    check(maxDiff(A * lu.inverse(), unitMatGen<double>(n)) < 1e-10, "LU inverse residual");
+
+    Mat<double> P(3, 3);
+    P.set(1, 2, 2);
+    P.set(2, 3, 3);
+    P.set(3, 1, 1);
+    check(std::abs(LU<double>(P).det() - 6) < 1e-12, "det of a permuted diagonal");
+    Mat<double> S = A.clone();
+    std::swap_ranges(S.rowPtr(1), S.rowPtr(1) + n, S.rowPtr(2));
+    double d = lu.det();
+    check(d != 0 && std::abs(LU<double>(S).det() + d) < 1e-10 * std::abs(d), "a row swap negates det");
+
+    Mat<double> D(2, 2);
+    D.set(1, 1, 1);
+    D.set(2, 2, 1e-20);
+    LU<double> tiny(D);
+    check(tiny.det() == 1e-20 && tiny.rank() == 1, "a tiny pivot keeps det but not rank");
+    check(tiny.inverse().get(2, 2) == 1e20, "a tiny pivot is still invertible");
+    Mat<double> Z(2, 2);
+    Z.set(1, 1, 1);
+    Z.set(1, 2, 2);
+    bool thrown = false;
+    try {
+        LU<double>(Z).inverse();
+    } catch (Inverse_NotInvertible &) {
+        thrown = true;
+    }
+    check(thrown && LU<double>(Z).det() == 0, "an exactly zero pivot is singular");
+}
+
+// solve(A, B) for one and many right-hand sides: n straddles TRSM_BLOCK, and B is wider than a block and than the
+// 2 * 256 columns trsm() splits across threads
+static void testSolveMultiColumn() {
+    const int n = 137;
+    Mat<double> A = randomMat<double>(n, n, 41);
+    for (int nrhs: {1, 5, 70, 600}) {
+        Mat<double> B = randomMat<double>(n, nrhs, 42);
+        Mat<double> X = solve(A, B);
+        check(X.row == n && X.col == nrhs && maxDiff(A * X, B) < 1e-9, "solve residual for several right-hand sides");
+    }
+}
+
+// Householder QR on tall, square and wide shapes (several QR_BLOCK panels), a zero column that gets tau = 0, and
+// least squares on a tall system
+static void testHouseholderQR() {
+    int shapes[][2] = {{97, 40}, {33, 33}, {30, 75}};
+    for (auto &sh: shapes) {
+        Mat<double> A = randomMat<double>(sh[0], sh[1], 51);
+        HouseholderQR<double> qr(A);
+        for (bool thin: {true, false}) {
+            Mat<double> Q = qr.Q(thin);
+            check(maxDiff(Q * qr.R(thin), A) < 1e-12, "QR reconstructs A");
+            check(orthoError(Q) < 1e-12, "Q is orthonormal");
+        }
+    }
+
+    Mat<double> Z = randomMat<double>(60, 20, 52);
+    for (int i = 1; i <= Z.row; i++) Z.set(i, 5, 0);
+    HouseholderQR<double> zq(Z);
+    check(maxDiff(zq.Q() * zq.R(), Z) < 1e-12 && orthoError(zq.Q(false)) < 1e-12, "QR with a zero column");
+    bool thrown = false;
+    try {
+        zq.solve(randomMat<double>(60, 1, 53));
+    } catch (Inverse_NotInvertible &) {
+        thrown = true;
+    }
+    check(thrown, "least squares rejects a rank deficient A");
+
+    Mat<double> A = randomMat<double>(97, 40, 54), B = randomMat<double>(97, 2, 55);
+    Mat<double> X = HouseholderQR<double>(A).solve(B);
+    Mat<double> At = A.transpose();
+    check(maxDiff(At * (A * X - B), Mat<double>(40, 2)) < 1e-10, "least-squares residual is orthogonal to A");
+    Mat<double> X0 = randomMat<double>(40, 3, 56);
+    check(maxDiff(HouseholderQR<double>(A).solve(A * X0), X0) < 1e-10, "least squares recovers a consistent system");
+    thrown = false;
+    try {
+        HouseholderQR<double>(randomMat<double>(30, 75, 57)).solve(randomMat<double>(30, 1, 58));
+    } catch (InvalidDimensionsException &) {
+        thrown = true;
+    }
+    check(thrown, "least squares rejects a wide A");
+}
+
+// symmetric eigen decomposition across several TRIDIAG_BLOCK panels and QL_SWEEPS batches: A * V = V * D, V^T * V = I
+static void testSymmetricEigen() {
+    for (int n: {1, 7, 90}) {
+        Mat<double> S = randomMat<double>(n, n, 61);
+        Mat<double> A = S + S.transpose();
+        SymmetricEigen<double> es(A);
+        Mat<double> V = es.vectors(), VD = V.clone();
+        const std::vector<double> &d = es.values();
+        for (int i = 1; i <= n; i++) {
+            for (int j = 1; j <= n; j++) VD(i, j) *= d[j - 1];
+        }
+        check(std::is_sorted(d.begin(), d.end()), "symmetric eigenvalues are ascending");
+        check(maxDiff(A * V, VD) < 1e-11, "A * V = V * D");
+        check(orthoError(V) < 1e-12, "symmetric eigenvectors are orthonormal");
+    }
+}
+
+// general eigen decomposition of a matrix with complex-conjugate pairs: A * z = lambda * z for every column
+static void testGeneralEigen() {
+    const int n = 12;
+    Mat<double> A = randomMat<double>(n, n, 71);
+    A.set(1, 2, -3); // rotation-like block, guarantees a complex pair even if the rest were real
+    A.set(2, 1, 3);
+    GeneralEigen<double> ge(A);
+    std::vector<std::complex<double>> lambda = ge.values();
+    Mat<std::complex<double>> Z = ge.vectors();
+    check(!ge.isReal(), "a rotation block gives complex eigenvalues");
+    double err = 0;
+    for (int j = 1; j <= n; j++) {
+        for (int i = 1; i <= n; i++) {
+            std::complex<double> az = 0;
+            for (int k = 1; k <= n; k++) az += A.get(i, k) * Z.get(k, j);
+            err = std::max(err, std::abs(az - lambda[j - 1] * Z.get(i, j)));
+        }
+    }
+    check(err < 1e-10, "A * z = lambda * z for every eigenvector");
+    int pairs = 0;
+    for (int j = 0; j < n; j++) {
+        if (lambda[j].imag() == 0) continue;
+        bool conj = false;
+        for (int k = 0; k < n; k++) conj = conj || (k != j && std::abs(lambda[k] - std::conj(lambda[j])) < 1e-12);
+        pairs += conj;
+    }
+    check(pairs > 0 && pairs % 2 == 0, "complex eigenvalues come in conjugate pairs");
+    bool thrown = false;
+    try {
+        ge.realVectors();
+    } catch (Eigen_ComplexSpectrum &) {
+        thrown = true;
+    }
+    check(thrown, "realVectors() throws for a complex spectrum");
+}
+
+// Lanczos and Arnoldi on a sparse Laplacian against the dense eigensolvers, at both ends of the spectrum
+static void testKrylovEigen() {
+    const int nev = 3;
+    Mat<double> L = gridLaplacian(12, 10), D = L.clone();
+    D.toDense();
+    std::vector<double> all = SymmetricEigen<double>(D, false).values();
+    for (EigenTarget target: {EigenTarget::LargestAlgebraic, EigenTarget::SmallestAlgebraic}) {
+        bool largest = target == EigenTarget::LargestAlgebraic;
+        Lanczos<double> lz(L, nev, target, 40);
+        double err = 0;
+        for (int i = 0; i < nev; i++) {
+            double want = largest ? all[all.size() - 1 - i] : all[i];
+            err = std::max(err, std::abs(lz.values()[i] - want));
+        }
+        Mat<double> X = lz.vectors(), LX = L * X;
+        for (int i = 1; i <= X.row; i++) {
+            for (int j = 1; j <= nev; j++) err = std::max(err, std::abs(LX.get(i, j) - lz.values()[j - 1] * X.get(i, j)));
+        }
+        check(lz.converged() && err < 1e-8, "Lanczos matches the dense symmetric eigensolver");
+    }
+
+    Mat<double> N = gridLaplacian(12, 10, 0.3), ND = N.clone();
+    ND.toDense();
+    std::vector<std::complex<double>> general = GeneralEigen<double>(ND, false).values();
+    std::sort(general.begin(), general.end(), [](auto a, auto b) { return a.real() < b.real(); });
+    for (EigenTarget target: {EigenTarget::LargestAlgebraic, EigenTarget::SmallestAlgebraic}) {
+        bool largest = target == EigenTarget::LargestAlgebraic;
+        Arnoldi<double> ar(N, nev, target, 40);
+        double err = 0;
+        for (int i = 0; i < nev; i++) {
+            std::complex<double> want = largest ? general[general.size() - 1 - i] : general[i];
+            err = std::max(err, std::abs(ar.values()[i] - want));
+        }
+        check(ar.converged() && err < 1e-8, "Arnoldi matches the dense general eigensolver");
+    }
+}
+
+// ||b - A * x|| / ||b|| for n x 1 b and x
+static double relativeResidual(const Mat<double> &A, const Mat<double> &b, const Mat<double> &x) {
+    return (b - A * x).normFro() / Mat<double>(b).normFro();
+}
+
+// CG, BiCGSTAB and GMRES reach the requested true residual, report it, and stop at maxIterations otherwise
+static void testKrylovSolvers() {
+    Mat<double> S = gridLaplacian(20, 20), N = gridLaplacian(20, 20, 0.4);
+    Mat<double> b = randomMat<double>(400, 1, 81), x;
+
+    ConjugateGradient<double> cg(S, 1e-10);
+    SolverInfo info = cg.solve(b, x);
+    check(info.converged && info.iterations > 1 && info.iterations <= 400 && info.residual <= 1e-10,
+          "CG converges on an SPD Laplacian");
+    check(relativeResidual(S, b, x) < 1e-9, "CG true residual");
+
+    BiCGSTAB<double> bicg(N, 1e-10);
+    info = bicg.solve(b, x = Mat<double>());
+    check(info.converged && info.iterations <= 400 && relativeResidual(N, b, x) < 1e-9, "BiCGSTAB true residual");
+
+    GMRES<double> gmres(N, 10, 1e-10);
+    info = gmres.solve(b, x = Mat<double>());
+    check(info.converged && info.iterations > 10, "restarted GMRES converges over several cycles");
+    check(relativeResidual(N, b, x) < 1e-9, "GMRES true residual");
+
+    GMRES<double> capped(N, 10, 1e-10, 7);
+    info = capped.solve(b, x = Mat<double>());
+    check(!info.converged && info.iterations == 7 && info.residual > 1e-10, "GMRES stops at maxIterations");
+    int calls = 0;
+    cg.monitor = [&](int, double) { return ++calls < 3; };
+    info = cg.solve(b, x = Mat<double>());
+    check(!info.converged && info.iterations == 3 && calls == 3, "a monitor returning false stops CG");
+}
+
+// PCG with every preconditioner, the IC(0) diagonal shift on Kershaw's matrix, and the level-scheduled triangular solve
+static void testPreconditioners() {
+    Mat<double> S = gridLaplacian(20, 20), b = randomMat<double>(400, 1, 91), x;
+    int plain = ConjugateGradient<double>(S).solve(b, x).iterations;
+    std::pair<const char *, std::shared_ptr<const Preconditioner<double>>> pcs[] = {
+            {"PCG with Jacobi",  std::make_shared<JacobiPreconditioner<double>>(S)},
+            {"PCG with SSOR",    std::make_shared<SSORPreconditioner<double>>(S, 1.5)},
+            {"PCG with ILU(0)",  std::make_shared<ILUPreconditioner<double>>(S)},
+            {"PCG with IC(0)",   std::make_shared<ICPreconditioner<double>>(S)}};
+    for (auto &pc: pcs) {
+        ConjugateGradient<double> pcg(S, pc.second);
+        SolverInfo info = pcg.solve(b, x = Mat<double>());
+        check(info.converged && info.iterations <= plain && relativeResidual(S, b, x) < 1e-9, pc.first);
+    }
+
+    // symmetric positive definite, but IC(0) meets a negative pivot without a shift
+    double k[4][4] = {{3, -2, 0, 2}, {-2, 3, -2, 0}, {0, -2, 3, -2}, {2, 0, -2, 3}};
+    Mat<double> K(4, 4, nullptr, true);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) K.set(i + 1, j + 1, k[i][j]);
+    }
+    auto ic = std::make_shared<ICPreconditioner<double>>(K);
+    Mat<double> kb = randomMat<double>(4, 1, 92);
+    ConjugateGradient<double> kcg(K, ic);
+    SolverInfo info = kcg.solve(kb, x = Mat<double>());
+    check(ic->diagonalShift() > 0 && info.converged && relativeResidual(K, kb, x) < 1e-9, "IC(0) with a diagonal shift");
+
+    // four levels of 1024 independent rows: row i depends on row i - 1024, solved level by level when threads exist
+    const int n = 4096;
+    Mat<double> T(n, n, nullptr, true);
+    std::vector<double> rhs(n), want(n), got(n);
+    for (int i = 0; i < n; i++) {
+        T.set(i + 1, i + 1, 2 + i % 3);
+        if (i >= 1024) T.set(i + 1, i - 1023, 0.5 - (i % 7) * 0.1);
+        rhs[i] = std::sin(i);
+    }
+    for (int i = 0; i < n; i++) {
+        want[i] = (rhs[i] - (i >= 1024 ? T.get(i + 1, i - 1023) * want[i - 1024] : 0)) / T.get(i + 1, i + 1);
+    }
+    TriangularFactor<double> tf(T.csr(), true, false);
+    tf.solve(rhs.data(), got.data());
+    double err = 0;
+    for (int i = 0; i < n; i++) err = std::max(err, std::abs(got[i] - want[i]));
+    check(tf.levels() == 4 && err < 1e-14, "level-scheduled triangular solve");
+    tf.solve(rhs.data(), rhs.data());
+    check(rhs == got, "triangular solve in place");
+}
+
+// Cholesky and LDL^T past one CHOLESKY_BLOCK panel: solve residuals, logDet against logAbsDet and LU, and a symmetric
+// quasi-definite matrix that LDL^T factors and Cholesky rejects
+static void testCholeskyLDLT() {
+    const int n = 150;
+    Mat<double> G = randomMat<double>(n, n, 101);
+    Mat<double> A = G * G.transpose() + double(n) * unitMatGen<double>(n), B = randomMat<double>(n, 4, 102);
+    Cholesky<double> ch(A);
+    LDLT<double> ld(A);
+    check(ch.isPositiveDefinite() && ld.isFactored() && ld.isPositiveDefinite(), "SPD matrix factors");
+    Mat<double> L = ch.lower();
+    check(maxDiff(L * L.transpose(), A) < 1e-9 * n, "L * L^T = A");
+    check(maxDiff(A * ch.solve(B), B) < 1e-10 && maxDiff(A * ld.solve(B), B) < 1e-10, "Cholesky and LDLT solve residual");
+    check(std::abs(ch.logDet() - ld.logAbsDet()) < 1e-9 * std::abs(ch.logDet()) && ld.detSign() == 1,
+          "logDet equals logAbsDet for an SPD matrix");
+    Mat<double> small = randomMat<double>(20, 20, 103);
+    small = small * small.transpose() + 20.0 * unitMatGen<double>(20);
+    check(std::abs(Cholesky<double>(small).logDet() - std::log(LU<double>(small).det())) < 1e-10, "logDet matches LU");
+
+    // [[P, C], [C^T, -Q]] with P, Q positive definite: det sign (-1)^q
+    const int p = 30, q = 7;
+    Mat<double> Q = randomMat<double>(p + q, p + q, 104);
+    Mat<double> K = Q * Q.transpose() + double(p + q) * unitMatGen<double>(p + q);
+    for (int i = p + 1; i <= p + q; i++) {
+        for (int j = p + 1; j <= p + q; j++) K.set(i, j, -K.get(i, j));
+    }
+    LDLT<double> kl(K);
+    Mat<double> kb = randomMat<double>(p + q, 2, 105);
+    check(kl.isFactored() && !kl.isPositiveDefinite() && kl.detSign() == (q % 2 ? -1 : 1), "LDLT of a quasi-definite matrix");
+    check(maxDiff(K * kl.solve(kb), kb) < 1e-10, "LDLT solve residual for an indefinite matrix");
+    check(std::abs(kl.logAbsDet() - std::log(std::abs(LU<double>(K).det()))) < 1e-9, "logAbsDet matches LU");
+    Cholesky<double> kc(K);
+    int thrown = 0;
+    try {
+        kc.solve(kb);
+    } catch (Cholesky_NotPositiveDefinite &) {
+        thrown++;
+    }
+    try {
+        kc.logDet();
+    } catch (Cholesky_NotPositiveDefinite &) {
+        thrown++;
+    }
+    check(!kc.isPositiveDefinite() && thrown == 2, "Cholesky rejects an indefinite matrix");
+}
+
+// SVD with both methods in thin and full mode on tall, square and wide inputs (wide ones go through A^T):
+// U * S * V^T = A, orthonormal U and V, the Penrose conditions for pinv(), and rank() of a low-rank product
+static void testSVD() {
+    int shapes[][2] = {{70, 30}, {25, 25}, {20, 55}};
+    for (auto &sh: shapes) {
+        Mat<double> A = randomMat<double>(sh[0], sh[1], 111);
+        std::vector<double> reference;
+        for (SVDMethod method: {SVDMethod::GolubKahan, SVDMethod::Jacobi}) {
+            for (bool thin: {true, false}) {
+                SVD<double> svd(A, thin, true, method);
+                const std::vector<double> &sv = svd.singularValues();
+                Mat<double> U = svd.U(), V = svd.V(), S(U.col, V.col);
+                for (int i = 0; i < (int) sv.size(); i++) S.set(i + 1, i + 1, sv[i]);
+                check(U.row == A.row && V.row == A.col && U.col == (thin ? (int) sv.size() : A.row), "SVD factor shapes");
+                check(std::is_sorted(sv.rbegin(), sv.rend()), "singular values are descending");
+                check(maxDiff(U * S * V.transpose(), A) < 1e-12, "U * S * V^T = A");
+                check(orthoError(U) < 1e-12 && orthoError(V) < 1e-12, "U and V are orthonormal");
+                if (reference.empty()) reference = sv;
+                double d = 0;
+                for (size_t i = 0; i < sv.size(); i++) d = std::max(d, std::abs(sv[i] - reference[i]));
+                check(d < 1e-12, "both SVD methods give the same singular values");
+                Mat<double> P = svd.pinv();
+                check(maxDiff(A * P * A, A) < 1e-11 && maxDiff(P * A * P, P) < 1e-11, "pinv satisfies A P A = A, P A P = P");
+            }
+        }
+    }
+    Mat<double> X = randomMat<double>(60, 5, 112), Y = randomMat<double>(5, 40, 113), R = X * Y;
+    check(SVD<double>(R, true, false).rank() == 5 && SVD<double>(R, true, false, SVDMethod::Jacobi).rank() == 5,
+          "SVD rank of a rank-5 product");
+    check(R.rank() == 5 && R.transpose().rank() == 5, "Mat::rank of a rank-5 product");
+}
+
+// randomized SVD of an exactly rank-8 matrix, dense and sparse, recovers the leading singular values of the full SVD
+// and reconstructs A
+static void testRandomizedSVD() {
+    const int r = 8;
+    Mat<double> A = randomMat<double>(200, r, 121) * randomMat<double>(r, 120, 122);
+    std::vector<double> full = SVD<double>(A, true, false).singularValues();
+    Mat<double> sparse = A.clone();
+    sparse.toSparse();
+    for (const Mat<double> &input: {A, sparse}) {
+        RandomizedSVD<double> rs(input, r, 10, 2, 7);
+        const std::vector<double> &sv = rs.singularValues();
+        double d = 0;
+        for (int i = 0; i < r; i++) d = std::max(d, std::abs(sv[i] - full[i]) / full[0]);
+        check((int) sv.size() == r && d < 1e-12, "randomized SVD matches the full singular values");
+        Mat<double> U = rs.U(), V = rs.V(), S(r, r);
+        for (int i = 0; i < r; i++) S.set(i + 1, i + 1, sv[i]);
+        check(maxDiff(U * S * V.transpose(), A) < 1e-11, "randomized SVD reconstructs a low-rank A");
+        check(orthoError(U) < 1e-12 && orthoError(V) < 1e-12, "randomized singular vectors are orthonormal");
+    }
+}
+
+// sample of a at (i, j) under a border mode, by stepping back into the image one reflection at a time
+static double borderSample(const Mat<double> &a, long long i, long long j, ConvBorder border) {
+    long long idx[2] = {i, j}, len[2] = {a.row, a.col};
+    for (int d = 0; d < 2; d++) {
+        long long &x = idx[d], n = len[d];
+        if (x >= 0 && x < n) continue;
+        if (border == ConvBorder::Zero) return 0;
+        if (border == ConvBorder::Replicate) x = x < 0 ? 0 : n - 1;
+        if (border == ConvBorder::Wrap) x = (x % n + n) % n;
+        while (border == ConvBorder::Reflect && (x < 0 || x >= n)) x = n == 1 ? 0 : x < 0 ? -x : 2 * (n - 1) - x;
+    }
+    return a.get((int) idx[0] + 1, (int) idx[1] + 1);
+}
+
+// conv() as the plain sliding-window sum, the kernel anchored like ConvShape asks
+static Mat<double> convReference(const Mat<double> &a, const Mat<double> &k, ConvBorder border, ConvShape shape) {
+    long long rows = a.row, cols = a.col, oy = k.row / 2, ox = k.col / 2;
+    if (shape == ConvShape::Valid) {
+        rows = std::max<long long>(0, a.row - k.row + 1), cols = std::max<long long>(0, a.col - k.col + 1);
+        oy = ox = 0;
+    } else if (shape == ConvShape::Full) {
+        rows = a.row + k.row - 1, cols = a.col + k.col - 1, oy = k.row - 1, ox = k.col - 1;
+    }
+    Mat<double> out((int) rows, (int) cols);
+    for (long long i = 0; i < rows; i++) {
+        for (long long j = 0; j < cols; j++) {
+            double sum = 0;
+            for (int m = 0; m < k.row; m++) {
+                for (int n = 0; n < k.col; n++) {
+                    sum += k.get(m + 1, n + 1) * borderSample(a, i - oy + m, j - ox + n, border);
+                }
+            }
+            out.set((int) i + 1, (int) j + 1, sum);
+        }
+    }
+    return out;
+}
+
+// every border mode and output shape of every method against the reference loop; the images include one smaller
+// than the kernel (several reflections deep) and one spanning more than one CONV_TILE_ROWS x CONV_TILE_COLS tile
+static void testConvBordersShapes() {
+    int images[][2] = {{3, 2}, {9, 14}, {40, 530}};
+    Mat<double> general = randomMat<double>(5, 4, 131), square = randomMat<double>(3, 3, 132);
+    Mat<double> rank1 = randomMat<double>(5, 1, 133) * randomMat<double>(1, 3, 134);
+    std::pair<ConvMethod, const Mat<double> *> runs[] = {{ConvMethod::Direct,    &general},
+                                                         {ConvMethod::FFT,       &general},
+                                                         {ConvMethod::Separable, &rank1},
+                                                         {ConvMethod::Winograd,  &square}};
+    for (auto &im: images) {
+        Mat<double> a = randomMat<double>(im[0], im[1], 135);
+        for (ConvBorder border: {ConvBorder::Zero, ConvBorder::Replicate, ConvBorder::Reflect, ConvBorder::Wrap}) {
+            for (ConvShape shape: {ConvShape::Same, ConvShape::Valid, ConvShape::Full}) {
+                for (auto &run: runs) {
+                    Mat<double> want = convReference(a, *run.second, border, shape);
+                    check(maxDiff(a.conv(*run.second, border, shape, run.first), want) < 1e-12,
+                          "conv matches the reference loop for every border and shape");
+                }
+            }
+        }
+    }
+}
+
+// a ConvPlan batch equals conv() image by image, and apply() honors the row stride of submatrix views on both sides
+static void testConvPlanBatch() {
+    const int rows = 13, cols = 17, count = 5;
+    Mat<double> general = randomMat<double>(5, 4, 141), square = randomMat<double>(3, 3, 142);
+    Mat<double> rank1 = randomMat<double>(5, 1, 143) * randomMat<double>(1, 3, 144);
+    std::pair<ConvMethod, const Mat<double> *> runs[] = {{ConvMethod::Direct,    &general},
+                                                         {ConvMethod::FFT,       &general},
+                                                         {ConvMethod::Separable, &rank1},
+                                                         {ConvMethod::Winograd,  &square}};
+    std::vector<Mat<double>> images;
+    std::vector<double> packed;
+    for (int b = 0; b < count; b++) {
+        images.push_back(randomMat<double>(rows, cols, 145 + b));
+        for (int i = 1; i <= rows; i++) packed.insert(packed.end(), images[b].rowPtr(i), images[b].rowPtr(i) + cols);
+    }
+    for (auto &run: runs) {
+        for (ConvShape shape: {ConvShape::Same, ConvShape::Valid}) {
+            ConvPlan<double> plan(*run.second, rows, cols, ConvBorder::Reflect, shape, run.first);
+            int outRows = plan.outputRows(), outCols = plan.outputCols();
+            std::vector<double> outputs((size_t) count * outRows * outCols);
+            plan.apply(packed.data(), outputs.data(), count);
+            double err = 0;
+            for (int b = 0; b < count; b++) {
+                Mat<double> want = images[b].conv(*run.second, ConvBorder::Reflect, shape, run.first);
+                for (int i = 1; i <= outRows; i++) {
+                    for (int j = 1; j <= outCols; j++) {
+                        double got = outputs[((size_t) b * outRows + i - 1) * outCols + j - 1];
+                        err = std::max(err, std::abs(got - want(i, j)));
+                    }
+                }
+            }
+            check(err < 1e-12, "ConvPlan batch equals per-image conv");
+
+            Mat<double> parent(outRows + 6, outCols + 9), big = randomMat<double>(rows + 4, cols + 7, 150);
+            for (int i = 1; i <= parent.row; i++) std::fill(parent.rowPtr(i), parent.rowPtr(i) + parent.col, 7.0);
+            Mat<double> view = parent.getSubmatrix(3, outRows + 2, 5, outCols + 4);
+            Mat<double> image = big.getSubmatrix(2, rows + 1, 4, cols + 3);
+            plan.apply(image, view);
+            bool untouched = true;
+            for (int i = 1; i <= parent.row; i++) {
+                for (int j = 1; j <= parent.col; j++) {
+                    bool inside = i >= 3 && i < outRows + 3 && j >= 5 && j < outCols + 5;
+                    untouched = untouched && (inside || parent(i, j) == 7.0);
+                }
+            }
+            Mat<double> want = image.clone().conv(*run.second, ConvBorder::Reflect, shape, run.first);
+            check(maxDiff(view, want) < 1e-12 && untouched, "ConvPlan writes through the output stride only");
+        }
+    }
+}
+
+// one Winograd tile kernel F(M x M, R x R) against the direct tile kernel on a valid nr x nc block
+template<class T, int M, int R>
+static double winogradTileError(long long nr, long long nc) {
+    Mat<T> src = randomMat<T>((int) nr + R - 1, (int) nc + R - 1, 161), k = randomMat<T>(R, R, 162);
+    Mat<T> got((int) nr, (int) nc), want((int) nr, (int) nc);
+    std::vector<T> U = winogradKernel<T, M, R>(k.pData.get(), k.step);
+    convWinogradTile<T, M, R>(src.pData.get(), src.step, nr, nc, U.data(), k.pData.get(), k.step, got.pData.get(),
+                              got.step);
+    convDirectTile(src.pData.get(), src.step, nr, nc, R, R, k.pData.get(), k.step, want.pData.get(), want.step);
+    return maxDiff(got, want);
+}
+
+// F(2 x 2, 3 x 3), F(4 x 4, 3 x 3) and F(2 x 2, 5 x 5) against Direct on odd output sizes, wide enough for whole
+// groups of SIMD lanes (up to 16 tiles of 4 columns); then the tile ConvPlan picks for the type, through conv()
+template<class T>
+static void testWinograd(double tol) {
+    long long sizes[][2] = {{13, 135}, {7, 71}, {3, 5}, {1, 3}}; // 135 and 71 leave a partial SIMD group
+    for (auto &sz: sizes) {
+        check(winogradTileError<T, 2, 3>(sz[0], sz[1]) < tol, "F(2 x 2, 3 x 3) matches direct");
+        check(winogradTileError<T, 4, 3>(sz[0], sz[1]) < 10 * tol, "F(4 x 4, 3 x 3) matches direct");
+        check(winogradTileError<T, 2, 5>(sz[0], sz[1]) < tol, "F(2 x 2, 5 x 5) matches direct");
+    }
+    Mat<T> a = randomMat<T>(41, 203, 163);
+    for (int r: {3, 5}) {
+        Mat<T> k = randomMat<T>(r, r, 164);
+        for (ConvShape shape: {ConvShape::Same, ConvShape::Valid, ConvShape::Full}) {
+            ConvPlan<T> plan(k, a.row, a.col, ConvBorder::Zero, shape, ConvMethod::Winograd);
+            Mat<T> d = a.conv(k, ConvBorder::Zero, shape, ConvMethod::Direct);
+            check(plan.resolvedMethod() == ConvMethod::Winograd && maxDiff(plan.apply(a), d) < 10 * tol,
+                  "Winograd conv matches direct");
+        }
+    }
+}
+
+int main() {
+    testSpGemmPlanPattern();
+    testSparseSetGet();
+    testConvLongDouble();
+    testConvIntegerSeparable();
+    testCacheVersion();
+    testParallelForException();
+    testSpmvTransposed();
+    testDenseMaxMin();
+    testConvFFTOddSizes();
+    testGemmEdges<float>(1e-6);
+    testGemmEdges<double>(1e-14);
+    testLU();
+    testSolveMultiColumn();
+    testHouseholderQR();
+    testSymmetricEigen();
+    testGeneralEigen();
+    testKrylovEigen();
+    testKrylovSolvers();
+    testPreconditioners();
+    testCholeskyLDLT();
+    testSVD();
+    testRandomizedSVD();
+    testConvBordersShapes();
+    testConvPlanBatch();
+    testWinograd<float>(1e-5);
+    testWinograd<double>(1e-13);
+    if (failures == 0) cout << "all tests passed\n";
+    return failures == 0 ? 0 : 1;
+}